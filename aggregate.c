@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <float.h>
+#include "aggregate.h"
+
+// Resets an aggregate to the empty set
+void aggregateInit(nodeAggregate *agg) {
+    agg->count = 0;
+
+    for (int i = 0; i < AGG_MAX_COLUMNS; i++) {
+        agg->sum[i] = 0;
+        agg->min[i] = DBL_MAX;
+        agg->max[i] = -DBL_MAX;
+        agg->present[i] = 0;
+    }
+}
+
+// Adds one datapoint's values to an aggregate
+void aggregateAdd(nodeAggregate *agg, int numColumns, const double *values) {
+    agg->count++;
+
+    for (int i = 0; i < numColumns; i++) {
+        agg->sum[i] += values[i];
+        if (values[i] < agg->min[i]) {
+            agg->min[i] = values[i];
+        }
+        if (values[i] > agg->max[i]) {
+            agg->max[i] = values[i];
+        }
+        agg->present[i] |= aggregateCategoryBit(values[i]);
+    }
+}
+
+// Adds every datapoint summarised by another aggregate
+void aggregateMerge(nodeAggregate *agg, int numColumns, const nodeAggregate *other) {
+    agg->count += other->count;
+
+    for (int i = 0; i < numColumns; i++) {
+        agg->sum[i] += other->sum[i];
+        if (other->min[i] < agg->min[i]) {
+            agg->min[i] = other->min[i];
+        }
+        if (other->max[i] > agg->max[i]) {
+            agg->max[i] = other->max[i];
+        }
+        agg->present[i] |= other->present[i];
+    }
+}
+
+// Returns the presence mask bit standing for a value
+uint64_t aggregateCategoryBit(double value) {
+    if (value >= 0 && value < AGG_CATEGORY_OVERFLOW && value == (int)value) {
+        return 1ULL << (int)value;
+    }
+
+    return 1ULL << AGG_CATEGORY_OVERFLOW;
+}
+
+// Adds a datapoint to an aggregate if the spec counts it
+void aggregateAddPoint(nodeAggregate *agg, aggregateSpec *spec, struct point_t *point) {
+    double values[AGG_MAX_COLUMNS];
+
+    if (spec->pointValues(point, spec, values)) {
+        aggregateAdd(agg, spec->numColumns, values);
+    }
+}
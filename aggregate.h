@@ -0,0 +1,55 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Most numeric columns a tree can keep summaries of */
+#define AGG_MAX_COLUMNS 8
+
+/* Values 0 to AGG_CATEGORY_OVERFLOW - 1 each have a bit in a summary's presence mask;
+every other value shares the overflow bit */
+#define AGG_CATEGORY_OVERFLOW 63
+
+/* Datapoint stored by the quadtree, defined in quadtree.h */
+struct point_t;
+
+// data definitions
+
+/* Which values are summarised, and how to read them from a datapoint */
+typedef struct aggregateSpec {
+    int numColumns;
+    /* Column identifiers, interpreted only by pointValues */
+    int columns[AGG_MAX_COLUMNS];
+    /* Fills in the point's value for each column, returning 0 (FALSE) if the point is not counted */
+    int (*pointValues)(struct point_t *point, struct aggregateSpec *spec, double *values);
+} aggregateSpec;
+
+/* Count, sum, minimum and maximum of each column over a set of counted datapoints */
+typedef struct nodeAggregate {
+    size_t count;
+    double sum[AGG_MAX_COLUMNS];
+    double min[AGG_MAX_COLUMNS];
+    double max[AGG_MAX_COLUMNS];
+    /* Which small integer values (such as category ids) occur in each column */
+    uint64_t present[AGG_MAX_COLUMNS];
+} nodeAggregate;
+
+// function definitions
+
+/* Resets an aggregate to the empty set */
+void aggregateInit(nodeAggregate *agg);
+
+/* Adds one datapoint's values to an aggregate */
+void aggregateAdd(nodeAggregate *agg, int numColumns, const double *values);
+
+/* Adds every datapoint summarised by another aggregate */
+void aggregateMerge(nodeAggregate *agg, int numColumns, const nodeAggregate *other);
+
+/* Returns the presence mask bit standing for a value */
+uint64_t aggregateCategoryBit(double value);
+
+/* Adds a datapoint to an aggregate if the spec counts it */
+void aggregateAddPoint(nodeAggregate *agg, aggregateSpec *spec, struct point_t *point);
+
+#endif
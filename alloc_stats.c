@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <pthread.h>
+#include "alloc_stats.h"
+
+/* What one thread has allocated and freed under each subsystem. Counts only grow, so blocks
+freed by another thread than allocated them balance out once every thread's are summed */
+typedef struct threadCounts {
+    size_t allocations[ALLOC_SUBSYSTEMS];
+    size_t frees[ALLOC_SUBSYSTEMS];
+    size_t bytesAllocated[ALLOC_SUBSYSTEMS];
+    size_t bytesFreed[ALLOC_SUBSYSTEMS];
+    struct threadCounts *next;
+} threadCounts;
+
+static const char *subsystemNames[ALLOC_SUBSYSTEMS] = {"csv", "dict", "tree", "query"};
+
+/* Every thread's counts, kept after the thread exits so its blocks stay accounted for */
+static threadCounts *allThreads;
+static pthread_mutex_t threadsLock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifndef NO_ALLOC_STATS
+static __thread threadCounts *myCounts;
+
+// Returns the calling thread's counts, registering them on first use
+static threadCounts *counts(void) {
+    if (!myCounts) {
+        // Counts are not themselves counted, and live as long as the program
+        myCounts = (threadCounts *)calloc(1, sizeof(threadCounts));
+        if (!myCounts) {
+            abort();
+        }
+        pthread_mutex_lock(&threadsLock);
+        myCounts->next = allThreads;
+        allThreads = myCounts;
+        pthread_mutex_unlock(&threadsLock);
+    }
+    return myCounts;
+}
+
+// Adds n to a counter only its thread writes, which reports may read at any time
+static void bump(size_t *counter, size_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+#endif
+
+// Counts a block allocated under the subsystem
+static void charge(int subsystem, void *block) {
+#ifndef NO_ALLOC_STATS
+    if (!block) {
+        return;
+    }
+    threadCounts *c = counts();
+    bump(&c->allocations[subsystem], 1);
+    bump(&c->bytesAllocated[subsystem], malloc_usable_size(block));
+#endif
+}
+
+// Counts a block about to be freed under the subsystem
+static void discharge(int subsystem, void *block) {
+#ifndef NO_ALLOC_STATS
+    if (!block) {
+        return;
+    }
+    threadCounts *c = counts();
+    bump(&c->frees[subsystem], 1);
+    bump(&c->bytesFreed[subsystem], malloc_usable_size(block));
+#endif
+}
+
+// Allocates a block charged to the subsystem
+void *trackedMalloc(int subsystem, size_t size) {
+    void *block = malloc(size);
+    charge(subsystem, block);
+    return block;
+}
+
+// Allocates a zeroed block charged to the subsystem
+void *trackedCalloc(int subsystem, size_t count, size_t size) {
+    void *block = calloc(count, size);
+    charge(subsystem, block);
+    return block;
+}
+
+// Resizes a block charged to the subsystem, which stays charged to it if the resize fails
+void *trackedRealloc(int subsystem, void *block, size_t size) {
+    discharge(subsystem, block);
+    void *resized = realloc(block, size);
+    charge(subsystem, resized ? resized : block);
+    return resized;
+}
+
+// Copies a string into a block charged to the subsystem
+char *trackedStrdup(int subsystem, const char *s) {
+    char *copy = strdup(s);
+    charge(subsystem, copy);
+    return copy;
+}
+
+// Frees a block charged to the subsystem
+void trackedFree(int subsystem, void *block) {
+    discharge(subsystem, block);
+    free(block);
+}
+
+// Charges a block the C library allocated itself to the subsystem
+void trackedAdopt(int subsystem, void *block) {
+    charge(subsystem, block);
+}
+
+// Sums every thread's counts of the subsystem into out
+void allocCountersOf(int subsystem, allocCounters *out) {
+    size_t allocations = 0, frees = 0, bytesAllocated = 0, bytesFreed = 0;
+
+    pthread_mutex_lock(&threadsLock);
+    for (threadCounts *c = allThreads; c; c = c->next) {
+        allocations += __atomic_load_n(&c->allocations[subsystem], __ATOMIC_RELAXED);
+        frees += __atomic_load_n(&c->frees[subsystem], __ATOMIC_RELAXED);
+        bytesAllocated += __atomic_load_n(&c->bytesAllocated[subsystem], __ATOMIC_RELAXED);
+        bytesFreed += __atomic_load_n(&c->bytesFreed[subsystem], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&threadsLock);
+
+    out->liveObjects = allocations - frees;
+    out->liveBytes = bytesAllocated - bytesFreed;
+    out->allocations = allocations;
+    out->bytesAllocated = bytesAllocated;
+}
+
+// Returns the number of blocks live over all subsystems
+size_t allocLiveObjects(void) {
+    size_t live = 0;
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        allocCounters c;
+        allocCountersOf(i, &c);
+        live += c.liveObjects;
+    }
+    return live;
+}
+
+// Prints the counters of every subsystem as one JSON line
+void allocReport(FILE *f) {
+    fprintf(f, "{");
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        allocCounters c;
+        allocCountersOf(i, &c);
+        fprintf(f, "%s\"%s_live_objects\":%zu,\"%s_live_bytes\":%zu,\"%s_allocations\":%zu,"
+            "\"%s_bytes_allocated\":%zu", i > 0 ? "," : "", subsystemNames[i], c.liveObjects,
+            subsystemNames[i], c.liveBytes, subsystemNames[i], c.allocations, subsystemNames[i],
+            c.bytesAllocated);
+    }
+    fprintf(f, "}\n");
+}
@@ -0,0 +1,55 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <stdio.h>
+
+/* Subsystems allocations are charged to: records read from the CSV file, the dictionary's
+records and tables, the index's nodes, rectangles and points, and everything made to answer
+queries (results, filters, cursors and cached results) */
+#define ALLOC_CSV 0
+#define ALLOC_DICT 1
+#define ALLOC_TREE 2
+#define ALLOC_QUERY 3
+#define ALLOC_SUBSYSTEMS 4
+
+// data definitions
+typedef struct allocCounters {
+    /* Blocks and bytes allocated and not yet freed */
+    size_t liveObjects;
+    size_t liveBytes;
+    /* Blocks and bytes allocated since the program started */
+    size_t allocations;
+    size_t bytesAllocated;
+} allocCounters;
+
+// function definitions
+
+/* Each function below behaves as its C library namesake, charging the block to the subsystem.
+A block must be freed or reallocated under the subsystem it was allocated under. Counting
+compiles away when built with -DNO_ALLOC_STATS, leaving plain calls to the C library */
+
+void *trackedMalloc(int subsystem, size_t size);
+
+void *trackedCalloc(int subsystem, size_t count, size_t size);
+
+void *trackedRealloc(int subsystem, void *block, size_t size);
+
+char *trackedStrdup(int subsystem, const char *s);
+
+void trackedFree(int subsystem, void *block);
+
+/* Charges a block the C library allocated itself (as getline does) to the subsystem, so it can
+be freed with trackedFree; does nothing given NULL */
+void trackedAdopt(int subsystem, void *block);
+
+/* Sums the counters of the subsystem over every thread into out; safe to call from several
+threads at once, though blocks being allocated meanwhile may or may not be counted */
+void allocCountersOf(int subsystem, allocCounters *out);
+
+/* Returns the number of blocks live over all subsystems */
+size_t allocLiveObjects(void);
+
+/* Prints the counters of every subsystem as one JSON line */
+void allocReport(FILE *f);
+
+#endif
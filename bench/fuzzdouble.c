@@ -0,0 +1,146 @@
+/*
+Fuzz test of parseDouble against strtod. Generates random decimal strings (long and
+short mantissas, leading zeros, exponents near the subnormal and overflow limits, and
+every double printed at random precisions) and checks both parsers return bit-identical
+values and stop at the same character. Exits with failure on the first mismatch.
+
+Usage: ./fuzzdouble [iterations] [seed]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "../parse_double.h"
+
+#define DEFAULT_ITERATIONS 10000000
+#define MAX_STRING 400
+
+static uint64_t state = 88172645463325252ULL;
+
+// Returns the next value of a xorshift64 generator
+static uint64_t nextRandom(void) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// Fills buf with a random decimal string built digit by digit
+static void randomDecimal(char *buf) {
+    char *p = buf;
+    int r = nextRandom() % 8;
+    if (r == 0) {
+        *p++ = '+';
+    } else if (r < 4) {
+        *p++ = '-';
+    }
+
+    int leadingZeros = nextRandom() % 4 == 0 ? nextRandom() % 30 : 0;
+    for (int i = 0; i < leadingZeros; i++) {
+        *p++ = '0';
+    }
+
+    int intDigits = nextRandom() % 25;
+    int fracDigits = nextRandom() % 4 == 0 ? 0 : nextRandom() % 40;
+    for (int i = 0; i < intDigits; i++) {
+        *p++ = '0' + nextRandom() % 10;
+    }
+    if (fracDigits > 0 || nextRandom() % 8 == 0) {
+        *p++ = '.';
+    }
+    for (int i = 0; i < fracDigits; i++) {
+        *p++ = '0' + nextRandom() % 10;
+    }
+
+    if (nextRandom() % 3 == 0) {
+        *p++ = nextRandom() % 2 ? 'e' : 'E';
+        r = nextRandom() % 3;
+        if (r == 1) {
+            *p++ = '-';
+        } else if (r == 2) {
+            *p++ = '+';
+        }
+        p += sprintf(p, "%d", (int)(nextRandom() % 700));
+    }
+
+    // Occasionally trailing text the parsers must stop before
+    if (nextRandom() % 10 == 0) {
+        *p++ = ",e.x"[nextRandom() % 4];
+    }
+    *p = '\0';
+}
+
+// Fills buf with a random double (any bit pattern, or a coordinate) printed at a random precision
+static void randomPrinted(char *buf) {
+    double value;
+    if (nextRandom() % 2) {
+        uint64_t bits = nextRandom();
+        memcpy(&value, &bits, sizeof(value));
+        if (!isfinite(value)) {
+            value = 1.0;
+        }
+    } else {
+        value = (double)(nextRandom() % 360000000000000000ULL) / 1e15 - 180.0;
+    }
+
+    int precision = nextRandom() % 25;
+    switch (nextRandom() % 3) {
+        case 0:
+            sprintf(buf, "%.*g", precision, value);
+            break;
+        case 1:
+            sprintf(buf, "%.*e", precision, value);
+            break;
+        default:
+            snprintf(buf, MAX_STRING, "%.*f", precision, value);
+            break;
+    }
+}
+
+// Returns 1 if both parsers agree on the string, printing it otherwise
+static int check(const char *s) {
+    char *endExpected, *endActual;
+    double expected = strtod(s, &endExpected);
+    double actual = parseDouble(s, &endActual);
+
+    if (memcmp(&expected, &actual, sizeof(double)) != 0 || endExpected != endActual) {
+        printf("mismatch on \"%s\": strtod %.17g (end %ld), parseDouble %.17g (end %ld)\n", s,
+            expected, (long)(endExpected - s), actual, (long)(endActual - s));
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    if (argc > 2) {
+        state = strtoull(argv[2], NULL, 10) | 1;
+    }
+
+    // Edge cases first, then random strings
+    const char *fixed[] = {"", "-", ".", "-.", "0", "-0", "0.0", "1e", "1e+", ".5", "5.",
+        "0x1p3", "inf", "-nan", " 1.5", "1e308", "1.7976931348623157e308", "1.8e308",
+        "2.2250738585072014e-308", "4.9e-324", "1e-400", "9007199254740993",
+        "-37.796155887263744", "144.97056424489568", "0.1", "1e23", "8.98846567431158e307"};
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+        if (!check(fixed[i])) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    char buf[MAX_STRING];
+    for (long i = 0; i < iterations; i++) {
+        if (i % 2) {
+            randomDecimal(buf);
+        } else {
+            randomPrinted(buf);
+        }
+        if (!check(buf)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%ld strings parsed identically\n", iterations);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,197 @@
+/* 
+    Generates synthetic footpath CSVs in the same 19 column layout as the
+    datasets/ files, along with matching point (stage 3) and range (stage 4)
+    query files, for benchmarking the dict3 and dict4 code paths.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#define NUMARGS 8
+
+/* Area covered by the generated footpaths; also the root node area used by run_bench.sh. */
+#define MIN_LON 144.90
+#define MIN_LAT (-37.90)
+#define MAX_LON 145.10
+#define MAX_LAT (-37.70)
+
+/* Longest footpath, in degrees along each axis. */
+#define MAX_SEGMENT 0.0015
+/* Spread of clustered points around their intersection, in degrees. */
+#define CLUSTER_SPREAD 0.0008
+/* Points per intersection for the clustered and duplicates distributions. */
+#define POINTS_PER_CLUSTER 50
+/* Smallest and largest range query side, in degrees. */
+#define MIN_WINDOW 0.0005
+#define MAX_WINDOW 0.02
+
+#define UNIFORM 0
+#define CLUSTERED 1
+#define DUPLICATES 2
+
+static uint64_t rngState;
+
+/* xorshift64* so the same seed gives the same data on every platform. */
+uint64_t nextRandom();
+
+uint64_t nextRandom(){
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+/* Returns a uniformly distributed double in [0, 1). */
+double uniform();
+
+double uniform(){
+    return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Returns a value in [-spread, spread] peaked around zero. */
+double triangular(double spread);
+
+double triangular(double spread){
+    return (uniform() + uniform() - 1) * spread;
+}
+
+/* Clamps a value into [min, max]. */
+double clamp(double v, double min, double max);
+
+double clamp(double v, double min, double max){
+    return v < min ? min : (v > max ? max : v);
+}
+
+int parseDistribution(char *name);
+
+int parseDistribution(char *name){
+    if(strcmp(name, "uniform") == 0){
+        return UNIFORM;
+    }
+    if(strcmp(name, "clustered") == 0){
+        return CLUSTERED;
+    }
+    if(strcmp(name, "duplicates") == 0){
+        return DUPLICATES;
+    }
+    fprintf(stderr, "Unknown distribution %s, expected uniform, clustered or duplicates\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/* Picks one endpoint of a footpath according to the distribution. */
+void pickPoint(int distribution, double *intersections, long numIntersections,
+    double *lon, double *lat);
+
+void pickPoint(int distribution, double *intersections, long numIntersections,
+    double *lon, double *lat){
+    if(distribution == UNIFORM){
+        *lon = MIN_LON + uniform() * (MAX_LON - MIN_LON);
+        *lat = MIN_LAT + uniform() * (MAX_LAT - MIN_LAT);
+        return;
+    }
+
+    long k = nextRandom() % numIntersections;
+    *lon = intersections[2 * k];
+    *lat = intersections[2 * k + 1];
+
+    // Duplicates reuse the intersection exactly, as footpaths meeting at a corner do
+    if(distribution == CLUSTERED){
+        *lon = clamp(*lon + triangular(CLUSTER_SPREAD), MIN_LON, MAX_LON);
+        *lat = clamp(*lat + triangular(CLUSTER_SPREAD), MIN_LAT, MAX_LAT);
+    }
+}
+
+int main(int argc, char **argv){
+    if(argc < NUMARGS){
+        fprintf(stderr, "Insufficient arguments, run in form:\n"
+            "\t./gendata <records> <uniform|clustered|duplicates> <seed> <csv file> "
+            "<point query file> <range query file> <queries>\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long n = strtol(argv[1], NULL, 10);
+    int distribution = parseDistribution(argv[2]);
+    rngState = strtoull(argv[3], NULL, 10) * 2654435761ULL + 1;
+    long numQueries = strtol(argv[7], NULL, 10);
+    assert(n > 0 && numQueries >= 0);
+
+    FILE *csvFile = fopen(argv[4], "w");
+    assert(csvFile);
+    FILE *pointFile = fopen(argv[5], "w");
+    assert(pointFile);
+    FILE *rangeFile = fopen(argv[6], "w");
+    assert(rangeFile);
+
+    long numIntersections = n / POINTS_PER_CLUSTER + 1;
+    double *intersections = (double *) malloc(sizeof(double) * 2 * numIntersections);
+    assert(intersections);
+    for(long i = 0; i < numIntersections; i++){
+        intersections[2 * i] = MIN_LON + uniform() * (MAX_LON - MIN_LON);
+        intersections[2 * i + 1] = MIN_LAT + uniform() * (MAX_LAT - MIN_LAT);
+    }
+
+    // Point queries are a sample of the generated endpoints
+    double *sample = (double *) malloc(sizeof(double) * 2 * (numQueries + 1));
+    assert(sample);
+    long sampled = 0;
+
+    fprintf(csvFile, "footpath_id,address,clue_sa,asset_type,deltaz,distance,grade1in,"
+        "mcc_id,mccid_int,rlmax,rlmin,segside,statusid,streetid,street_group,"
+        "start_lat,start_lon,end_lat,end_lon\n");
+
+    for(long i = 0; i < n; i++){
+        double startLon, startLat, endLon, endLat;
+        pickPoint(distribution, intersections, numIntersections, &startLon, &startLat);
+        if(distribution == UNIFORM){
+            endLon = clamp(startLon + triangular(MAX_SEGMENT), MIN_LON, MAX_LON);
+            endLat = clamp(startLat + triangular(MAX_SEGMENT), MIN_LAT, MAX_LAT);
+        } else {
+            pickPoint(distribution, intersections, numIntersections, &endLon, &endLat);
+        }
+
+        double rlmin = 10 + uniform() * 30;
+        double deltaz = uniform() * 4;
+        fprintf(csvFile, "%ld,Synthetic Street %ld between Street %ld and Street %ld,"
+            "Synthetic,Road Footway,%.2f,%.2f,%.1f,%ld.0,%ld.0,%.2f,%.2f,%s,2.0,%ld.0,%ld.0,"
+            "%.15f,%.15f,%.15f,%.15f\n",
+            i + 1, i % 997, i % 89, i % 97, deltaz, 20 + uniform() * 150, 10 + uniform() * 200,
+            1380000 + i, 20000 + i % 5000, rlmin + deltaz, rlmin,
+            (i % 2) ? "North" : "South", i % 1500, 20000 + i % 10000,
+            startLat, startLon, endLat, endLon);
+
+        // Reservoir sample so point queries are spread over the whole file
+        if(sampled < numQueries){
+            sample[2 * sampled] = startLon;
+            sample[2 * sampled + 1] = startLat;
+            sampled++;
+        } else if(numQueries > 0){
+            long j = nextRandom() % (i + 1);
+            if(j < numQueries){
+                sample[2 * j] = startLon;
+                sample[2 * j + 1] = startLat;
+            }
+        }
+    }
+
+    for(long i = 0; i < sampled; i++){
+        fprintf(pointFile, "%.15f %.15f\n", sample[2 * i], sample[2 * i + 1]);
+    }
+
+    for(long i = 0; i < numQueries; i++){
+        double width = MIN_WINDOW + uniform() * (MAX_WINDOW - MIN_WINDOW);
+        double height = MIN_WINDOW + uniform() * (MAX_WINDOW - MIN_WINDOW);
+        double lon = MIN_LON + uniform() * (MAX_LON - MIN_LON - width);
+        double lat = MIN_LAT + uniform() * (MAX_LAT - MIN_LAT - height);
+        fprintf(rangeFile, "%.6f %.6f %.6f %.6f\n", lon, lat, lon + width, lat + height);
+    }
+
+    free(sample);
+    free(intersections);
+    fclose(csvFile);
+    fclose(pointFile);
+    fclose(rangeFile);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+#!/bin/sh
+# Runs dict3 and dict4 built with AddressSanitizer over the test fixtures with each index
+# engine and the main driver options, and as servers sent the same requests, failing if any
+# run leaks memory (as LeakSanitizer reports) or ends with blocks still counted live by
+# --alloc-stats. The server cases need python3 as their client.
+#
+# Usage: bench/leakcheck.sh <dict3 binary> <dict4 binary> [engines]
+
+DICT3=${1:-./dict3_asan}
+DICT4=${2:-./dict4_asan}
+ENGINES=${3:-"pointer linear compact specialised disk"}
+WORKDIR=${LEAKCHECK_DIR:-leakcheck_data}
+DATASET=tests/dataset_1000.csv
+
+# Root node area holding every fixture's records
+ROOT="144.90 -37.90 145.10 -37.70"
+
+mkdir -p "$WORKDIR" || exit 1
+
+# Range queries followed by requests for the next pages of their cursors, and a few tiles
+cat tests/*.s4.in > "$WORKDIR/pages.in"
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    echo "next $i" >> "$WORKDIR/pages.in"
+done
+printf "0/0/0\n4/7/9\n8/118/151 | asset_type = Road Footway\n12/1890/2421\n" > "$WORKDIR/tiles.in"
+
+# Requests sent to the servers: point queries, or range queries and their next pages, then stats
+{ head -n 20 tests/test5.s3.in; echo stats; } > "$WORKDIR/serve.s3.in"
+{ cat "$WORKDIR/pages.in"; echo stats; } > "$WORKDIR/serve.s4.in"
+
+# A request line longer than the server accepts, which must be refused and the connection closed
+{ head -n 3 tests/test14.s4.in; awk 'BEGIN { while (n++ < 100000) printf "9"; print "" }'
+    echo stats; } > "$WORKDIR/oversized.s4.in"
+SOCKET="$WORKDIR/leakcheck.sock"
+
+runs=0
+failures=0
+
+# Runs one case, failing it on a non-zero exit (LeakSanitizer exits 23 on a leak) or any
+# subsystem with blocks live after teardown
+check() {
+    program=$1; stage=$2; input=$3; shift 3
+    runs=$((runs + 1))
+    ASAN_OPTIONS=detect_leaks=1 $program $stage $DATASET "$WORKDIR/out.txt" $ROOT --alloc-stats \
+        "$@" < "$input" > /dev/null 2> "$WORKDIR/err.txt"
+    status=$?
+    live=$(tail -n 1 "$WORKDIR/err.txt" | grep -o '"[a-z]*_live_objects":[1-9][0-9]*')
+    if [ $status -ne 0 ] || [ -n "$live" ]; then
+        failures=$((failures + 1))
+        echo "FAIL: $program $stage $input $* (exit $status) $live"
+        grep -A 12 "ERROR: LeakSanitizer" "$WORKDIR/err.txt" | head -n 20
+    fi
+}
+
+# Starts a server, sends it the requests in one connection and stops it with SIGTERM, failing
+# the case as check does, or if the server never listened or its replies lack the expected text
+check_serve() {
+    program=$1; stage=$2; input=$3; expect=$4; shift 4
+    runs=$((runs + 1))
+    rm -f "$SOCKET"
+    ASAN_OPTIONS=detect_leaks=1 $program $stage $DATASET "$WORKDIR/out.txt" $ROOT --alloc-stats \
+        --serve="$SOCKET" "$@" < /dev/null > /dev/null 2> "$WORKDIR/err.txt" &
+    server=$!
+    tries=0
+    while [ ! -S "$SOCKET" ] && [ $tries -lt 100 ] && kill -0 $server 2> /dev/null; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+    python3 -c '
+import socket, sys
+client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+client.connect(sys.argv[1])
+try:
+    client.sendall(open(sys.argv[2], "rb").read())
+    client.shutdown(socket.SHUT_WR)
+except BrokenPipeError:
+    pass
+replies = b""
+try:
+    while True:
+        chunk = client.recv(65536)
+        if not chunk:
+            break
+        replies += chunk
+except ConnectionResetError:
+    pass
+sys.exit(0 if sys.argv[3].encode() in replies else 1)
+' "$SOCKET" "$input" "$expect" 2> /dev/null
+    replied=$?
+    kill -TERM $server 2> /dev/null
+    wait $server
+    status=$?
+    live=$(tail -n 1 "$WORKDIR/err.txt" | grep -o '"[a-z]*_live_objects":[1-9][0-9]*')
+    if [ $replied -ne 0 ] || [ $status -ne 0 ] || [ -n "$live" ]; then
+        failures=$((failures + 1))
+        echo "FAIL: $program $stage --serve $input $* (exit $status, replied $replied) $live"
+        grep -A 12 "ERROR: LeakSanitizer" "$WORKDIR/err.txt" | head -n 20
+    fi
+}
+
+for engine in $ENGINES; do
+    check_serve "$DICT3" 3 "$WORKDIR/serve.s3.in" _live_objects --engine=$engine --lazy --cache=1M
+    check_serve "$DICT4" 4 "$WORKDIR/serve.s4.in" _live_objects --engine=$engine --max-results=3 \
+        --cache=1M
+    check_serve "$DICT4" 4 "$WORKDIR/oversized.s4.in" "Request longer than" --engine=$engine
+    for t in tests/*.s3.in; do
+        check "$DICT3" 3 "$t" --engine=$engine
+        check "$DICT3" 3 "$t" --engine=$engine --lazy --cache=1M
+        check "$DICT3" 3 "$t" --engine=$engine --no-pipeline
+    done
+    for t in tests/*.s4.in; do
+        check "$DICT4" 4 "$t" --engine=$engine
+        check "$DICT4" 4 "$t" --engine=$engine --lazy --cache=1M
+        check "$DICT4" 4 "$t" --engine=$engine --count-only
+        check "$DICT4" 4 "$t" --engine=$engine --aggregate=distance,grade1in
+        check "$DICT4" 4 "$t" --engine=$engine --filter-index=distance,asset_type
+        check "$DICT4" 4 "$t" --engine=$engine --batch=4 --cache=1M
+        check "$DICT4" 4 "$t" --engine=$engine --dataset=tests/dataset_100.csv \
+            --dataset=tests/dataset_20.csv
+    done
+    check "$DICT4" 4 "$WORKDIR/pages.in" --engine=$engine --max-results=3
+    check "$DICT4" 4 "$WORKDIR/pages.in" --engine=$engine --max-nodes=5 --no-pipeline
+    check "$DICT4" 4 "$WORKDIR/tiles.in" --engine=$engine --tiles
+    check "$DICT4" 4 "$WORKDIR/tiles.in" --engine=$engine --tiles --dataset=tests/dataset_100.csv
+done
+
+echo "$runs runs, $failures failed"
+[ $failures -eq 0 ]
@@ -0,0 +1,255 @@
+/* 
+    Micro-benchmarks for the quadtree's geometric primitives, quadrant 
+    selection, node split, coordinate parsing, and insertion and range counts in the pointer
+    quadtree and trees instantiated from quadtree_template.h, reported in nanoseconds per 
+    operation so layout and precision changes to point2D and rectangle2D can be compared.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include "../quadtree.h"
+#include "../query_stats.h"
+#include "../contain_kernel.h"
+#include "../parse_double.h"
+#include "../footpath_quadtree.h"
+
+#define DEFAULT_ITERATIONS 10000000L
+#define NUM_SAMPLES 4096
+#define SPLIT_DIVISOR 100
+#define COORDINATE_LENGTH 32
+#define TREE_DIVISOR 100
+#define QUERY_HALF 0.01L
+
+/* Allocates zeroed nodes for gridTree. */
+void *allocGridNode(size_t size);
+
+void *allocGridNode(size_t size){
+    return calloc(1, size);
+}
+
+/* A second instantiation: double coordinates, integer items and eight points per node. */
+QUADTREE_TEMPLATE(gridTree, double, uint32_t, 8, 32, allocGridNode, free)
+
+static uint64_t rngState = 88172645463325252ULL;
+
+/* Returns a uniformly distributed value in [0, 1). */
+long double uniform();
+
+long double uniform(){
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return (rngState >> 11) * (1.0L / 9007199254740992.0L);
+}
+
+/* Results are accumulated here so the compiler cannot drop the calls. */
+volatile long sink;
+
+/* Prints one result line. */
+void report(const char *name, long iterations, unsigned long long ns);
+
+void report(const char *name, long iterations, unsigned long long ns){
+    printf("%s\t%ld\t%.2f\n", name, iterations, (double)ns / iterations);
+}
+
+/* Frees a node created by create_quadNode along with its rectangle. */
+void freeChild(QuadTree *child);
+
+void freeChild(QuadTree *child){
+    freeRectangle(child->boundary);
+    freeQuadtree(child);
+}
+
+int main(int argc, char **argv){
+    long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+    assert(iterations > 0);
+
+    // Samples are drawn around a unit root so roughly half of each test succeeds
+    point2D *points[NUM_SAMPLES];
+    rectangle2D *rectangles[NUM_SAMPLES];
+    for(int i = 0; i < NUM_SAMPLES; i++){
+        points[i] = create_point(uniform() * 2 - 1, uniform() * 2 - 1);
+        rectangles[i] = create_rectangle(create_point(uniform() * 2 - 1, uniform() * 2 - 1),
+            uniform() / 2, uniform() / 2);
+    }
+
+    FILE *devNull = fopen("/dev/null", "w");
+    assert(devNull);
+
+    printf("primitive\titerations\tns_per_op\n");
+
+    unsigned long long start = monotonicNs();
+    long hits = 0;
+    for(long i = 0; i < iterations; i++){
+        hits += inRectangle(rectangles[i & (NUM_SAMPLES - 1)], points[(i * 7) & (NUM_SAMPLES - 1)]);
+    }
+    report("inRectangle", iterations, monotonicNs() - start);
+    sink = hits;
+
+    // Batch kernel over contiguous coordinates, reported per point tested
+    double *xs = (double *) malloc(sizeof(double) * NUM_SAMPLES);
+    double *ys = (double *) malloc(sizeof(double) * NUM_SAMPLES);
+    assert(xs && ys);
+    for(int i = 0; i < NUM_SAMPLES; i++){
+        xs[i] = (double)points[i]->x;
+        ys[i] = (double)points[i]->y;
+    }
+    containBounds bounds;
+    long batches = iterations / CONTAIN_BATCH > 0 ? iterations / CONTAIN_BATCH : 1;
+    start = monotonicNs();
+    hits = 0;
+    for(long i = 0; i < batches; i++){
+        long offset = (i * CONTAIN_BATCH) & (NUM_SAMPLES - 1);
+        containBoundsOf(rectangles[i & (NUM_SAMPLES - 1)], &bounds);
+        hits += __builtin_popcountll(containBatch(xs + offset, ys + offset, CONTAIN_BATCH, &bounds));
+    }
+    report("containBatch", batches * CONTAIN_BATCH, monotonicNs() - start);
+    sink = hits;
+    free(xs);
+    free(ys);
+
+    start = monotonicNs();
+    hits = 0;
+    for(long i = 0; i < iterations; i++){
+        hits += rectangleOverlap(rectangles[i & (NUM_SAMPLES - 1)], 
+            rectangles[(i * 7 + 1) & (NUM_SAMPLES - 1)]);
+    }
+    report("rectangleOverlap", iterations, monotonicNs() - start);
+    sink = hits;
+
+    start = monotonicNs();
+    hits = 0;
+    for(long i = 0; i < iterations; i++){
+        hits += quadrantOf(rectangles[i & (NUM_SAMPLES - 1)], points[(i * 7) & (NUM_SAMPLES - 1)]);
+    }
+    report("quadrantOf", iterations, monotonicNs() - start);
+    sink = hits;
+
+    // The printing variant writes to /dev/null, so this is the cost of the stdio call alone
+    start = monotonicNs();
+    hits = 0;
+    for(long i = 0; i < iterations; i++){
+        hits += determineQuadrant(rectangles[i & (NUM_SAMPLES - 1)], 
+            points[(i * 7) & (NUM_SAMPLES - 1)], devNull);
+    }
+    report("determineQuadrant", iterations, monotonicNs() - start);
+    sink = hits;
+
+    // Splits allocate, so fewer are run; the timing includes freeing the children
+    long splits = iterations / SPLIT_DIVISOR > 0 ? iterations / SPLIT_DIVISOR : 1;
+    QuadTree *node = new_Quadtree(rectangles[0]);
+    start = monotonicNs();
+    for(long i = 0; i < splits; i++){
+        create_quadNode(node);
+        sink += node->SE->boundary->center->x > 0;
+        freeChild(node->NW);
+        freeChild(node->NE);
+        freeChild(node->SW);
+        freeChild(node->SE);
+        node->NW = node->NE = node->SW = node->SE = NULL;
+    }
+    report("create_quadNode", splits, monotonicNs() - start);
+
+    // Coordinates printed the way the dataset stores them
+    static char coordinates[NUM_SAMPLES][COORDINATE_LENGTH];
+    for(int i = 0; i < NUM_SAMPLES; i++){
+        snprintf(coordinates[i], COORDINATE_LENGTH, "%.17g", (double)(144.9L + uniform() / 10));
+    }
+    double total = 0;
+    start = monotonicNs();
+    for(long i = 0; i < iterations; i++){
+        total += strtod(coordinates[i & (NUM_SAMPLES - 1)], NULL);
+    }
+    report("strtod", iterations, monotonicNs() - start);
+    sink = total;
+
+    total = 0;
+    start = monotonicNs();
+    for(long i = 0; i < iterations; i++){
+        total += parseDouble(coordinates[i & (NUM_SAMPLES - 1)], NULL);
+    }
+    report("parseDouble", iterations, monotonicNs() - start);
+    sink = total;
+
+    // Trees of random points, built and then counted over small squares around other points
+    long treePoints = iterations / TREE_DIVISOR > 0 ? iterations / TREE_DIVISOR : 1;
+    point2D *rootCenter = create_point(0, 0);
+    rectangle2D *root = create_rectangle(rootCenter, 1, 1);
+    // Each quadtree owns the points added to it, so the footpath tree is given copies
+    point2D **treeSamples = (point2D **) malloc(sizeof(point2D *) * treePoints);
+    point2D **treeCopies = (point2D **) malloc(sizeof(point2D *) * treePoints);
+    assert(treeSamples && treeCopies);
+    for(long i = 0; i < treePoints; i++){
+        treeSamples[i] = create_point(uniform() * 2 - 1, uniform() * 2 - 1);
+        treeCopies[i] = create_point(treeSamples[i]->x, treeSamples[i]->y);
+    }
+
+    QuadTree *pointerTree = new_Quadtree(root);
+    start = monotonicNs();
+    for(long i = 0; i < treePoints; i++){
+        addPoint(pointerTree, treeSamples[i]);
+    }
+    report("addPoint", treePoints, monotonicNs() - start);
+
+    footpathTree *specialised = newFootpathTree(root);
+    start = monotonicNs();
+    for(long i = 0; i < treePoints; i++){
+        footpathAddPoint(specialised, treeCopies[i]);
+    }
+    report("footpathTree_insert", treePoints, monotonicNs() - start);
+
+    gridTree *grid = gridTree_new(0, 0, 1, 1);
+    start = monotonicNs();
+    for(long i = 0; i < treePoints; i++){
+        gridTree_insert(grid, (double)treeSamples[i]->x, (double)treeSamples[i]->y, (uint32_t)i);
+    }
+    report("gridTree_insert", treePoints, monotonicNs() - start);
+
+    long queries = treePoints;
+    point2D queryCenter;
+    rectangle2D query = {&queryCenter, QUERY_HALF, QUERY_HALF};
+    start = monotonicNs();
+    hits = 0;
+    for(long i = 0; i < queries; i++){
+        queryCenter = *points[i & (NUM_SAMPLES - 1)];
+        hits += rangeCount(pointerTree, &query);
+    }
+    report("rangeCount", queries, monotonicNs() - start);
+    long pointerHits = hits;
+
+    start = monotonicNs();
+    hits = 0;
+    for(long i = 0; i < queries; i++){
+        queryCenter = *points[i & (NUM_SAMPLES - 1)];
+        hits += footpathRangeCount(specialised, &query);
+    }
+    report("footpathTree_count", queries, monotonicNs() - start);
+    assert(hits == pointerHits);
+
+    start = monotonicNs();
+    hits = 0;
+    for(long i = 0; i < queries; i++){
+        point2D *c = points[i & (NUM_SAMPLES - 1)];
+        hits += gridTree_count(grid, (double)(c->x - QUERY_HALF), (double)(c->y - QUERY_HALF), 
+            (double)(c->x + QUERY_HALF), (double)(c->y + QUERY_HALF));
+    }
+    report("gridTree_count", queries, monotonicNs() - start);
+    sink = hits;
+
+    freeQuadtree(pointerTree);
+    freeFootpathTree(specialised);
+    gridTree_free(grid, NULL);
+    free(treeSamples);
+    free(treeCopies);
+    freeRectangle(root);
+
+    freeQuadtree(node);
+    for(int i = 0; i < NUM_SAMPLES; i++){
+        freePoint(points[i]);
+        freeRectangle(rectangles[i]);
+    }
+    fclose(devNull);
+
+    return EXIT_SUCCESS;
+}
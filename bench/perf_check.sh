@@ -0,0 +1,187 @@
+#!/bin/sh
+# Runs dict3 and dict4 over the test fixtures and over larger generated datasets several times,
+# failing if any output differs from its expected file or from the output recorded in the
+# baseline, or if the fastest load and build time, fastest query time, peak RSS or number of
+# allocations of any case regresses beyond its tolerance. The first run (or any run with
+# PERF_UPDATE=1) records the baseline instead of checking it.
+#
+# Usage: bench/perf_check.sh <dict3 binary> <dict4 binary> [baseline file]
+
+DICT3=${1:-./dict3_release}
+DICT4=${2:-./dict4_release}
+BASELINE=${3:-perf_baseline.tsv}
+REPEATS=${PERF_REPEATS:-5}
+RECORDS=${PERF_RECORDS:-100000}
+QUERIES=${PERF_QUERIES:-1000}
+ENGINES=${PERF_ENGINES:-"pointer"}
+SEED=${BENCH_SEED:-20003}
+WORKDIR=${PERF_DIR:-bench_data}
+
+# Percentages each metric may grow by before the check fails; times within PERF_TIME_FLOOR_MS
+# and RSS within PERF_RSS_FLOOR_KB of the baseline always pass, as the fixtures run too quickly
+# and in too little memory to measure more finely
+TIME_TOLERANCE=${PERF_TIME_TOLERANCE:-25}
+TIME_FLOOR_MS=${PERF_TIME_FLOOR_MS:-5}
+RSS_TOLERANCE=${PERF_RSS_TOLERANCE:-10}
+RSS_FLOOR_KB=${PERF_RSS_FLOOR_KB:-1024}
+ALLOC_TOLERANCE=${PERF_ALLOC_TOLERANCE:-2}
+
+# Root node area holding every fixture's and generated dataset's records
+ROOT="144.90 -37.90 145.10 -37.70"
+
+# Root node area the expected quadrants of test1 were printed under
+README_ROOT="144.969 -37.7975 144.971 -37.7955"
+
+mkdir -p "$WORKDIR" || exit 1
+RESULTS="$WORKDIR/perf_results.tsv"
+: > "$RESULTS"
+
+# Extracts a numeric field from a JSON line of the driver's
+field() {
+    sed -n "s/.*\"$1\":\([0-9]*\).*/\1/p" "$2" | head -n 1
+}
+
+# Prints the smallest of the numbers on standard input, the run least disturbed by the machine
+fastest() {
+    sort -n | head -n 1
+}
+
+failures=0
+
+# Runs one case REPEATS times, checking its output against the expected files (or "-" for
+# none), and appends its best times and RSS, allocation count and output checksum to the results
+run_case() {
+    name=$1; program=$2; stage=$3; dataset=$4; input=$5; expected=$6; expectedStdout=$7
+    shift 7
+    : > "$WORKDIR/build.txt"; : > "$WORKDIR/query.txt"; : > "$WORKDIR/rss.txt"
+
+    i=0
+    while [ $i -lt "$REPEATS" ]; do
+        $program $stage "$dataset" "$WORKDIR/perf_out.txt" "$@" --timing --alloc-stats \
+            < "$input" > "$WORKDIR/perf_stdout.txt" 2> "$WORKDIR/perf_err.txt"
+        status=$?
+        if [ $status -ne 0 ]; then
+            echo "FAIL: $name exited with status $status"
+            failures=$((failures + 1))
+            return
+        fi
+        timing=$(grep '"load_ns"' "$WORKDIR/perf_err.txt" | tail -n 1)
+        echo "$timing" > "$WORKDIR/timing.json"
+        load=$(field load_ns "$WORKDIR/timing.json")
+        build=$(field build_ns "$WORKDIR/timing.json")
+        echo $(((load + build) / 1000)) >> "$WORKDIR/build.txt"
+        echo $(($(field query_ns "$WORKDIR/timing.json") / 1000)) >> "$WORKDIR/query.txt"
+        field peak_rss_kb "$WORKDIR/timing.json" >> "$WORKDIR/rss.txt"
+        i=$((i + 1))
+    done
+
+    # Outputs are compared once, as every run gives the same
+    if [ "$expected" != "-" ] && ! cmp -s "$WORKDIR/perf_out.txt" "$expected"; then
+        echo "FAIL: $name output differs from $expected"
+        failures=$((failures + 1))
+    fi
+    if [ "$expectedStdout" != "-" ] && ! cmp -s "$WORKDIR/perf_stdout.txt" "$expectedStdout"; then
+        echo "FAIL: $name stdout differs from $expectedStdout"
+        failures=$((failures + 1))
+    fi
+
+    # Allocations are summed over every subsystem of the last run's --alloc-stats line
+    allocs=$(tail -n 1 "$WORKDIR/perf_err.txt" | grep -o '"[a-z]*_allocations":[0-9]*' | \
+        awk -F: '{ n += $2 } END { print n + 0 }')
+    sum=$(cat "$WORKDIR/perf_out.txt" "$WORKDIR/perf_stdout.txt" | cksum | awk '{ print $1 }')
+    printf "%s\t%s\t%s\t%s\t%s\t%s\n" "$name" "$(fastest < "$WORKDIR/build.txt")" \
+        "$(fastest < "$WORKDIR/query.txt")" "$(fastest < "$WORKDIR/rss.txt")" "$allocs" "$sum" \
+        >> "$RESULTS"
+}
+
+# The fixtures, each with the smallest dataset holding the records its expected output lists;
+# test7 and test8 query records of the full dataset, so only their timing and checksum count
+run_case test1.s3 "$DICT3" 3 tests/dataset_2.csv tests/test1.s3.in tests/test1.s3.out \
+    tests/test1.s3.stdout.out $README_ROOT
+run_case test2.s3 "$DICT3" 3 tests/dataset_2.csv tests/test2.s3.in tests/test2.s3.out - $ROOT
+run_case test3.s3 "$DICT3" 3 tests/dataset_20.csv tests/test3.s3.in tests/test3.s3.out - $ROOT
+run_case test4.s3 "$DICT3" 3 tests/dataset_100.csv tests/test4.s3.in tests/test4.s3.out - $ROOT
+run_case test5.s3 "$DICT3" 3 tests/dataset_1000.csv tests/test5.s3.in tests/test5.s3.out - $ROOT
+run_case test6.s3 "$DICT3" 3 tests/dataset_20.csv tests/test6.s3.in tests/test6.s3.out - $ROOT
+run_case test7.s3 "$DICT3" 3 tests/dataset_1000.csv tests/test7.s3.in - - $ROOT
+run_case test8.s3 "$DICT3" 3 tests/dataset_1000.csv tests/test8.s3.in - - $ROOT
+run_case test9.s4 "$DICT4" 4 tests/dataset_2.csv tests/test9.s4.in tests/test9.s4.out - $ROOT
+run_case test10.s4 "$DICT4" 4 tests/dataset_2.csv tests/test10.s4.in tests/test10.s4.out - $ROOT
+run_case test11.s4 "$DICT4" 4 tests/dataset_2.csv tests/test11.s4.in tests/test11.s4.out - $ROOT
+run_case test12.s4 "$DICT4" 4 tests/dataset_20.csv tests/test12.s4.in tests/test12.s4.out - $ROOT
+run_case test13.s4 "$DICT4" 4 tests/dataset_100.csv tests/test13.s4.in tests/test13.s4.out - $ROOT
+run_case test14.s4 "$DICT4" 4 tests/dataset_1000.csv tests/test14.s4.in tests/test14.s4.out - $ROOT
+
+# Aggregates over a footpath whose start and end coincide, which must be summarised once by
+# every engine
+for engine in pointer linear compact specialised disk; do
+    run_case test15.s4.$engine "$DICT4" 4 tests/dataset_3.csv tests/test15.s4.in \
+        tests/test15.s4.out tests/test15.s4.stdout.out $ROOT --engine=$engine \
+        --aggregate=distance,grade1in
+done
+
+# Scaled up generated variants, checked against the outputs recorded in the baseline
+for dist in uniform clustered; do
+    csv="$WORKDIR/$dist-$RECORDS.csv"
+    points="$WORKDIR/$dist-$RECORDS.s3.in"
+    ranges="$WORKDIR/$dist-$RECORDS.s4.in"
+    if [ ! -f "$csv" ]; then
+        ./gendata "$RECORDS" "$dist" "$SEED" "$csv" "$points" "$ranges" "$QUERIES" || exit 1
+    fi
+    for engine in $ENGINES; do
+        run_case "$dist-$RECORDS.s3.$engine" "$DICT3" 3 "$csv" "$points" - - $ROOT \
+            --engine=$engine
+        run_case "$dist-$RECORDS.s4.$engine" "$DICT4" 4 "$csv" "$ranges" - - $ROOT \
+            --engine=$engine
+    done
+done
+
+if [ ! -f "$BASELINE" ] || [ -n "$PERF_UPDATE" ]; then
+    printf "case\tbuild_us\tquery_us\tpeak_rss_kb\tallocations\toutput_cksum\n" > "$BASELINE"
+    cat "$RESULTS" >> "$BASELINE"
+    echo "baseline recorded in $BASELINE"
+    [ $failures -eq 0 ]
+    exit
+fi
+
+# Compares each case with its baseline line, printing every metric now and in the baseline
+printf "case\tbuild_us\tquery_us\tpeak_rss_kb\tallocations\n"
+awk -F '\t' -v tt="$TIME_TOLERANCE" -v floor="$TIME_FLOOR_MS" -v rt="$RSS_TOLERANCE" \
+    -v rssFloor="$RSS_FLOOR_KB" -v at="$ALLOC_TOLERANCE" '
+    function worse(now, was, tolerance, slack) {
+        return now > was * (1 + tolerance / 100) + slack
+    }
+    NR == FNR {
+        if (FNR > 1) {
+            build[$1] = $2; query[$1] = $3; rss[$1] = $4; allocs[$1] = $5; sum[$1] = $6
+        }
+        next
+    }
+    {
+        if (!($1 in build)) {
+            printf "%s\tnot in baseline\n", $1
+            next
+        }
+        printf "%s\t%d/%d\t%d/%d\t%d/%d\t%d/%d\n", $1, $2, build[$1], $3, query[$1],
+            $4, rss[$1], $5, allocs[$1]
+        if ($6 != sum[$1]) {
+            printf "FAIL: %s output differs from the baseline\n", $1
+        }
+        if (worse($2, build[$1], tt, floor * 1000)) {
+            printf "FAIL: %s load and build time regressed\n", $1
+        }
+        if (worse($3, query[$1], tt, floor * 1000)) {
+            printf "FAIL: %s query time regressed\n", $1
+        }
+        if (worse($4, rss[$1], rt, rssFloor)) {
+            printf "FAIL: %s peak RSS regressed\n", $1
+        }
+        if (worse($5, allocs[$1], at, 0)) {
+            printf "FAIL: %s allocations regressed\n", $1
+        }
+    }' "$BASELINE" "$RESULTS" > "$WORKDIR/perf_report.txt"
+cat "$WORKDIR/perf_report.txt"
+failures=$((failures + $(grep -c '^FAIL' "$WORKDIR/perf_report.txt")))
+
+echo "$(wc -l < "$RESULTS") cases, $failures failed"
+[ $failures -eq 0 ]
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Trains instrumented dict3 and dict4 builds for profile guided optimisation, running them
+# over generated uniform and clustered datasets with each index engine and the main options.
+#
+# Usage: bench/pgo_train.sh <dict3 binary> <dict4 binary> [records] [queries]
+
+DICT3=${1:-./dict3_pgo}
+DICT4=${2:-./dict4_pgo}
+RECORDS=${3:-100000}
+QUERIES=${4:-2000}
+SEED=${BENCH_SEED:-20003}
+WORKDIR=${PGO_TRAIN_DIR:-bench_data}
+
+# Root node area, matching the area gendata draws points from
+ROOT="144.90 -37.90 145.10 -37.70"
+
+mkdir -p "$WORKDIR" || exit 1
+
+for dist in uniform clustered; do
+    csv="$WORKDIR/$dist-$RECORDS.csv"
+    points="$WORKDIR/$dist-$RECORDS.s3.in"
+    ranges="$WORKDIR/$dist-$RECORDS.s4.in"
+    if [ ! -f "$csv" ]; then
+        ./gendata "$RECORDS" "$dist" "$SEED" "$csv" "$points" "$ranges" "$QUERIES" || exit 1
+    fi
+
+    for engine in pointer linear compact specialised disk; do
+        echo "training $dist $engine"
+        $DICT3 3 "$csv" /dev/null $ROOT --engine=$engine < "$points" > /dev/null || exit 1
+        $DICT4 4 "$csv" /dev/null $ROOT --engine=$engine < "$ranges" > /dev/null || exit 1
+        $DICT4 4 "$csv" /dev/null $ROOT --engine=$engine --count-only < "$ranges" \
+            > /dev/null || exit 1
+    done
+    $DICT4 4 "$csv" /dev/null $ROOT --lazy --cache=4M < "$ranges" > /dev/null || exit 1
+    $DICT4 4 "$csv" /dev/null $ROOT --batch=256 < "$ranges" > /dev/null || exit 1
+done
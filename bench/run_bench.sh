@@ -0,0 +1,60 @@
+#!/bin/sh
+# Generates synthetic datasets and query workloads, runs dict3 (point queries)
+# and dict4 (range queries) over them with each index engine, and prints one
+# tab-separated line per run so results can be diffed between builds.
+#
+# Usage: bench/run_bench.sh "<sizes>" "<distributions>" [queries] [engines]
+
+SIZES=${1:-"10000 100000"}
+DISTS=${2:-"uniform clustered duplicates"}
+QUERIES=${3:-1000}
+ENGINES=${4:-"pointer linear"}
+SEED=${BENCH_SEED:-20003}
+WORKDIR=${BENCH_DIR:-bench_data}
+
+# Root node area, matching the area gendata draws points from
+ROOT="144.90 -37.90 145.10 -37.70"
+
+mkdir -p "$WORKDIR" || exit 1
+
+# Extracts a numeric field from the driver's --timing JSON line
+field() {
+    sed -n "s/.*\"$1\":\([0-9]*\).*/\1/p" "$2"
+}
+
+printf "program\tengine\tdistribution\trecords\tqueries\tload_ms\tbuild_ms\tpeak_rss_kb\tquery_ms\tqueries_per_s\n"
+
+for n in $SIZES; do
+    for dist in $DISTS; do
+        csv="$WORKDIR/$dist-$n.csv"
+        points="$WORKDIR/$dist-$n.s3.in"
+        ranges="$WORKDIR/$dist-$n.s4.in"
+        if [ ! -f "$csv" ]; then
+            ./gendata "$n" "$dist" "$SEED" "$csv" "$points" "$ranges" "$QUERIES" || exit 1
+        fi
+
+        for engine in $ENGINES; do
+            for program in dict3 dict4; do
+                if [ "$program" = dict3 ]; then
+                    stage=3; queryfile=$points
+                else
+                    stage=4; queryfile=$ranges
+                fi
+                timing="$WORKDIR/timing.json"
+                ./$program $stage "$csv" /dev/null $ROOT --engine="$engine" --timing \
+                    < "$queryfile" > /dev/null 2> "$timing" || exit 1
+
+                queries=$(field queries "$timing")
+                load=$(field load_ns "$timing")
+                build=$(field build_ns "$timing")
+                query=$(field query_ns "$timing")
+                rss=$(field peak_rss_kb "$timing")
+                awk -v p="$program" -v e="$engine" -v d="$dist" -v n="$n" -v q="$queries" \
+                    -v l="$load" -v b="$build" -v r="$rss" -v t="$query" 'BEGIN {
+                    printf "%s\t%s\t%s\t%d\t%d\t%.1f\t%.1f\t%d\t%.1f\t%.0f\n", p, e, d, n, q,
+                        l / 1e6, b / 1e6, r, t / 1e6, (t > 0) ? q / (t / 1e9) : 0
+                }'
+            done
+        done
+    done
+done
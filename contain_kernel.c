@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "contain_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONTAIN_X86 1
+#endif
+
+// Returns the next double towards positive (up) or negative (!up) infinity
+static double stepDouble(double d, int up) {
+    uint64_t bits;
+
+    if (d == 0) {
+        d = 0.0;
+        memcpy(&bits, &d, sizeof(bits));
+        bits = 1;
+        memcpy(&d, &bits, sizeof(d));
+        return up ? d : -d;
+    }
+
+    memcpy(&bits, &d, sizeof(bits));
+    if ((d > 0) == (up != 0)) {
+        bits++;
+    } else {
+        bits--;
+    }
+    memcpy(&d, &bits, sizeof(d));
+
+    return d;
+}
+
+// Converts a query rectangle into double bounds, rounding inwards
+void containBoundsOf(rectangle2D *range, containBounds *bounds) {
+    long double minX = range->center->x - range->x_half;
+    long double maxX = range->center->x + range->x_half;
+    long double minY = range->center->y - range->y_half;
+    long double maxY = range->center->y + range->y_half;
+
+    // A double x satisfies x >= minX exactly when it is at least the smallest double >= minX
+    bounds->minX = (double)minX;
+    if (bounds->minX < minX) {
+        bounds->minX = stepDouble(bounds->minX, 1);
+    }
+    bounds->minY = (double)minY;
+    if (bounds->minY < minY) {
+        bounds->minY = stepDouble(bounds->minY, 1);
+    }
+
+    // ... and x <= maxX exactly when it is at most the largest double <= maxX
+    bounds->maxX = (double)maxX;
+    if (bounds->maxX > maxX) {
+        bounds->maxX = stepDouble(bounds->maxX, 0);
+    }
+    bounds->maxY = (double)maxY;
+    if (bounds->maxY > maxY) {
+        bounds->maxY = stepDouble(bounds->maxY, 0);
+    }
+}
+
+// Returns 1 (TRUE) if both coordinates of the point are exactly representable as doubles
+int exactAsDouble(point2D *point) {
+    return (long double)(double)point->x == point->x && (long double)(double)point->y == point->y;
+}
+
+// Branch-free scalar kernel, used on other architectures and for tails
+static uint64_t containScalar(const double *xs, const double *ys, size_t count, 
+    const containBounds *b) {
+    uint64_t mask = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t hit = (xs[i] >= b->minX) & (xs[i] <= b->maxX) & (ys[i] >= b->minY) & (ys[i] <= b->maxY);
+        mask |= hit << i;
+    }
+
+    return mask;
+}
+
+#ifdef CONTAIN_X86
+
+// SSE2 kernel, two points per compare
+__attribute__((target("sse2")))
+static uint64_t containSSE2(const double *xs, const double *ys, size_t count, 
+    const containBounds *b) {
+    __m128d minX = _mm_set1_pd(b->minX);
+    __m128d maxX = _mm_set1_pd(b->maxX);
+    __m128d minY = _mm_set1_pd(b->minY);
+    __m128d maxY = _mm_set1_pd(b->maxY);
+    uint64_t mask = 0;
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        __m128d x = _mm_loadu_pd(xs + i);
+        __m128d y = _mm_loadu_pd(ys + i);
+        __m128d in = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(x, minX), _mm_cmple_pd(x, maxX)),
+            _mm_and_pd(_mm_cmpge_pd(y, minY), _mm_cmple_pd(y, maxY)));
+        mask |= (uint64_t)_mm_movemask_pd(in) << i;
+    }
+
+    if (i < count) {
+        mask |= containScalar(xs + i, ys + i, count - i, b) << i;
+    }
+
+    return mask;
+}
+
+// AVX kernel, four points (a whole quadtree node) per compare
+__attribute__((target("avx2")))
+static uint64_t containAVX2(const double *xs, const double *ys, size_t count, 
+    const containBounds *b) {
+    __m256d minX = _mm256_set1_pd(b->minX);
+    __m256d maxX = _mm256_set1_pd(b->maxX);
+    __m256d minY = _mm256_set1_pd(b->minY);
+    __m256d maxY = _mm256_set1_pd(b->maxY);
+    uint64_t mask = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256d x = _mm256_loadu_pd(xs + i);
+        __m256d y = _mm256_loadu_pd(ys + i);
+        __m256d in = _mm256_and_pd(
+            _mm256_and_pd(_mm256_cmp_pd(x, minX, _CMP_GE_OQ), _mm256_cmp_pd(x, maxX, _CMP_LE_OQ)),
+            _mm256_and_pd(_mm256_cmp_pd(y, minY, _CMP_GE_OQ), _mm256_cmp_pd(y, maxY, _CMP_LE_OQ)));
+        mask |= (uint64_t)_mm256_movemask_pd(in) << i;
+    }
+
+    if (i < count) {
+        mask |= containScalar(xs + i, ys + i, count - i, b) << i;
+    }
+
+    return mask;
+}
+
+#endif
+
+typedef uint64_t (*containFunction)(const double *, const double *, size_t, const containBounds *);
+
+/* Kernel chosen for the CPU, set once by whichever query thread calls containBatch first */
+static containFunction kernel = containScalar;
+static pthread_once_t kernelOnce = PTHREAD_ONCE_INIT;
+
+// Picks the widest kernel the CPU supports
+static void selectKernel(void) {
+#ifdef CONTAIN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = containAVX2;
+        return;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        kernel = containSSE2;
+        return;
+    }
+#endif
+    kernel = containScalar;
+}
+
+// Tests up to CONTAIN_BATCH points against the bounds, returning a hit mask
+uint64_t containBatch(const double *xs, const double *ys, size_t count, const containBounds *bounds) {
+    assert(count <= CONTAIN_BATCH);
+    pthread_once(&kernelOnce, selectKernel);
+
+    return kernel(xs, ys, count, bounds);
+}
@@ -0,0 +1,33 @@
+#ifndef CONTAIN_KERNEL_H
+#define CONTAIN_KERNEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "quadtree.h"
+
+/* Most points tested by one call, one bit of the returned mask each */
+#define CONTAIN_BATCH 64
+
+// data definitions
+
+/* Query rectangle bounds as doubles, equivalent to inRectangle for points whose coordinates are doubles */
+typedef struct containBounds {
+    double minX;
+    double minY;
+    double maxX;
+    double maxY;
+} containBounds;
+
+// function definitions
+
+/* Converts a query rectangle into double bounds, rounding inwards so no exact double point changes side */
+void containBoundsOf(rectangle2D *range, containBounds *bounds);
+
+/* Returns 1 (TRUE) if both coordinates of the point are exactly representable as doubles */
+int exactAsDouble(point2D *point);
+
+/* Tests up to CONTAIN_BATCH points given as separate x and y arrays against the bounds,
+returning a mask with bit i set when point i lies within them */
+uint64_t containBatch(const double *xs, const double *ys, size_t count, const containBounds *bounds);
+
+#endif
@@ -2,13 +2,413 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/resource.h>
+#include <pthread.h>
 #include "read.h"
 #include "dictionary.h"
+#include "query_stats.h"
+#include "server.h"
+#include "pipeline.h"
+#include "alloc_stats.h"
 
 
 #define MINARGS 7
+#define ENGINE_FLAG "--engine="
+#define STATS_FLAG "--stats"
+#define QUERY_STATS_FLAG "--query-stats"
+#define ALLOC_STATS_FLAG "--alloc-stats"
+#define TIMING_FLAG "--timing"
+#define COUNT_ONLY_FLAG "--count-only"
+#define AGGREGATE_FLAG "--aggregate="
+#define FILTER_INDEX_FLAG "--filter-index="
+#define SERVE_FLAG "--serve="
+#define WORKERS_FLAG "--workers="
+#define NO_PIPELINE_FLAG "--no-pipeline"
+#define LAZY_FLAG "--lazy"
+#define CACHE_FLAG "--cache="
+#define TILES_FLAG "--tiles"
+#define DATASET_FLAG "--dataset="
+#define BATCH_FLAG "--batch="
+#define MAX_RESULTS_FLAG "--max-results="
+#define MAX_NODES_FLAG "--max-nodes="
+#define DEADLINE_FLAG "--deadline-ms="
+#define PAGE_FILE_FLAG "--page-file="
+#define PAGE_CACHE_FLAG "--page-cache="
+/* Result cache size when tile queries are answered without a --cache size */
+#define TILE_CACHE_DEFAULT (64 << 20)
+#define STATS_REQUEST "stats"
+#define CURSOR_REQUEST "next"
+
+/* dict4 is built from this file with EXPECTED_STAGE "4" and STAGE (RANGEQUERY) */
+#ifndef EXPECTED_STAGE
 #define EXPECTED_STAGE "3"
+#endif
+#ifndef STAGE
 #define STAGE (REGIONQUERY)
+#endif
+
+/* Optional driver behaviour selected by flags after the positional arguments. */
+struct options {
+    int engine;
+    int printStats;
+    int printQueryStats;
+    /* Whether the blocks and bytes still allocated per subsystem are printed after teardown */
+    int printAllocStats;
+    int printTiming;
+    int countOnly;
+    /* Comma-separated fields summarised per range query, or NULL */
+    char *aggregateFields;
+    /* Comma-separated fields summarised per node for filtered queries, or NULL */
+    char *filterIndexFields;
+    /* Unix domain socket to serve queries on instead of reading stdin, or NULL */
+    char *socketPath;
+    int numWorkers;
+    /* Whether stdin queries are read, answered and written by separate threads */
+    int pipeline;
+    /* Whether fields other than footpath_id and the coordinates are parsed on first use */
+    int lazy;
+    /* Memory budget in bytes of the query result cache, or 0 for no cache */
+    size_t cacheBytes;
+    /* Whether query lines are zoom/x/y tiles of the root rectangle */
+    int tiles;
+    /* Datasets loaded after the first, each into a shard of its own */
+    char **datasets;
+    int numDatasets;
+    /* Range queries read from stdin and answered together, or 0 to answer each as it is read */
+    int batchSize;
+    /* Limits on each range query (records per page, nodes and milliseconds), or 0 for none */
+    size_t maxResults;
+    size_t maxNodes;
+    unsigned long long deadlineMs;
+    /* File the disk engine writes its pages to (or NULL for a temporary file), and the bytes of
+    them it caches (or 0 for its default) */
+    char *pageFile;
+    size_t pageCacheBytes;
+};
+
+/* Everything a query needs besides its text, shared by the stdin loop and server workers. */
+struct queryContext {
+    struct dictionary *dict;
+    spatialIndex *index;
+    queryCache *cache;
+    struct options *opts;
+    size_t numQueries;
+};
+
+/* Returns the number of bytes written as a count with an optional K, M or G suffix, 
+or 0 if it cannot be read. */
+size_t parseByteSize(char *size);
+
+size_t parseByteSize(char *size){
+    char *end;
+    unsigned long long bytes = strtoull(size, &end, 10);
+    if (end == size) {
+        return 0;
+    }
+    if (*end == 'K' || *end == 'k') {
+        bytes <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        bytes <<= 20;
+        end++;
+    } else if (*end == 'G' || *end == 'g') {
+        bytes <<= 30;
+        end++;
+    }
+    return *end == '\0' ? bytes : 0;
+}
+
+/* Returns the positive count following the flag's name, exiting if there is none. */
+unsigned long long parseLimit(char *flag, char *name);
+
+unsigned long long parseLimit(char *flag, char *name){
+    char *end;
+    unsigned long long limit = strtoull(flag + strlen(name), &end, 10);
+    if (end == flag + strlen(name) || *end != '\0' || limit == 0) {
+        fprintf(stderr, "Expected a positive limit, received %s\n", flag);
+        exit(EXIT_FAILURE);
+    }
+    return limit;
+}
+
+/* Parses the optional flags, exiting on any flag not recognised. */
+void parseOptions(int argc, char **argv, struct options *opts);
+
+void parseOptions(int argc, char **argv, struct options *opts){
+    opts->engine = ENGINE_POINTER;
+    opts->printStats = 0;
+    opts->printQueryStats = 0;
+    opts->printAllocStats = 0;
+    opts->printTiming = 0;
+    opts->countOnly = 0;
+    opts->aggregateFields = NULL;
+    opts->filterIndexFields = NULL;
+    opts->socketPath = NULL;
+    opts->numWorkers = SERVER_DEFAULT_WORKERS;
+    opts->pipeline = 1;
+    opts->lazy = 0;
+    opts->cacheBytes = 0;
+    opts->tiles = 0;
+    opts->datasets = (char **) trackedMalloc(ALLOC_DICT, sizeof(char *) * argc);
+    assert(opts->datasets);
+    opts->numDatasets = 0;
+    opts->batchSize = 0;
+    opts->maxResults = 0;
+    opts->maxNodes = 0;
+    opts->deadlineMs = 0;
+    opts->pageFile = NULL;
+    opts->pageCacheBytes = 0;
+
+    for (int i = MINARGS + 1; i < argc; i++) {
+        if (strcmp(argv[i], STATS_FLAG) == 0) {
+            opts->printStats = 1;
+        } else if (strcmp(argv[i], QUERY_STATS_FLAG) == 0) {
+            opts->printQueryStats = 1;
+        } else if (strcmp(argv[i], ALLOC_STATS_FLAG) == 0) {
+            opts->printAllocStats = 1;
+        } else if (strcmp(argv[i], TIMING_FLAG) == 0) {
+            opts->printTiming = 1;
+        } else if (strcmp(argv[i], LAZY_FLAG) == 0) {
+            opts->lazy = 1;
+        } else if (strcmp(argv[i], NO_PIPELINE_FLAG) == 0) {
+            opts->pipeline = 0;
+        } else if (strncmp(argv[i], DATASET_FLAG, strlen(DATASET_FLAG)) == 0) {
+            opts->datasets[opts->numDatasets++] = argv[i] + strlen(DATASET_FLAG);
+        } else if (strcmp(argv[i], TILES_FLAG) == 0) {
+            opts->tiles = 1;
+        } else if (strcmp(argv[i], COUNT_ONLY_FLAG) == 0) {
+            opts->countOnly = 1;
+        } else if (strncmp(argv[i], AGGREGATE_FLAG, strlen(AGGREGATE_FLAG)) == 0) {
+            opts->aggregateFields = argv[i] + strlen(AGGREGATE_FLAG);
+        } else if (strncmp(argv[i], FILTER_INDEX_FLAG, strlen(FILTER_INDEX_FLAG)) == 0) {
+            opts->filterIndexFields = argv[i] + strlen(FILTER_INDEX_FLAG);
+        } else if (strncmp(argv[i], SERVE_FLAG, strlen(SERVE_FLAG)) == 0) {
+            opts->socketPath = argv[i] + strlen(SERVE_FLAG);
+        } else if (strncmp(argv[i], WORKERS_FLAG, strlen(WORKERS_FLAG)) == 0) {
+            opts->numWorkers = atoi(argv[i] + strlen(WORKERS_FLAG));
+            if (opts->numWorkers < 1) {
+                fprintf(stderr, "Expected at least one worker, received %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[i], BATCH_FLAG, strlen(BATCH_FLAG)) == 0) {
+            opts->batchSize = atoi(argv[i] + strlen(BATCH_FLAG));
+            if (opts->batchSize < 1) {
+                fprintf(stderr, "Expected at least one query per batch, received %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[i], MAX_RESULTS_FLAG, strlen(MAX_RESULTS_FLAG)) == 0) {
+            opts->maxResults = parseLimit(argv[i], MAX_RESULTS_FLAG);
+        } else if (strncmp(argv[i], MAX_NODES_FLAG, strlen(MAX_NODES_FLAG)) == 0) {
+            opts->maxNodes = parseLimit(argv[i], MAX_NODES_FLAG);
+        } else if (strncmp(argv[i], DEADLINE_FLAG, strlen(DEADLINE_FLAG)) == 0) {
+            opts->deadlineMs = parseLimit(argv[i], DEADLINE_FLAG);
+        } else if (strncmp(argv[i], PAGE_FILE_FLAG, strlen(PAGE_FILE_FLAG)) == 0) {
+            opts->pageFile = argv[i] + strlen(PAGE_FILE_FLAG);
+        } else if (strncmp(argv[i], PAGE_CACHE_FLAG, strlen(PAGE_CACHE_FLAG)) == 0) {
+            opts->pageCacheBytes = parseByteSize(argv[i] + strlen(PAGE_CACHE_FLAG));
+            if (opts->pageCacheBytes == 0) {
+                fprintf(stderr, "Expected a page cache size such as 16M, received %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[i], CACHE_FLAG, strlen(CACHE_FLAG)) == 0) {
+            opts->cacheBytes = parseByteSize(argv[i] + strlen(CACHE_FLAG));
+            if (opts->cacheBytes == 0) {
+                fprintf(stderr, "Expected a cache size such as 64M, received %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[i], ENGINE_FLAG, strlen(ENGINE_FLAG)) == 0) {
+            opts->engine = parseEngine(argv[i] + strlen(ENGINE_FLAG));
+            if (opts->engine == ENGINE_UNKNOWN) {
+                fprintf(stderr, "Unknown engine %s, expected pointer, linear, compact, specialised or disk\n", 
+                    argv[i] + strlen(ENGINE_FLAG));
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Answers one query line, writing its summary and records to the given files. */
+void answerQuery(char *query, FILE *summaryFile, FILE *outputFile, void *arg);
+
+void answerQuery(char *query, FILE *summaryFile, FILE *outputFile, void *arg){
+    struct queryContext *ctx = (struct queryContext *) arg;
+    size_t queryNumber = __atomic_fetch_add(&ctx->numQueries, 1, __ATOMIC_RELAXED);
+    queryStatsBegin();
+
+    // A request for the next page of a range query names the cursor it was given
+    int cursorId;
+    char extra;
+    if (STAGE == RANGEQUERY && sscanf(query, CURSOR_REQUEST " %d %c", &cursorId, &extra) == 1) {
+        printNextPage(ctx->dict, cursorId, summaryFile, outputFile);
+        queryStatsEnd(ctx->opts->printQueryStats ? stderr : NULL, queryNumber);
+        return;
+    }
+
+    // Search for the query within the dictionary
+    struct queryResult *r;
+    if (ctx->opts->tiles) {
+        r = lookupTile(ctx->dict, query);
+    } else if (STAGE == RANGEQUERY) {
+        r = lookupRange(ctx->dict, query);
+    } else {
+        r = lookupRecord(ctx->dict, query);
+    }
+
+    // Output the records matching the query, or just how many points match
+    if (ctx->opts->tiles) {
+        printTileResult(r, summaryFile, outputFile, ctx->index);
+    } else if (STAGE == RANGEQUERY && ctx->opts->aggregateFields) {
+        printRangeAggregate(r, summaryFile, outputFile, ctx->index);
+    } else if (STAGE == RANGEQUERY && ctx->opts->countOnly) {
+        printRangeCount(r, summaryFile, outputFile, ctx->index);
+    } else if (STAGE == RANGEQUERY && hasQueryBudget(ctx->dict)) {
+        printRangePage(r, summaryFile, outputFile, ctx->index);
+    } else {
+        printQueryResult(r, summaryFile, outputFile, STAGE, ctx->index);
+    }
+
+    // Per-query counters and the final summary go to stderr as JSON lines
+    queryStatsEnd(ctx->opts->printQueryStats ? stderr : NULL, queryNumber);
+
+    freeQueryResult(r);
+}
+
+/* Answers a batch of range query lines together, writing their summaries and records to the
+given files in the order read. The batch is timed and counted as one query by --query-stats. */
+void answerBatch(char **queries, size_t numQueries, FILE *summaryFile, FILE *outputFile, 
+    struct queryContext *ctx);
+
+void answerBatch(char **queries, size_t numQueries, FILE *summaryFile, FILE *outputFile, 
+    struct queryContext *ctx){
+    size_t queryNumber = __atomic_fetch_add(&ctx->numQueries, numQueries, __ATOMIC_RELAXED);
+    queryStatsBegin();
+
+    struct queryResult **rs = (struct queryResult **) trackedMalloc(ALLOC_QUERY, 
+        sizeof(struct queryResult *) * numQueries);
+    assert(rs);
+    for (size_t i = 0; i < numQueries; i++) {
+        rs[i] = lookupRange(ctx->dict, queries[i]);
+    }
+    printRangeBatch(rs, numQueries, summaryFile, outputFile, ctx->index);
+
+    queryStatsEnd(ctx->opts->printQueryStats ? stderr : NULL, queryNumber);
+
+    for (size_t i = 0; i < numQueries; i++) {
+        freeQueryResult(rs[i]);
+    }
+    trackedFree(ALLOC_QUERY, rs);
+}
+
+/* Answers a request sent to the server: the records of a query followed by its summary,
+or the index statistics and query totals for a stats request. */
+void serveQuery(char *request, FILE *f, void *arg);
+
+void serveQuery(char *request, FILE *f, void *arg){
+    struct queryContext *ctx = (struct queryContext *) arg;
+
+    if (strcmp(request, STATS_REQUEST) == 0) {
+        indexPrintStats(ctx->index, f);
+        queryStatsReport(f);
+        if (ctx->cache) {
+            cacheReport(ctx->cache, f);
+        }
+        allocReport(f);
+        return;
+    }
+
+    char *summary = NULL;
+    size_t summaryLen = 0;
+    FILE *summaryFile = open_memstream(&summary, &summaryLen);
+    assert(summaryFile);
+    answerQuery(request, summaryFile, f, ctx);
+    fclose(summaryFile);
+    trackedAdopt(ALLOC_QUERY, summary);
+
+    fwrite(summary, 1, summaryLen, f);
+    trackedFree(ALLOC_QUERY, summary);
+}
+
+/* One dataset loaded into its own shard and part of the dictionary by a thread. */
+struct shardLoad {
+    char *path;
+    struct dictionary *part;
+    spatialIndex *shard;
+    int lazy;
+    int n;
+};
+
+/* Reads a dataset and inserts its records into the load's part and shard. */
+void *loadShard(void *arg);
+
+void *loadShard(void *arg){
+    struct shardLoad *load = (struct shardLoad *) arg;
+    FILE *csvFile = fopen(load->path, "r");
+    if (! csvFile) {
+        fprintf(stderr, "Cannot open dataset %s\n", load->path);
+        exit(EXIT_FAILURE);
+    }
+
+    struct csvRecord **dataset = load->lazy ? readCSVInPlace(csvFile, &load->n) 
+        : readCSV(csvFile, &load->n);
+    for (int i = 0; i < load->n; i++) {
+        insertRecord(load->part, dataset[i], load->shard);
+    }
+    indexBuild(load->shard);
+
+    freeCSV(dataset, load->n);
+    fclose(csvFile);
+    return NULL;
+}
+
+/* Loads the first dataset and every further one into a shard of the index each, with a
+thread per dataset, then appends their records to the dictionary in the order the datasets
+were given. Returns the number of records read. */
+int loadShards(struct dictionary *dict, spatialIndex *index, char *firstPath, 
+    struct options *opts);
+
+int loadShards(struct dictionary *dict, spatialIndex *index, char *firstPath, 
+    struct options *opts){
+    int numShards = opts->numDatasets + 1;
+    struct shardLoad *loads = (struct shardLoad *) trackedMalloc(ALLOC_DICT, 
+        sizeof(struct shardLoad) * numShards);
+    pthread_t *threads = (pthread_t *) trackedMalloc(ALLOC_DICT, sizeof(pthread_t) * numShards);
+    assert(loads && threads);
+
+    for (int i = 0; i < numShards; i++) {
+        loads[i].path = i == 0 ? firstPath : opts->datasets[i - 1];
+        loads[i].part = newPartDict(dict);
+        loads[i].shard = index->shards[i];
+        loads[i].lazy = opts->lazy;
+        loads[i].n = 0;
+        int created = pthread_create(&threads[i], NULL, loadShard, &loads[i]);
+        assert(created == 0);
+    }
+
+    int n = 0;
+    for (int i = 0; i < numShards; i++) {
+        pthread_join(threads[i], NULL);
+        appendDict(dict, loads[i].part);
+        n += loads[i].n;
+    }
+
+    trackedFree(ALLOC_DICT, loads);
+    trackedFree(ALLOC_DICT, threads);
+    return n;
+}
+
+/* Returns the peak resident set size of the process in kilobytes. */
+long peakRSSKilobytes();
+
+long peakRSSKilobytes(){
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_maxrss;
+}
 
 int main(int argc, char **argv){
     
@@ -25,6 +425,11 @@ int main(int argc, char **argv){
         exit(EXIT_FAILURE);
     }
 
+    // Optional flags follow the seven positional arguments
+    struct options opts;
+    parseOptions(argc, argv, &opts);
+    unsigned long long startNs = monotonicNs();
+
     char *temp;
     long double startLat, startLon, endLat, endLon;
     long double x_mid, y_mid;
@@ -65,13 +470,20 @@ int main(int argc, char **argv){
     assert(outputFile);
 
     
-    int n;
+    int n = 0;
 
-    // Reads the csv file line by line and stores each record as a struct
-    struct csvRecord **dataset = readCSV(csvFile, &n);
+    // Reads the csv file line by line and stores each record as a struct; with further 
+    // datasets every file is read by the thread loading its shard instead. Lazy records keep 
+    // their line, so it is split in place rather than copied field by field
+    struct csvRecord **dataset = NULL;
+    if (opts.numDatasets == 0) {
+        dataset = opts.lazy ? readCSVInPlace(csvFile, &n) : readCSV(csvFile, &n);
+    }
+    unsigned long long loadedNs = monotonicNs();
 
     // Create a dictionary to store all the structs
     struct dictionary *dict = newDict();
+    setLazyRecords(dict, opts.lazy);
 
     // Creates the center point of the root node 
     point2D *center = create_point(x_mid, y_mid);
@@ -82,41 +494,139 @@ int main(int argc, char **argv){
     // Forms the rectangle around the center point to create the root node rectangle
     rectangle2D *boundary = create_rectangle(center, x_half, y_half);
 
-    // Inserts the rectangle as the root node of the quadtree
-    QuadTree *qt = new_Quadtree(boundary);
+    // Inserts the rectangle as the root node of the selected index engine, one per dataset
+    spatialIndex *index;
+    if (opts.numDatasets > 0) {
+        index = newShardedIndex(boundary, opts.engine, opts.numDatasets + 1);
+    } else {
+        index = newSpatialIndex(boundary, opts.engine);
+    }
+    indexSetPointResolver(index, recordPoint);
+    if (! indexSetPageStorage(index, opts.pageFile, opts.pageCacheBytes)) {
+        fprintf(stderr, "Cannot open page file %s\n", opts.pageFile);
+        exit(EXIT_FAILURE);
+    }
+
+    // Per-node summaries must be set up before any point is inserted
+    aggregateSpec aggSpec;
+    if (opts.aggregateFields) {
+        if (! parseAggregateColumns(opts.aggregateFields, &aggSpec)) {
+            exit(EXIT_FAILURE);
+        }
+        indexEnableAggregates(index, &aggSpec);
+    }
+    aggregateSpec summarySpec;
+    if (opts.filterIndexFields) {
+        if (! parseSummaryColumns(dict, opts.filterIndexFields, &summarySpec)) {
+            exit(EXIT_FAILURE);
+        }
+        indexEnableSummaries(index, &summarySpec);
+    }
 
     point2D *start_p=NULL;
     point2D *end_p=NULL;
 
     // Inserts each line of the CSV file as a record in the dictionary
     // Simoultaenously adds the coordinate pairs from the records into the quadtree 
-    for(int i = 0; i < n; i++){
-        insertRecord(dict, dataset[i],qt);   
+    if (opts.numDatasets > 0) {
+        n = loadShards(dict, index, inputCSVName, &opts);
+    } else {
+        for(int i = 0; i < n; i++){
+            insertRecord(dict, dataset[i], index);   
+        }
     }
+    indexBuild(index);
+    rankRecords(dict);
+    unsigned long long builtNs = monotonicNs();
 
     free(start_p);
     free(end_p);
     freeCSV(dataset, n);
 
+    // Index statistics go to stderr so query output is unaffected
+    if (opts.printStats) {
+        indexPrintStats(index, stderr);
+    }
+
     
-    char *query = NULL;
+    // Results are cached once the index is built, and dropped if it changes
+    queryCache *cache = NULL;
+    if (opts.tiles && ! opts.cacheBytes) {
+        opts.cacheBytes = TILE_CACHE_DEFAULT;
+    }
+    if (opts.cacheBytes) {
+        cache = newQueryCache(opts.cacheBytes, &index->generation);
+        setQueryCache(dict, cache);
+    }
+    setQueryBudget(dict, opts.maxResults, opts.maxNodes, opts.deadlineMs);
+    struct queryContext ctx = {dict, index, cache, &opts, 0};
 
-    // Gets each query line by line from the user
-    while((query = getQuery(stdin))){
+    if (opts.socketPath) {
+        // Queries come from clients of the socket until the server is stopped
+        fprintf(stderr, "Serving %d records on %s\n", n, opts.socketPath);
+        if (serveRequests(opts.socketPath, opts.numWorkers, serveQuery, &ctx) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (opts.batchSize > 0 && STAGE == RANGEQUERY && ! opts.tiles && ! opts.countOnly &&
+        ! opts.aggregateFields && ! hasQueryBudget(dict)) {
+        // Range queries are read a batch at a time and answered with shared traversals
+        char **queries = (char **) trackedMalloc(ALLOC_QUERY, sizeof(char *) * opts.batchSize);
+        assert(queries);
+        size_t numQueries = 0;
+        char *query = NULL;
+        do {
+            query = getQuery(stdin);
+            if (query) {
+                queries[numQueries++] = query;
+            }
+            if (numQueries > 0 && (! query || numQueries == (size_t) opts.batchSize)) {
+                answerBatch(queries, numQueries, stdout, outputFile, &ctx);
+                for (size_t i = 0; i < numQueries; i++) {
+                    trackedFree(ALLOC_QUERY, queries[i]);
+                }
+                numQueries = 0;
+            }
+        } while (query);
+        trackedFree(ALLOC_QUERY, queries);
+    } else if (opts.pipeline) {
+        // Reading, answering and writing queries overlap on separate threads
+        runPipeline(stdin, stdout, outputFile, answerQuery, &ctx);
+    } else {
+        // Gets each query line by line from the user
+        char *query = NULL;
+        while((query = getQuery(stdin))){
+            answerQuery(query, stdout, outputFile, &ctx);
+            trackedFree(ALLOC_QUERY, query);
+        }
+    }
 
-        // Search for the query within the dictionary
-        struct queryResult *r = lookupRecord(dict, query);
+    unsigned long long queriedNs = monotonicNs();
 
-        // Output the records matching the query
-        printQueryResult(r, stdout, outputFile, STAGE,qt);
-          
-        freeQueryResult(r);
-        free(query);
+    if (opts.printQueryStats) {
+        queryStatsReport(stderr);
+        if (cache) {
+            cacheReport(cache, stderr);
+        }
     }
 
+    // Phase timings and peak memory as one JSON line, for the benchmark harness
+    if (opts.printTiming) {
+        fprintf(stderr, "{\"records\":%d,\"queries\":%zu,\"load_ns\":%llu,\"build_ns\":%llu,"
+            "\"query_ns\":%llu,\"peak_rss_kb\":%ld}\n", n, ctx.numQueries, loadedNs - startNs,
+            builtNs - loadedNs, queriedNs - builtNs, peakRSSKilobytes());
+    }
+
+    // Everything allocated is freed, so --alloc-stats shows any block left behind
     freeDict(dict);
     dict = NULL;
-    free(center);
+    freeQueryCache(cache);
+    freeSpatialIndex(index);
+    indexReleaseResults();
+    freeRectangle(boundary);
+    trackedFree(ALLOC_DICT, opts.datasets);
+    if (opts.printAllocStats) {
+        allocReport(stderr);
+    }
 
     fclose(csvFile);
     fclose(outputFile);
@@ -1,4 +1,7 @@
 #include "dictionary.h"
+#include "parse_double.h"
+#include "query_stats.h"
+#include "alloc_stats.h"
 #include "record_struct.h"
 #include "record_struct.c"
 
@@ -6,6 +9,9 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
 
 #define NUMERIC_BASE 10
 #define KEY_FIELD 1
@@ -13,11 +19,15 @@
 #define NOTDOUBLE (-1)
 #define MAXPRECISION (-2)
 #define NUM_FIELDS 19
-#define QT_NODE_CAPACITY (4)
-#define MAX_ARRAY_SIZE (1024)
 #define FIELDLOOKUPFAILURE (-1)
 #define INDEXINITIAL 1
 #define APPROXIMATE_VALUE 0.000000000000001
+#define FILTER_SEPARATOR '|'
+#define FILTER_CLAUSE_SEPARATOR "&"
+#define MAX_FILTER_CONDITIONS 8
+#define NOCATEGORY (-1)
+#define BITS_PER_WORD 64
+#define MAX_OPEN_CURSORS 256
 
 // Field names by index.
 static char *fieldNames[] = {"footpath_id", "address", "clue_sa", 
@@ -42,6 +52,56 @@ struct queryResult {
     struct data **records;
     long double x_val;
     long double y_val;
+    /* Top-right corner, only set for range queries. */
+    char *lonMax;
+    char *latMax;
+    long double x_max;
+    long double y_max;
+    /* Dictionary the query was looked up in, which orders range results. */
+    struct dictionary *dict;
+    /* Attribute filter following the coordinates, or NULL. */
+    char *where;
+    struct recordFilter *filter;
+    /* Tile of a tile query, with zoom -1 if the tile could not be read. */
+    int zoom;
+    uint32_t tileX;
+    uint32_t tileY;
+    /* Key of the query in the dictionary's result cache, or NULL when not caching. */
+    char *cacheKey;
+    /* Set when the result was found in the cache, which holds it in hit. */
+    int cached;
+    cachedResult hit;
+};
+
+/* Comparison operators of filter conditions, two-character operators first. */
+enum filterOp {FILTER_NE, FILTER_LE, FILTER_GE, FILTER_EQ, FILTER_LT, FILTER_GT, NUM_FILTER_OPS};
+static char *filterOpNames[] = {"!=", "<=", ">=", "=", "<", ">"};
+
+/* One "field op value" clause of a filter. */
+struct filterCondition {
+    int field;
+    int op;
+    double value;
+    char *text;
+    /* Category id of the text for string fields, or NOCATEGORY if no record has it. */
+    int category;
+};
+
+/* Conjunction of conditions records must meet to be returned by a query. */
+struct recordFilter {
+    int numConditions;
+    /* Set to 0 when the filter could not be parsed, so nothing matches. */
+    int valid;
+    struct filterCondition conditions[MAX_FILTER_CONDITIONS];
+};
+
+/* 
+Distinct values of a string field, numbered in order of first appearance.
+Values past the first AGG_CATEGORY_OVERFLOW share the overflow id.
+*/
+struct categoryTable {
+    int numValues;
+    char *values[AGG_CATEGORY_OVERFLOW];
 };
 
 /* CSV records. */
@@ -66,6 +126,15 @@ struct data {
     double start_lon;
     double end_lat;
     double end_lon;
+    /* Category ids of the string fields the dictionary numbers. */
+    unsigned char category[NUM_FIELDS];
+    /* 
+    For records read lazily, the NUL-separated text of every field until 
+    first accessed; only the key and coordinates are parsed before then. 
+    */
+    char *raw;
+    /* Position of the record in footpath_id order. */
+    int rank;
 };
 
 /* A node in the dictionary, used to allow quick lookup. */
@@ -88,8 +157,68 @@ struct dictionary {
     struct dictionaryNode *head;
     struct dictionaryNode *tail;
     struct index **indices;
+    /* Category tables of the string fields, indexed by field; shared with any parts. */
+    struct categoryTable *categories;
+    /* Whether this is a part whose records are appended to another dictionary. */
+    int isPart;
+    /* Whether each string field's values are numbered as records are inserted. */
+    int categorised[NUM_FIELDS];
+    /* Whether records are inserted without parsing fields other than the key and coordinates. */
+    int lazy;
+    int numRecords;
+    /* Records in footpath_id order, covering the first numRanked records inserted. */
+    struct data **byRank;
+    int numRanked;
+    /* Results of earlier point and range queries, or NULL. */
+    queryCache *cache;
+    /* Limits on range queries, or 0 for none; with any set, results are printed in pages. */
+    size_t maxResults;
+    size_t maxNodes;
+    unsigned long long deadlineNs;
+    /* Range queries with pages still to print, most recently used first. */
+    struct queryCursor *cursors;
+    int numCursors;
+    int lastCursorId;
+};
+
+/* A range query run within the dictionary's limits with records still to print. */
+struct queryCursor {
+    int id;
+    indexCursor *search;
+    struct recordFilter *filter;
+    pointFilter test;
+    /* Ranks found but not yet printed, and all ranks found, in increasing order. */
+    int *pending;
+    size_t numPending;
+    int *found;
+    size_t numFound;
+    struct queryCursor *next;
+};
+
+/* 
+One bit per rank, clear between queries, marking the records a range query found.
+Each thread has its own, so range queries can run concurrently.
+*/
+struct rankMarks {
+    size_t numWords;
+    uint64_t words[];
 };
 
+static pthread_key_t rankMarksKey;
+static pthread_once_t rankMarksOnce = PTHREAD_ONCE_INIT;
+
+/* Held while a lazily read record is parsed, as concurrent queries may reach it at once. */
+static pthread_mutex_t materialiseLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Held while the open cursors are taken or put back, as server workers share them. */
+static pthread_mutex_t cursorLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Reasons a page of a range query ends short of its records, by RANGE_STOPPED_ value. */
+static char *truncationNames[] = {"", "results", "nodes", "deadline"};
+
+/* Held while string values are numbered, as dictionary parts may be filled concurrently. */
+static pthread_mutex_t categoryLock = PTHREAD_MUTEX_INITIALIZER;
+
 /* Reads a given string as an integer and returns the integer. */
 int readIntField(char *fieldString);
 
@@ -104,13 +233,13 @@ int readIntField(char *fieldString){
 }
 
 char *readStringField(char *fieldString){
-    char *str = strdup(fieldString);
+    char *str = trackedStrdup(ALLOC_DICT, fieldString);
     assert(str);
     return str;
 }
 
 double readDoubleField(char *fieldString){
-    return strtod(fieldString, NULL);
+    return parseDouble(fieldString, NULL);
 }
 
 /* Sets the relevant field. */
@@ -187,6 +316,35 @@ void setField(struct data *record, int fieldIndex, char *fieldVal){
 
 }
 
+/* Returns 1 if the field is parsed as soon as a record is read, even lazily. */
+int isEagerField(int fieldIndex);
+
+int isEagerField(int fieldIndex){
+    return fieldIndex == 0 || (fieldIndex >= 15 && fieldIndex <= 18);
+}
+
+/* Parses the remaining fields of a lazily read record, if it has not been already. */
+void materialiseRecord(struct data *record);
+
+void materialiseRecord(struct data *record){
+    if(! __atomic_load_n(&record->raw, __ATOMIC_ACQUIRE)){
+        return;
+    }
+    pthread_mutex_lock(&materialiseLock);
+    if(record->raw){
+        char *fieldVal = record->raw;
+        for(int i = 0; i < NUM_FIELDS; i++){
+            if(! isEagerField(i)){
+                setField(record, i, fieldVal);
+            }
+            fieldVal += strlen(fieldVal) + 1;
+        }
+        trackedFree(ALLOC_DICT, record->raw);
+        __atomic_store_n(&record->raw, NULL, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&materialiseLock);
+}
+
 /* Returns the double value for the given field index. */
 double getDoubleVal(struct data *record, int fieldIndex);
 
@@ -241,6 +399,96 @@ double getDoubleVal(struct data *record, int fieldIndex){
     return FIELDLOOKUPFAILURE;
 }
 
+/* Returns the value of a numeric (integer or double) field as a double. */
+double getNumericVal(struct data *record, int fieldIndex);
+
+double getNumericVal(struct data *record, int fieldIndex){
+    if(! isEagerField(fieldIndex)){
+        materialiseRecord(record);
+    }
+    switch(fieldIndex){
+        case 0:
+            return record->footpath_id;
+        case 7:
+            return record->mcc_id;
+        case 8:
+            return record->mccid_int;
+        case 12:
+            return record->statusid;
+        case 13:
+            return record->streetid;
+        case 14:
+            return record->street_group;
+        default:
+            return getDoubleVal(record, fieldIndex);
+    }
+}
+
+/* Returns 1 if the field at the given index holds a number. */
+int isNumericField(int fieldIndex);
+
+int isNumericField(int fieldIndex){
+    return fieldIndex >= 0 && fieldIndex < NUM_FIELDS && fieldIndex != 1 && 
+        fieldIndex != 2 && fieldIndex != 3 && fieldIndex != 11;
+}
+
+/* Returns the value of a string field. */
+char *getStringVal(struct data *record, int fieldIndex);
+
+char *getStringVal(struct data *record, int fieldIndex){
+    materialiseRecord(record);
+    switch(fieldIndex){
+        case 1:
+            return record->address;
+        case 2:
+            return record->clue_sa;
+        case 3:
+            return record->asset_type;
+        case 11:
+            return record->segside;
+        default:
+            fprintf(stderr, "%d: Unhandled field number %d\n", __LINE__, 
+                fieldIndex);
+            assert(fieldIndex >= 0 && fieldIndex < NUM_FIELDS && 0);
+    }
+    return NULL;
+}
+
+/* Returns the index of the field with the given name, or FIELDLOOKUPFAILURE. */
+int fieldIndexOf(char *name);
+
+int fieldIndexOf(char *name){
+    for(int i = 0; i < NUM_FIELDS; i++){
+        if(strcmp(name, fieldNames[i]) == 0){
+            return i;
+        }
+    }
+    return FIELDLOOKUPFAILURE;
+}
+
+/* Returns the category id of a value in the table, adding it if asked to and 
+there is room. Returns NOCATEGORY if the value is absent and not added. */
+int categoryId(struct categoryTable *table, char *value, int add);
+
+int categoryId(struct categoryTable *table, char *value, int add){
+    for(int i = 0; i < table->numValues; i++){
+        if(strcmp(table->values[i], value) == 0){
+            return i;
+        }
+    }
+    if(table->numValues < AGG_CATEGORY_OVERFLOW){
+        if(! add){
+            return NOCATEGORY;
+        }
+        table->values[table->numValues] = trackedStrdup(ALLOC_DICT, value);
+        assert(table->values[table->numValues]);
+        return table->numValues++;
+    }
+
+    // Values past the table share the overflow id and must be compared as text
+    return AGG_CATEGORY_OVERFLOW;
+}
+
 /* Prints a given value. */
 void printIntField(FILE *f, int value);
 
@@ -334,11 +582,29 @@ void printField(FILE *f, struct data *record, int fieldIndex){
 // Initialises a new dictionary to store all the structs of records
 struct dictionary *newDict(){
     struct dictionary *ret = (struct dictionary *) 
-        malloc(sizeof(struct dictionary));
+        trackedMalloc(ALLOC_DICT, sizeof(struct dictionary));
     assert(ret);
     ret->head = NULL;
     ret->tail = NULL;
     ret->indices = NULL;
+    ret->categories = (struct categoryTable *) 
+        trackedCalloc(ALLOC_DICT, NUM_FIELDS, sizeof(struct categoryTable));
+    assert(ret->categories);
+    ret->isPart = 0;
+    for(int i = 0; i < NUM_FIELDS; i++){
+        ret->categorised[i] = 0;
+    }
+    ret->lazy = 0;
+    ret->numRecords = 0;
+    ret->byRank = NULL;
+    ret->numRanked = 0;
+    ret->cache = NULL;
+    ret->maxResults = 0;
+    ret->maxNodes = 0;
+    ret->deadlineNs = 0;
+    ret->cursors = NULL;
+    ret->numCursors = 0;
+    ret->lastCursorId = 0;
     return ret;
 }
 
@@ -346,38 +612,133 @@ struct dictionary *newDict(){
 struct data *readRecord(struct csvRecord *record);
 
 struct data *readRecord(struct csvRecord *record){
-    struct data *ret = (struct data *) malloc(sizeof(struct data));
+    struct data *ret = (struct data *) trackedMalloc(ALLOC_DICT, sizeof(struct data));
     assert(ret);
     assert(record->fieldCount == NUM_FIELDS);
     for(int i = 0; i < NUM_FIELDS; i++){
         setField(ret, i, record->fields[i]);
         
     }
+    ret->raw = NULL;
     return ret;
 };
 
+/* Read the key and coordinates of a record split in place, taking its line as the 
+text of every field to be parsed when first accessed. */
+struct data *readRecordLazily(struct csvRecord *record);
+
+struct data *readRecordLazily(struct csvRecord *record){
+    struct data *ret = (struct data *) trackedCalloc(ALLOC_DICT, 1, sizeof(struct data));
+    assert(ret);
+    assert(record->fieldCount == NUM_FIELDS);
+    assert(record->inPlace && record->line);
+
+    for(int i = 0; i < NUM_FIELDS; i++){
+        if(isEagerField(i)){
+            setField(ret, i, record->fields[i]);
+        }
+    }
+    ret->raw = record->line;
+    record->line = NULL;
+    return ret;
+}
+
+void setLazyRecords(struct dictionary *dict, int lazy){
+    dict->lazy = lazy;
+}
+
+void setQueryCache(struct dictionary *dict, queryCache *cache){
+    dict->cache = cache;
+}
+
+void setQueryBudget(struct dictionary *dict, size_t maxResults, size_t maxNodes, 
+    unsigned long long deadlineMs){
+    dict->maxResults = maxResults;
+    dict->maxNodes = maxNodes;
+    dict->deadlineNs = deadlineMs * 1000000ULL;
+}
+
+int hasQueryBudget(struct dictionary *dict){
+    return dict->maxResults || dict->maxNodes || dict->deadlineNs;
+}
+
+struct dictionary *newPartDict(struct dictionary *dict){
+    struct dictionary *part = newDict();
+    trackedFree(ALLOC_DICT, part->categories);
+    part->categories = dict->categories;
+    part->isPart = 1;
+    for(int i = 0; i < NUM_FIELDS; i++){
+        part->categorised[i] = dict->categorised[i];
+    }
+    part->lazy = dict->lazy;
+    return part;
+}
+
+void appendDict(struct dictionary *dict, struct dictionary *part){
+    assert(part->isPart && part->categories == dict->categories);
+    if(part->head){
+        if(dict->head){
+            dict->tail->next = part->head;
+        } else {
+            dict->head = part->head;
+        }
+        dict->tail = part->tail;
+    }
+    dict->numRecords += part->numRecords;
+    trackedFree(ALLOC_DICT, part);
+}
+
+/* Recovers a point of the record for indexes which do not keep points. */
+void recordPoint(struct data *record, int end, long double *x, long double *y){
+    *x = end ? record->end_lon : record->start_lon;
+    *y = end ? record->end_lat : record->start_lat;
+}
+
 // Inserts a struct representing a record into the dictionary and adds the coordinate points into the quadtree
-void insertRecord(struct dictionary *dict, struct csvRecord *record, QuadTree *qt){
+void insertRecord(struct dictionary *dict, struct csvRecord *record, spatialIndex *index){
     if(! dict){
         return;
     }
     struct dictionaryNode *newNode = (struct dictionaryNode *) 
-        malloc(sizeof(struct dictionaryNode));
+        trackedMalloc(ALLOC_DICT, sizeof(struct dictionaryNode));
     assert(newNode);
-    newNode->record = readRecord(record);
+    newNode->record = dict->lazy ? readRecordLazily(record) : readRecord(record);
+
+    // String fields kept in node summaries are numbered so filters can compare ids
+    for(int i = 0; i < NUM_FIELDS; i++){
+        if(dict->categorised[i]){
+            pthread_mutex_lock(&categoryLock);
+            newNode->record->category[i] = categoryId(&dict->categories[i], 
+                record->fields[i], 1);
+            pthread_mutex_unlock(&categoryLock);
+        }
+    }
     
     // Create a new point with the start latitude and longitude of the record as coordinates
     point2D *start_p = create_point(newNode->record->start_lon, newNode->record->start_lat);
+    start_p->record = newNode->record;
 
     // Insert the point into existing quadtree
-    addPoint(qt,start_p);
+    int startAdded = indexAddPoint(index, start_p);
 
     // Create another point with the end latitude and longitude of the record as coordinates
     point2D *end_p = create_point(newNode->record->end_lon, newNode->record->end_lat);
+    end_p->record = newNode->record;
+    end_p->end = 1;
 
     // Insert the point into existing quadtree
-    addPoint(qt,end_p);
+    int endAdded = indexAddPoint(index, end_p);
+
+    // The index owns the points it keeps; points outside the root rectangle, and points of 
+    // indexes which recover them from the record itself, are freed here
+    if(! startAdded || ! indexKeepsPoints(index)){
+        freePoint(start_p);
+    }
+    if(! endAdded || ! indexKeepsPoints(index)){
+        freePoint(end_p);
+    }
     newNode->next = NULL;
+    dict->numRecords++;
 
     if(! (dict->head)){
         /* First insertion, insert new node as head and tail. */
@@ -390,6 +751,332 @@ void insertRecord(struct dictionary *dict, struct csvRecord *record, QuadTree *q
     }
 }
 
+/* Removes leading and trailing spaces from a string in place. */
+char *trimSpaces(char *str);
+
+char *trimSpaces(char *str){
+    while(*str == ' '){
+        str++;
+    }
+    size_t len = strlen(str);
+    while(len > 0 && str[len - 1] == ' '){
+        str[--len] = '\0';
+    }
+    return str;
+}
+
+/* Parses one "field op value" clause into the condition, returning 0 if it is 
+not a valid comparison. Text is compared only for equality. */
+int parseCondition(struct dictionary *dict, char *clause, struct filterCondition *c);
+
+int parseCondition(struct dictionary *dict, char *clause, struct filterCondition *c){
+    char *opStart = strpbrk(clause, "!<>=");
+    if(! opStart){
+        return 0;
+    }
+    c->op = NUM_FILTER_OPS;
+    for(int i = 0; i < NUM_FILTER_OPS; i++){
+        if(strncmp(opStart, filterOpNames[i], strlen(filterOpNames[i])) == 0){
+            c->op = i;
+            break;
+        }
+    }
+    if(c->op == NUM_FILTER_OPS){
+        return 0;
+    }
+    char *valueText = opStart + strlen(filterOpNames[c->op]);
+    *opStart = '\0';
+
+    c->field = fieldIndexOf(trimSpaces(clause));
+    if(c->field == FIELDLOOKUPFAILURE){
+        return 0;
+    }
+    c->text = trackedStrdup(ALLOC_QUERY, trimSpaces(valueText));
+    assert(c->text);
+    c->value = 0;
+    c->category = NOCATEGORY;
+
+    // Values of fields which are not numbered are compared as text, like overflow ids
+    if(! isNumericField(c->field)){
+        c->category = AGG_CATEGORY_OVERFLOW;
+        if(dict->categorised[c->field]){
+            c->category = categoryId(&dict->categories[c->field], c->text, 0);
+        }
+        return c->op == FILTER_EQ || c->op == FILTER_NE;
+    }
+
+    char *end;
+    c->value = parseDouble(c->text, &end);
+    return end != c->text && *end == '\0';
+}
+
+/* Parses "&"-separated conditions into a filter. A filter which cannot be parsed
+is reported and matches no records. */
+struct recordFilter *parseFilter(struct dictionary *dict, char *where);
+
+struct recordFilter *parseFilter(struct dictionary *dict, char *where){
+    struct recordFilter *filter = (struct recordFilter *) 
+        trackedMalloc(ALLOC_QUERY, sizeof(struct recordFilter));
+    assert(filter);
+    filter->numConditions = 0;
+    filter->valid = 1;
+
+    char *copy = trackedStrdup(ALLOC_QUERY, where);
+    assert(copy);
+    char *savePtr = NULL;
+    for(char *clause = strtok_r(copy, FILTER_CLAUSE_SEPARATOR, &savePtr); clause; 
+        clause = strtok_r(NULL, FILTER_CLAUSE_SEPARATOR, &savePtr)){
+
+        if(filter->numConditions >= MAX_FILTER_CONDITIONS){
+            filter->valid = 0;
+            break;
+        }
+        struct filterCondition *c = &filter->conditions[filter->numConditions];
+        c->text = NULL;
+        int parsed = parseCondition(dict, clause, c);
+        if(c->text){
+            filter->numConditions++;
+        }
+        if(! parsed){
+            filter->valid = 0;
+            break;
+        }
+    }
+    if(! filter->valid){
+        fprintf(stderr, "Invalid filter %s\n", where);
+    }
+    trackedFree(ALLOC_QUERY, copy);
+    return filter;
+}
+
+/* Returns 1 if the record meets every condition of the filter. */
+int recordMatches(struct data *record, struct recordFilter *filter);
+
+int recordMatches(struct data *record, struct recordFilter *filter){
+    if(! filter->valid){
+        return 0;
+    }
+    for(int i = 0; i < filter->numConditions; i++){
+        struct filterCondition *c = &filter->conditions[i];
+
+        if(! isNumericField(c->field)){
+            int equal;
+            if(c->category == NOCATEGORY){
+                equal = 0;
+            } else if(c->category < AGG_CATEGORY_OVERFLOW){
+                equal = record->category[c->field] == c->category;
+            } else {
+                equal = strcmp(getStringVal(record, c->field), c->text) == 0;
+            }
+            if(equal != (c->op == FILTER_EQ)){
+                return 0;
+            }
+            continue;
+        }
+
+        double value = getNumericVal(record, c->field);
+        int met = 0;
+        switch(c->op){
+            case FILTER_EQ:
+                met = value == c->value;
+                break;
+            case FILTER_NE:
+                met = value != c->value;
+                break;
+            case FILTER_LT:
+                met = value < c->value;
+                break;
+            case FILTER_LE:
+                met = value <= c->value;
+                break;
+            case FILTER_GT:
+                met = value > c->value;
+                break;
+            case FILTER_GE:
+                met = value >= c->value;
+                break;
+        }
+        if(! met){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Tests a datapoint's record against the filter given as the argument. */
+int filterPoint(point2D *point, void *arg);
+
+int filterPoint(point2D *point, void *arg){
+    return point->record && recordMatches(point->record, (struct recordFilter *) arg);
+}
+
+/* Returns 0 if the summary shows no point it covers can meet the filter given
+as the argument; conditions on columns not summarised never rule points out. */
+int summaryMayMatch(nodeAggregate *summary, aggregateSpec *spec, void *arg);
+
+int summaryMayMatch(nodeAggregate *summary, aggregateSpec *spec, void *arg){
+    struct recordFilter *filter = (struct recordFilter *) arg;
+    if(! filter->valid || summary->count == 0){
+        return 0;
+    }
+    for(int i = 0; i < filter->numConditions; i++){
+        struct filterCondition *c = &filter->conditions[i];
+        int col = 0;
+        while(col < spec->numColumns && spec->columns[col] != c->field){
+            col++;
+        }
+        if(col == spec->numColumns){
+            continue;
+        }
+
+        double min = summary->min[col];
+        double max = summary->max[col];
+        if(! isNumericField(c->field)){
+            uint64_t present = summary->present[col];
+            uint64_t bit = c->category == NOCATEGORY ? 0 : aggregateCategoryBit(c->category);
+            if(c->op == FILTER_EQ && ! (present & bit)){
+                return 0;
+            }
+
+            // Overflow ids stand for many values, so only an exact id rules a node out
+            if(c->op == FILTER_NE && c->category < AGG_CATEGORY_OVERFLOW && present == bit){
+                return 0;
+            }
+            continue;
+        }
+
+        if((c->op == FILTER_EQ && (c->value < min || c->value > max)) ||
+            (c->op == FILTER_NE && min == c->value && max == c->value) ||
+            (c->op == FILTER_LT && min >= c->value) ||
+            (c->op == FILTER_LE && min > c->value) ||
+            (c->op == FILTER_GT && max <= c->value) ||
+            (c->op == FILTER_GE && max < c->value)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Frees a filter and the text of its conditions. */
+void freeFilter(struct recordFilter *filter);
+
+void freeFilter(struct recordFilter *filter){
+    if(! filter){
+        return;
+    }
+    for(int i = 0; i < filter->numConditions; i++){
+        trackedFree(ALLOC_QUERY, filter->conditions[i].text);
+    }
+    trackedFree(ALLOC_QUERY, filter);
+}
+
+/* Splits the filter off the end of a query line, setting the result's copy of its
+text and parsed form (or NULL if the query has none). */
+void splitFilter(struct dictionary *dict, char *query, struct queryResult *qr);
+
+void splitFilter(struct dictionary *dict, char *query, struct queryResult *qr){
+    qr->where = NULL;
+    qr->filter = NULL;
+
+    char *separator = strchr(query, FILTER_SEPARATOR);
+    if(! separator){
+        return;
+    }
+    *separator = '\0';
+    qr->where = trackedStrdup(ALLOC_QUERY, trimSpaces(separator + 1));
+    assert(qr->where);
+    qr->filter = parseFilter(dict, qr->where);
+}
+
+/* Reads a summarised field of a datapoint's record: numbers as they are and text
+as its category id. Every point is counted, so both ends of a footpath are. */
+int recordSummaryValues(point2D *point, aggregateSpec *spec, double *values);
+
+int recordSummaryValues(point2D *point, aggregateSpec *spec, double *values){
+    struct data *record = point->record;
+    if(! record){
+        return 0;
+    }
+    for(int i = 0; i < spec->numColumns; i++){
+        int field = spec->columns[i];
+        values[i] = isNumericField(field) ? getNumericVal(record, field) : record->category[field];
+    }
+    return 1;
+}
+
+int parseSummaryColumns(struct dictionary *dict, char *list, aggregateSpec *spec){
+    spec->numColumns = 0;
+    spec->pointValues = recordSummaryValues;
+
+    char *copy = trackedStrdup(ALLOC_DICT, list);
+    assert(copy);
+    for(char *name = strtok(copy, ","); name; name = strtok(NULL, ",")){
+        int field = fieldIndexOf(name);
+        if(field == FIELDLOOKUPFAILURE || spec->numColumns >= AGG_MAX_COLUMNS){
+            fprintf(stderr, "Cannot index field %s\n", name);
+            trackedFree(ALLOC_DICT, copy);
+            return 0;
+        }
+        spec->columns[spec->numColumns++] = field;
+        if(! isNumericField(field)){
+            dict->categorised[field] = 1;
+        }
+    }
+    trackedFree(ALLOC_DICT, copy);
+    return 1;
+}
+
+/* Prints the filter of a query after its coordinates, if it has one. */
+void printWhere(FILE *f, struct queryResult *r);
+
+void printWhere(FILE *f, struct queryResult *r){
+    if(r->where){
+        fprintf(f, " | %s", r->where);
+    }
+}
+
+/* 
+Returns a copy of the cache key written by the format, or NULL if results cannot be cached:
+when there is no cache, or records were inserted since ranking, as results are cached by rank.
+*/
+char *cacheKeyOf(struct dictionary *dict, char *format, ...);
+
+char *cacheKeyOf(struct dictionary *dict, char *format, ...){
+    if(! dict->cache || dict->numRanked != dict->numRecords){
+        return NULL;
+    }
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    assert(len >= 0);
+
+    char *key = (char *) trackedMalloc(ALLOC_QUERY, len + 1);
+    assert(key);
+    va_start(args, format);
+    vsnprintf(key, len + 1, format, args);
+    va_end(args);
+    return key;
+}
+
+/* 
+Returns the cache key of a query: its stage, parsed coordinates and filter, so queries 
+writing the same numbers differently share an entry.
+*/
+char *queryCacheKey(struct queryResult *r, int stage);
+
+char *queryCacheKey(struct queryResult *r, int stage){
+    return cacheKeyOf(r->dict, "%d %La %La %La %La|%s", stage, r->x_val, r->y_val, 
+        r->x_max, r->y_max, r->where ? r->where : "");
+}
+
+/* Returns the cache key of a tile of a tile query, which shares the query's filter. */
+char *tileCacheKey(struct queryResult *r, int zoom, uint32_t x, uint32_t y);
+
+char *tileCacheKey(struct queryResult *r, int zoom, uint32_t x, uint32_t y){
+    return cacheKeyOf(r->dict, "T %d %u %u|%s", zoom, x, y, r->where ? r->where : "");
+}
+
 /* Search for a given key in the dictionary. */
 struct queryResult *lookupRecord(struct dictionary *dict, char *query){
     int numRecords = 0, ctr=0;
@@ -398,34 +1085,60 @@ struct queryResult *lookupRecord(struct dictionary *dict, char *query){
     char* lon="";
     long double search_lat, search_lon;
 
+    struct queryResult *qr = (struct queryResult *) 
+        trackedMalloc(ALLOC_QUERY, sizeof(struct queryResult));
+    assert(qr);
+    splitFilter(dict, query, qr);
+
     // Extract the coordinates of the point to be searched from the query
-    char* token = strtok(query, " ");
+    char *savePtr = NULL;
+    char* token = strtok_r(query, " ", &savePtr);
     while( token != NULL ) {
       ctr++;
 
       if (ctr==1) {
-         lon=strdup(token);
+         lon=trackedStrdup(ALLOC_QUERY, token);
 
       } else if (ctr==2) {
-         lat=strdup(token);
+         lat=trackedStrdup(ALLOC_QUERY, token);
 
       }
-      token = strtok(NULL, " ");
+      token = strtok_r(NULL, " ", &savePtr);
 
    }
 
     // Convert the coordinates from string to long double format
-    search_lat = strtod(lat, NULL);
-    search_lon = strtod(lon, NULL);
+    search_lat = parseDouble(lat, NULL);
+    search_lon = parseDouble(lon, NULL);
+
+    qr->x_val = search_lon;
+    qr->y_val = search_lat;
+    qr->x_max = search_lon;
+    qr->y_max = search_lat;
+    qr->dict = dict;
+
+    // A cached result names its records by rank, saving the scan below
+    qr->cacheKey = queryCacheKey(qr, REGIONQUERY);
+    qr->cached = qr->cacheKey && cacheGet(dict->cache, qr->cacheKey, &qr->hit);
+    if(qr->cached){
+        numRecords = qr->hit.numIds;
+        records = (struct data **) trackedMalloc(ALLOC_QUERY, 
+            sizeof(struct data *) * (numRecords + 1));
+        assert(records);
+        for(int i = 0; i < numRecords; i++){
+            records[i] = dict->byRank[qr->hit.ids[i]];
+        }
+    }
 
     /* Iterate over all records and collect all matching records. */
-    struct dictionaryNode *current = dict->head;
+    struct dictionaryNode *current = qr->cached ? NULL : dict->head;
     while(current){
         if(((current->record->start_lat == search_lat) || (current->record->end_lat == search_lat)) && 
-        ((current->record->start_lon ==  search_lon) || (current->record->end_lon == search_lon))){
+        ((current->record->start_lon ==  search_lon) || (current->record->end_lon == search_lon)) &&
+        (! qr->filter || recordMatches(current->record, qr->filter))){
 
             /* Match. */
-            records = (struct data **) realloc(records, 
+            records = (struct data **) trackedRealloc(ALLOC_QUERY, records, 
                 sizeof(struct data *) * (numRecords + 1));
             assert(records);
             records[numRecords] = current->record;
@@ -434,65 +1147,893 @@ struct queryResult *lookupRecord(struct dictionary *dict, char *query){
         current = current->next;
     }
 
-    struct queryResult *qr = (struct queryResult *) 
-        malloc(sizeof(struct queryResult));
-    assert(qr);
-
     qr->lon = lon;
     assert(qr->lon);
     qr->lat = lat;
     assert(qr->lat);
     qr->numRecords = numRecords;
     qr->records = records;
-    qr->x_val = search_lon;
-    qr->y_val = search_lat;
+    qr->lonMax = NULL;
+    qr->latMax = NULL;
+
+    return qr;
+}
+
+/* Orders records by footpath_id, keeping copies of the same record adjacent. */
+int compareFootpathId(const void *a, const void *b);
+
+int compareFootpathId(const void *a, const void *b){
+    struct data *ra = *(struct data **) a;
+    struct data *rb = *(struct data **) b;
+    if(ra->footpath_id != rb->footpath_id){
+        return (ra->footpath_id > rb->footpath_id) - (ra->footpath_id < rb->footpath_id);
+    }
+    return (ra > rb) - (ra < rb);
+}
+
+/* Ranks every record by footpath_id, once after loading, so range results can be 
+ordered by marking ranks instead of sorting. */
+void rankRecords(struct dictionary *dict){
+    trackedFree(ALLOC_DICT, dict->byRank);
+
+    dict->byRank = (struct data **) trackedMalloc(ALLOC_DICT, 
+        sizeof(struct data *) * (dict->numRecords + 1));
+    assert(dict->byRank);
+    int i = 0;
+    for(struct dictionaryNode *current = dict->head; current; current = current->next){
+        dict->byRank[i++] = current->record;
+    }
+    qsort(dict->byRank, dict->numRecords, sizeof(struct data *), compareFootpathId);
+    for(i = 0; i < dict->numRecords; i++){
+        dict->byRank[i]->rank = i;
+    }
+    dict->numRanked = dict->numRecords;
+}
+
+/* Frees a thread's rank marks as it exits. */
+void freeRankMarks(void *marks);
+
+void freeRankMarks(void *marks){
+    trackedFree(ALLOC_QUERY, marks);
+}
+
+/* Creates the key of each thread's rank marks, which are freed as the thread exits. */
+void createRankMarksKey();
+
+void createRankMarksKey(){
+    int created = pthread_key_create(&rankMarksKey, freeRankMarks);
+    assert(created == 0);
+}
+
+/* Returns the calling thread's rank marks, grown to cover every ranked record. */
+struct rankMarks *threadRankMarks(struct dictionary *dict);
+
+struct rankMarks *threadRankMarks(struct dictionary *dict){
+    pthread_once(&rankMarksOnce, createRankMarksKey);
+
+    size_t numWords = dict->numRanked / BITS_PER_WORD + 1;
+    struct rankMarks *marks = (struct rankMarks *) pthread_getspecific(rankMarksKey);
+    if(! marks || marks->numWords < numWords){
+        trackedFree(ALLOC_QUERY, marks);
+        marks = (struct rankMarks *) trackedCalloc(ALLOC_QUERY, 1, sizeof(struct rankMarks) + 
+            sizeof(uint64_t) * numWords);
+        assert(marks);
+        marks->numWords = numWords;
+        pthread_setspecific(rankMarksKey, marks);
+    }
+    return marks;
+}
+
+/* Parse a range query given by its bottom-left and top-right coordinates. */
+struct queryResult *lookupRange(struct dictionary *dict, char *query){
+    char *coords[4] = {NULL, NULL, NULL, NULL};
+    int ctr = 0;
+
+    struct queryResult *qr = (struct queryResult *) 
+        trackedMalloc(ALLOC_QUERY, sizeof(struct queryResult));
+    assert(qr);
+    splitFilter(dict, query, qr);
+
+    // Extract the four corner coordinates of the query rectangle
+    char *savePtr = NULL;
+    char *token = strtok_r(query, " ", &savePtr);
+    while(token != NULL && ctr < 4){
+        coords[ctr++] = trackedStrdup(ALLOC_QUERY, token);
+        token = strtok_r(NULL, " ", &savePtr);
+    }
+    for(int i = ctr; i < 4; i++){
+        coords[i] = trackedStrdup(ALLOC_QUERY, "");
+    }
+
+    // Records are found through the quadtree when the result is printed
+    qr->lon = coords[0];
+    qr->lat = coords[1];
+    qr->lonMax = coords[2];
+    qr->latMax = coords[3];
+    qr->numRecords = 0;
+    qr->records = NULL;
+    qr->x_val = strtold(qr->lon, NULL);
+    qr->y_val = strtold(qr->lat, NULL);
+    qr->x_max = strtold(qr->lonMax, NULL);
+    qr->y_max = strtold(qr->latMax, NULL);
+
+    // Records inserted since the last range query are ranked before it runs
+    if(dict->numRanked != dict->numRecords){
+        rankRecords(dict);
+    }
+    qr->dict = dict;
+
+    // Only full range results are cached, so the cache is consulted when they are printed
+    qr->cacheKey = NULL;
+    qr->cached = 0;
+
+    return qr;
+}
+
+/* Parse a tile query given as zoom/x/y. */
+struct queryResult *lookupTile(struct dictionary *dict, char *query){
+    struct queryResult *qr = (struct queryResult *) 
+        trackedMalloc(ALLOC_QUERY, sizeof(struct queryResult));
+    assert(qr);
+    splitFilter(dict, query, qr);
+
+    char *savePtr = NULL;
+    char *token = strtok_r(query, " ", &savePtr);
+    qr->lon = trackedStrdup(ALLOC_QUERY, token ? token : "");
+    assert(qr->lon);
+
+    // Anything but three numbers leaves no tile to look in
+    int zoom;
+    unsigned int x, y;
+    char trailing;
+    qr->zoom = -1;
+    if(sscanf(qr->lon, "%d/%u/%u%c", &zoom, &x, &y, &trailing) == 3){
+        qr->zoom = zoom;
+        qr->tileX = x;
+        qr->tileY = y;
+    }
+
+    // Records are found through the index when the result is printed
+    qr->lat = NULL;
+    qr->lonMax = NULL;
+    qr->latMax = NULL;
+    qr->numRecords = 0;
+    qr->records = NULL;
+    qr->x_val = 0;
+    qr->y_val = 0;
+    qr->x_max = 0;
+    qr->y_max = 0;
+    if(dict->numRanked != dict->numRecords){
+        rankRecords(dict);
+    }
+    qr->dict = dict;
+    qr->cacheKey = NULL;
+    qr->cached = 0;
 
     return qr;
 }
 
+/* Prints a record's fields on one line of the output file. */
+void printRecord(FILE *outputFile, struct data *record);
+
+void printRecord(FILE *outputFile, struct data *record){
+    materialiseRecord(record);
+    fprintf(outputFile, "--> ");
+    for(int j = 0; j < NUM_FIELDS; j++){
+        fprintf(outputFile, "%s: ", fieldNames[j]);
+        printField(outputFile, record, j);
+        fprintf(outputFile, " || ");
+    }
+    fprintf(outputFile, "\n");
+}
+
+/* Builds the query rectangle of a range query result. */
+rectangle2D *rangeRectangle(struct queryResult *r);
+
+rectangle2D *rangeRectangle(struct queryResult *r){
+    point2D *center_r = create_point((r->x_val + r->x_max) / 2, (r->y_val + r->y_max) / 2);
+    return create_rectangle(center_r, (r->x_max - r->x_val) / 2, (r->y_max - r->y_val) / 2);
+}
+
+/* Output only the number of datapoints (footpath ends) within a range query. */
+void printRangeCount(struct queryResult *r, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index){
+
+    rectangle2D *boundary_r = rangeRectangle(r);
+    size_t count = 0;
+    if(r->filter){
+        // Filtered points must be looked at, so they are collected and counted
+        pointFilter filter = {filterPoint, summaryMayMatch, r->filter};
+        point2D **res = indexRangeQueryFiltered(index, boundary_r, &filter, NULL);
+        while(res[count] != NULL){
+            count++;
+        }
+        trackedFree(ALLOC_QUERY, res);
+    } else {
+        count = indexRangeCount(index, boundary_r);
+    }
+
+    fprintf(outputFile, "%s %s %s %s", r->lon, r->lat, r->lonMax, r->latMax);
+    printWhere(outputFile, r);
+    fprintf(outputFile, "\n--> points: %zu\n", count);
+    fprintf(summaryFile, "%s %s %s %s", r->lon, r->lat, r->lonMax, r->latMax);
+    printWhere(summaryFile, r);
+    fprintf(summaryFile, " --> %zu\n", count);
+
+    freeRectangle(boundary_r);
+}
+
+/* Reads the aggregated fields of a footpath at its start point; end points are not
+counted, so each footpath is summarised once, even when both lie at one place. */
+int recordValues(point2D *point, aggregateSpec *spec, double *values);
+
+int recordValues(point2D *point, aggregateSpec *spec, double *values){
+    struct data *record = point->record;
+    if(! record || point->end){
+        return 0;
+    }
+    for(int i = 0; i < spec->numColumns; i++){
+        values[i] = getNumericVal(record, spec->columns[i]);
+    }
+    return 1;
+}
+
+int parseAggregateColumns(char *list, aggregateSpec *spec){
+    spec->numColumns = 0;
+    spec->pointValues = recordValues;
+
+    char *copy = trackedStrdup(ALLOC_DICT, list);
+    assert(copy);
+    for(char *name = strtok(copy, ","); name; name = strtok(NULL, ",")){
+        int field = fieldIndexOf(name);
+        if(! isNumericField(field) || spec->numColumns >= AGG_MAX_COLUMNS){
+            fprintf(stderr, "Cannot aggregate field %s\n", name);
+            trackedFree(ALLOC_DICT, copy);
+            return 0;
+        }
+        spec->columns[spec->numColumns++] = field;
+    }
+    trackedFree(ALLOC_DICT, copy);
+    return 1;
+}
+
+void printRangeAggregate(struct queryResult *r, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index){
+
+    rectangle2D *boundary_r = rangeRectangle(r);
+    nodeAggregate agg;
+    if(r->filter && index->aggSpec){
+        // Node summaries cover every record, so filtered points are summarised one by one
+        aggregateInit(&agg);
+        pointFilter filter = {filterPoint, summaryMayMatch, r->filter};
+        point2D **res = indexRangeQueryFiltered(index, boundary_r, &filter, NULL);
+        for(size_t i = 0; res[i] != NULL; i++){
+            aggregateAddPoint(&agg, index->aggSpec, res[i]);
+        }
+        trackedFree(ALLOC_QUERY, res);
+    } else {
+        indexRangeAggregate(index, boundary_r, &agg);
+    }
+
+    fprintf(outputFile, "%s %s %s %s", r->lon, r->lat, r->lonMax, r->latMax);
+    printWhere(outputFile, r);
+    fprintf(outputFile, "\n--> count: %zu || ", agg.count);
+    for(int i = 0; index->aggSpec && i < index->aggSpec->numColumns; i++){
+        int field = index->aggSpec->columns[i];
+        int precision = fieldPrecision[field] == NOTDOUBLE ? 0 : fieldPrecision[field];
+        fprintf(outputFile, "sum_%s: ", fieldNames[field]);
+        printDoubleField(outputFile, agg.sum[i], precision);
+        fprintf(outputFile, " || ");
+
+        // Minimum and maximum are undefined over no footpaths
+        if(agg.count > 0){
+            fprintf(outputFile, "min_%s: ", fieldNames[field]);
+            printDoubleField(outputFile, agg.min[i], precision);
+            fprintf(outputFile, " || max_%s: ", fieldNames[field]);
+            printDoubleField(outputFile, agg.max[i], precision);
+            fprintf(outputFile, " || ");
+        }
+    }
+    fprintf(outputFile, "\n");
+    fprintf(summaryFile, "%s %s %s %s", r->lon, r->lat, r->lonMax, r->latMax);
+    printWhere(summaryFile, r);
+    fprintf(summaryFile, " --> %zu\n", agg.count);
+
+    freeRectangle(boundary_r);
+}
+
+/* 
+Returns the ranks of the records the datapoints belong to in increasing order, each once, 
+setting numIds to how many there are. Ranks are marked in the calling thread's bitmap and 
+read back in order, so no sort is needed.
+*/
+int *rankOrder(struct dictionary *dict, point2D **res, size_t *numIds);
+
+int *rankOrder(struct dictionary *dict, point2D **res, size_t *numIds){
+    uint64_t *found = threadRankMarks(dict)->words;
+    size_t lowWord = SIZE_MAX;
+    size_t highWord = 0;
+    size_t numPoints = 0;
+    for(size_t i = 0; res[i] != NULL; i++, numPoints++){
+        if(! res[i]->record){
+            continue;
+        }
+        size_t word = res[i]->record->rank / BITS_PER_WORD;
+        found[word] |= 1ULL << (res[i]->record->rank % BITS_PER_WORD);
+        if(word < lowWord){
+            lowWord = word;
+        }
+        if(word > highWord){
+            highWord = word;
+        }
+    }
+
+    // Reading the marks clears them for the next query
+    int *ids = (int *) trackedMalloc(ALLOC_QUERY, sizeof(int) * (numPoints + 1));
+    assert(ids);
+    *numIds = 0;
+    for(size_t word = lowWord; lowWord != SIZE_MAX && word <= highWord; word++){
+        uint64_t bits = found[word];
+        found[word] = 0;
+        while(bits){
+            ids[(*numIds)++] = word * BITS_PER_WORD + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+    return ids;
+}
+
+/* Output the query rectangle of a range query to both files. */
+void printRangeHeading(struct queryResult *r, FILE *summaryFile, FILE *outputFile);
+
+void printRangeHeading(struct queryResult *r, FILE *summaryFile, FILE *outputFile){
+    fprintf(outputFile, "%s %s %s %s", r->lon, r->lat, r->lonMax, r->latMax);
+    printWhere(outputFile, r);
+    fprintf(outputFile, "\n");
+    fprintf(summaryFile, "%s %s %s %s", r->lon, r->lat, r->lonMax, r->latMax);
+    printWhere(summaryFile, r);
+    fprintf(summaryFile, " -->");
+}
+
+/* Output the quadrants a range query explored and its records, given by rank. */
+void printRangeFound(struct queryResult *r, FILE *summaryFile, FILE *outputFile, 
+    int *ids, size_t numIds, char *path, size_t pathLen);
+
+void printRangeFound(struct queryResult *r, FILE *summaryFile, FILE *outputFile, 
+    int *ids, size_t numIds, char *path, size_t pathLen){
+
+    fwrite(path, 1, pathLen, summaryFile);
+    fprintf(summaryFile, "\n");
+    for(size_t i = 0; i < numIds; i++){
+        printRecord(outputFile, r->dict->byRank[ids[i]]);
+    }
+}
+
+/* Output the records of a range query, sorted by footpath_id with duplicates removed. */
+void printRangeResult(struct queryResult *r, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index);
+
+void printRangeResult(struct queryResult *r, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index){
+
+    printRangeHeading(r, summaryFile, outputFile);
+
+    // A cached result replays the quadrants explored and lists its records by rank
+    r->cacheKey = queryCacheKey(r, RANGEQUERY);
+    if(r->cacheKey && cacheGet(r->dict->cache, r->cacheKey, &r->hit)){
+        r->cached = 1;
+        printRangeFound(r, summaryFile, outputFile, r->hit.ids, r->hit.numIds, r->hit.path, 
+            r->hit.pathLen);
+        return;
+    }
+
+    // Convert the query corners into a rectangle around its center
+    rectangle2D *boundary_r = rangeRectangle(r);
+
+    /* Search for all points within the query passing its filter, printing the 
+    quadrants explored; quadrants whose summaries rule the filter out are skipped.
+    They are captured as they are printed when the result is to be cached. */
+    char *path = NULL;
+    size_t pathLen = 0;
+    FILE *pathFile = r->cacheKey ? open_memstream(&path, &pathLen) : summaryFile;
+    assert(pathFile);
+    pointFilter filter = {filterPoint, summaryMayMatch, r->filter};
+    point2D **res = indexRangeQueryFiltered(index, boundary_r, r->filter ? &filter : NULL, 
+        pathFile);
+    if(r->cacheKey){
+        fclose(pathFile);
+        trackedAdopt(ALLOC_QUERY, path);
+        fwrite(path, 1, pathLen, summaryFile);
+    }
+    fprintf(summaryFile, "\n");
+
+    // Records are printed by footpath_id, each once though both its ends may be found
+    size_t numIds;
+    int *ids = rankOrder(r->dict, res, &numIds);
+    for(size_t i = 0; i < numIds; i++){
+        printRecord(outputFile, r->dict->byRank[ids[i]]);
+    }
+
+    if(r->cacheKey){
+        cachePut(r->dict->cache, r->cacheKey, ids, numIds, path, pathLen);
+        trackedFree(ALLOC_QUERY, path);
+    }
+    trackedFree(ALLOC_QUERY, ids);
+    trackedFree(ALLOC_QUERY, res);
+    freeRectangle(boundary_r);
+}
+
+/* The ranks of the records found by each query of a batch. */
+struct rangeBatchFound {
+    struct dictionary *dict;
+    int **ids;
+    size_t *numIds;
+};
+
+/* Keeps the ranks of the records found by a query of a batch, freeing its result. */
+void rangeBatchResult(size_t i, point2D **result, void *arg);
+
+void rangeBatchResult(size_t i, point2D **result, void *arg){
+    struct rangeBatchFound *found = (struct rangeBatchFound *) arg;
+    found->ids[i] = rankOrder(found->dict, result, &found->numIds[i]);
+    trackedFree(ALLOC_QUERY, result);
+}
+
+/* Output the records of a batch of range queries in the order given, searching the index 
+once for all the queries not already cached. */
+void printRangeBatch(struct queryResult **rs, size_t numQueries, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index){
+
+    batchQuery *queries = (batchQuery *) trackedMalloc(ALLOC_QUERY, 
+        sizeof(batchQuery) * (numQueries + 1));
+    pointFilter *filters = (pointFilter *) trackedMalloc(ALLOC_QUERY, 
+        sizeof(pointFilter) * (numQueries + 1));
+    char **paths = (char **) trackedMalloc(ALLOC_QUERY, sizeof(char *) * (numQueries + 1));
+    size_t *pathLens = (size_t *) trackedMalloc(ALLOC_QUERY, sizeof(size_t) * (numQueries + 1));
+    size_t *searched = (size_t *) trackedMalloc(ALLOC_QUERY, sizeof(size_t) * (numQueries + 1));
+    struct rangeBatchFound found;
+    found.ids = (int **) trackedMalloc(ALLOC_QUERY, sizeof(int *) * (numQueries + 1));
+    found.numIds = (size_t *) trackedMalloc(ALLOC_QUERY, sizeof(size_t) * (numQueries + 1));
+    assert(queries && filters && paths && pathLens && searched && found.ids && found.numIds);
+
+    // Cached queries are replayed; the rest are searched together, capturing the 
+    // quadrants each explores
+    size_t numSearched = 0;
+    for(size_t i = 0; i < numQueries; i++){
+        struct queryResult *r = rs[i];
+        r->cacheKey = queryCacheKey(r, RANGEQUERY);
+        if(r->cacheKey && cacheGet(r->dict->cache, r->cacheKey, &r->hit)){
+            r->cached = 1;
+            continue;
+        }
+
+        size_t k = numSearched++;
+        searched[i] = k;
+        filters[k] = (pointFilter) {filterPoint, summaryMayMatch, r->filter};
+        queries[k].range = rangeRectangle(r);
+        queries[k].filter = r->filter ? &filters[k] : NULL;
+        queries[k].summaryFile = open_memstream(&paths[k], &pathLens[k]);
+        assert(queries[k].summaryFile);
+        queries[k].result = NULL;
+    }
+    if(numSearched > 0){
+        found.dict = rs[0]->dict;
+        indexRangeQueryBatch(index, queries, numSearched, rangeBatchResult, &found);
+    }
+    for(size_t k = 0; k < numSearched; k++){
+        fclose(queries[k].summaryFile);
+        trackedAdopt(ALLOC_QUERY, paths[k]);
+    }
+
+    for(size_t i = 0; i < numQueries; i++){
+        struct queryResult *r = rs[i];
+        printRangeHeading(r, summaryFile, outputFile);
+        if(r->cached){
+            printRangeFound(r, summaryFile, outputFile, r->hit.ids, r->hit.numIds, 
+                r->hit.path, r->hit.pathLen);
+            continue;
+        }
+
+        size_t k = searched[i];
+        printRangeFound(r, summaryFile, outputFile, found.ids[k], found.numIds[k], 
+            paths[k], pathLens[k]);
+        if(r->cacheKey){
+            cachePut(r->dict->cache, r->cacheKey, found.ids[k], found.numIds[k], paths[k], 
+                pathLens[k]);
+        }
+        trackedFree(ALLOC_QUERY, found.ids[k]);
+        trackedFree(ALLOC_QUERY, paths[k]);
+        freeRectangle(queries[k].range);
+    }
+
+    trackedFree(ALLOC_QUERY, queries);
+    trackedFree(ALLOC_QUERY, filters);
+    trackedFree(ALLOC_QUERY, paths);
+    trackedFree(ALLOC_QUERY, pathLens);
+    trackedFree(ALLOC_QUERY, searched);
+    trackedFree(ALLOC_QUERY, found.ids);
+    trackedFree(ALLOC_QUERY, found.numIds);
+}
+
+/* Removes from the increasing ranks those in found, returning how many remain. */
+size_t dropFound(int *ranks, size_t numRanks, int *found, size_t numFound);
+
+size_t dropFound(int *ranks, size_t numRanks, int *found, size_t numFound){
+    size_t kept = 0;
+    size_t j = 0;
+    for(size_t i = 0; i < numRanks; i++){
+        while(j < numFound && found[j] < ranks[i]){
+            j++;
+        }
+        if(j == numFound || found[j] != ranks[i]){
+            ranks[kept++] = ranks[i];
+        }
+    }
+    return kept;
+}
+
+/* Merges the increasing ranks into the increasing array, which is reallocated to hold them. */
+void mergeRanks(int **into, size_t *numInto, int *ranks, size_t numRanks);
+
+void mergeRanks(int **into, size_t *numInto, int *ranks, size_t numRanks){
+    int *merged = (int *) trackedMalloc(ALLOC_QUERY, sizeof(int) * (*numInto + numRanks + 1));
+    assert(merged);
+    size_t i = 0, j = 0, k = 0;
+    while(i < *numInto || j < numRanks){
+        if(j == numRanks || (i < *numInto && (*into)[i] < ranks[j])){
+            merged[k++] = (*into)[i++];
+        } else {
+            merged[k++] = ranks[j++];
+        }
+    }
+    trackedFree(ALLOC_QUERY, *into);
+    *into = merged;
+    *numInto = k;
+}
+
+/* Frees a cursor and the search it holds. */
+void freeQueryCursor(struct queryCursor *c);
+
+void freeQueryCursor(struct queryCursor *c){
+    freeIndexCursor(c->search);
+    freeFilter(c->filter);
+    trackedFree(ALLOC_QUERY, c->pending);
+    trackedFree(ALLOC_QUERY, c->found);
+    trackedFree(ALLOC_QUERY, c);
+}
+
+/* Starts a cursor over a range query, taking over its filter. */
+struct queryCursor *newQueryCursor(struct queryResult *r, spatialIndex *index);
+
+struct queryCursor *newQueryCursor(struct queryResult *r, spatialIndex *index){
+    struct queryCursor *c = (struct queryCursor *) trackedMalloc(ALLOC_QUERY, 
+        sizeof(struct queryCursor));
+    assert(c);
+    c->id = 0;
+    c->filter = r->filter;
+    r->filter = NULL;
+    c->test = (pointFilter) {filterPoint, summaryMayMatch, c->filter};
+    c->pending = NULL;
+    c->numPending = 0;
+    c->found = NULL;
+    c->numFound = 0;
+    c->next = NULL;
+
+    rectangle2D *boundary_r = rangeRectangle(r);
+    c->search = newIndexCursor(index, boundary_r, c->filter ? &c->test : NULL);
+    freeRectangle(boundary_r);
+    return c;
+}
+
+/* Output the next page of a cursor's records, searching on within the dictionary's limits 
+if those already found cannot fill it, and the quadrants explored. Returns RANGE_COMPLETE if 
+the cursor has no records left, or why the page stopped short. */
+int printCursorPage(struct dictionary *dict, struct queryCursor *c, FILE *summaryFile, 
+    FILE *outputFile);
+
+int printCursorPage(struct dictionary *dict, struct queryCursor *c, FILE *summaryFile, 
+    FILE *outputFile){
+
+    // A record has two points, so twice as many points as records missing are searched for
+    int status = RANGE_COMPLETE;
+    if(! indexCursorDone(c->search) && 
+        (! dict->maxResults || c->numPending < dict->maxResults)){
+        queryBudget budget = {0, dict->maxNodes, 0};
+        if(dict->maxResults){
+            budget.maxPoints = 2 * (dict->maxResults - c->numPending);
+        }
+        if(dict->deadlineNs){
+            budget.deadlineNs = monotonicNs() + dict->deadlineNs;
+        }
+        point2D **res = indexCursorNext(c->search, &budget, summaryFile, &status);
+
+        // Records printed on earlier pages are not printed again, though their other end is found
+        size_t numIds;
+        int *ids = rankOrder(dict, res, &numIds);
+        trackedFree(ALLOC_QUERY, res);
+        numIds = dropFound(ids, numIds, c->found, c->numFound);
+        mergeRanks(&c->found, &c->numFound, ids, numIds);
+        mergeRanks(&c->pending, &c->numPending, ids, numIds);
+        trackedFree(ALLOC_QUERY, ids);
+    }
+
+    size_t page = c->numPending;
+    if(dict->maxResults && page > dict->maxResults){
+        page = dict->maxResults;
+    }
+    for(size_t i = 0; i < page; i++){
+        printRecord(outputFile, dict->byRank[c->pending[i]]);
+    }
+    memmove(c->pending, c->pending + page, sizeof(int) * (c->numPending - page));
+    c->numPending -= page;
+
+    if(status == RANGE_COMPLETE && (c->numPending > 0 || ! indexCursorDone(c->search))){
+        status = RANGE_STOPPED_POINTS;
+    }
+    return status;
+}
+
+/* Ends the summary of a page, keeping the cursor open under an id given in the summary if 
+the page stopped short, and freeing it otherwise. */
+void finishCursorPage(struct dictionary *dict, struct queryCursor *c, int status, 
+    FILE *summaryFile);
+
+void finishCursorPage(struct dictionary *dict, struct queryCursor *c, int status, 
+    FILE *summaryFile){
+    if(status == RANGE_COMPLETE){
+        fprintf(summaryFile, "\n");
+        freeQueryCursor(c);
+        return;
+    }
+
+    // Beyond the limit of open cursors, the least recently used is dropped
+    struct queryCursor *dropped = NULL;
+    pthread_mutex_lock(&cursorLock);
+    if(! c->id){
+        c->id = ++dict->lastCursorId;
+    }
+    c->next = dict->cursors;
+    dict->cursors = c;
+    if(++dict->numCursors > MAX_OPEN_CURSORS){
+        struct queryCursor **last = &dict->cursors;
+        while((*last)->next){
+            last = &(*last)->next;
+        }
+        dropped = *last;
+        *last = NULL;
+        dict->numCursors--;
+    }
+    fprintf(summaryFile, " [truncated: %s, cursor %d]\n", truncationNames[status], c->id);
+    pthread_mutex_unlock(&cursorLock);
+
+    if(dropped){
+        freeQueryCursor(dropped);
+    }
+}
+
+/* Output the first page of a range query within the dictionary's limits. */
+void printRangePage(struct queryResult *r, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index){
+
+    printRangeHeading(r, summaryFile, outputFile);
+    struct queryCursor *c = newQueryCursor(r, index);
+    int status = printCursorPage(r->dict, c, summaryFile, outputFile);
+    finishCursorPage(r->dict, c, status, summaryFile);
+}
+
+/* Output the next page of the range query kept under the cursor. */
+void printNextPage(struct dictionary *dict, int cursorId, FILE *summaryFile, FILE *outputFile){
+    fprintf(outputFile, "next %d\n", cursorId);
+    fprintf(summaryFile, "next %d -->", cursorId);
+
+    // The cursor is taken out while its page is printed, so no other query can use it
+    pthread_mutex_lock(&cursorLock);
+    struct queryCursor **link = &dict->cursors;
+    while(*link && (*link)->id != cursorId){
+        link = &(*link)->next;
+    }
+    struct queryCursor *c = *link;
+    if(c){
+        *link = c->next;
+        dict->numCursors--;
+    }
+    pthread_mutex_unlock(&cursorLock);
+
+    if(! c){
+        fprintf(summaryFile, " %s\n", NOTFOUND);
+        return;
+    }
+    int status = printCursorPage(dict, c, summaryFile, outputFile);
+    finishCursorPage(dict, c, status, summaryFile);
+}
+
+/* 
+Answers the parent of a tile with one search and caches the records of each of its four 
+children, so neighbouring tiles are served from the cache. Returns the ranks of the tile's
+own records, setting numIds to how many there are.
+*/
+int *cacheSiblingTiles(struct queryResult *r, spatialIndex *index, size_t *numIds);
+
+int *cacheSiblingTiles(struct queryResult *r, spatialIndex *index, size_t *numIds){
+    point2D **res = indexTileQuery(index, r->zoom - 1, r->tileX >> 1, r->tileY >> 1);
+    size_t numPoints = 0;
+    while(res[numPoints] != NULL){
+        numPoints++;
+    }
+
+    // Children are numbered by the low bits of their tile, x first
+    point2D **children[4];
+    size_t counts[4] = {0, 0, 0, 0};
+    for(int c = 0; c < 4; c++){
+        children[c] = (point2D **) trackedMalloc(ALLOC_QUERY, sizeof(point2D *) * (numPoints + 1));
+        assert(children[c]);
+    }
+    for(size_t i = 0; i < numPoints; i++){
+        uint32_t x, y;
+        if((r->filter && ! filterPoint(res[i], r->filter)) || 
+            ! tileOf(index->boundary, r->zoom, res[i], &x, &y)){
+            continue;
+        }
+        int c = (x & 1) | (y & 1) << 1;
+        children[c][counts[c]++] = res[i];
+    }
+
+    int *ids = NULL;
+    for(int c = 0; c < 4; c++){
+        children[c][counts[c]] = NULL;
+        size_t numChildIds;
+        int *childIds = rankOrder(r->dict, children[c], &numChildIds);
+        uint32_t x = (r->tileX & ~1U) | (c & 1);
+        uint32_t y = (r->tileY & ~1U) | (c >> 1);
+        char *key = tileCacheKey(r, r->zoom, x, y);
+        cachePut(r->dict->cache, key, childIds, numChildIds, "", 0);
+        trackedFree(ALLOC_QUERY, key);
+
+        if(x == r->tileX && y == r->tileY){
+            ids = childIds;
+            *numIds = numChildIds;
+        } else {
+            trackedFree(ALLOC_QUERY, childIds);
+        }
+        trackedFree(ALLOC_QUERY, children[c]);
+    }
+    trackedFree(ALLOC_QUERY, res);
+    return ids;
+}
+
+/* Output the records inserted under the tile of a tile query. */
+void printTileResult(struct queryResult *r, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index){
+
+    fprintf(outputFile, "%s", r->lon);
+    printWhere(outputFile, r);
+    fprintf(outputFile, "\n");
+
+    // The tile's quadrants are known from its number, whichever engine answers it
+    point2D center;
+    rectangle2D tile = {&center, 0, 0};
+    int valid = tileRectangle(index->boundary, r->zoom, r->tileX, r->tileY, &tile);
+    fprintf(summaryFile, "%s", r->lon);
+    printWhere(summaryFile, r);
+    fprintf(summaryFile, " -->");
+    for(int level = r->zoom - 1; valid && level >= 0; level--){
+        int east = (r->tileX >> level) & 1;
+        int south = (r->tileY >> level) & 1;
+        fprintf(summaryFile, " %s", quadrantName(east ? (south ? 4 : 3) : (south ? 1 : 2)));
+    }
+    fprintf(summaryFile, "\n");
+    if(! valid){
+        return;
+    }
+
+    // Tiles missing from the cache are cached along with their siblings
+    size_t numIds;
+    int *ids;
+    r->cacheKey = tileCacheKey(r, r->zoom, r->tileX, r->tileY);
+    if(r->cacheKey && cacheGet(r->dict->cache, r->cacheKey, &r->hit)){
+        r->cached = 1;
+        ids = r->hit.ids;
+        numIds = r->hit.numIds;
+    } else if(r->cacheKey && r->zoom > 0){
+        ids = cacheSiblingTiles(r, index, &numIds);
+    } else {
+        point2D **res = indexTileQuery(index, r->zoom, r->tileX, r->tileY);
+        size_t kept = 0;
+        for(size_t i = 0; res[i] != NULL; i++){
+            if(! r->filter || filterPoint(res[i], r->filter)){
+                res[kept++] = res[i];
+            }
+        }
+        res[kept] = NULL;
+        ids = rankOrder(r->dict, res, &numIds);
+        trackedFree(ALLOC_QUERY, res);
+        if(r->cacheKey){
+            cachePut(r->dict->cache, r->cacheKey, ids, numIds, "", 0);
+        }
+    }
+
+    // Records are printed by footpath_id, each once though both its ends may lie in the tile
+    for(size_t i = 0; i < numIds; i++){
+        printRecord(outputFile, r->dict->byRank[ids[i]]);
+    }
+    if(! r->cached){
+        trackedFree(ALLOC_QUERY, ids);
+    }
+}
+
 /* Output the given query result. */
 void printQueryResult(struct queryResult *r, FILE *summaryFile, 
-    FILE *outputFile, int stage,QuadTree *qt){
+    FILE *outputFile, int stage, spatialIndex *index){
 
+    if(stage == RANGEQUERY){
+        printRangeResult(r, summaryFile, outputFile, index);
+        return;
+    }
 
     /* Print details. */
-    fprintf(outputFile, "%s %s\n", r->lon, r->lat);
+    fprintf(outputFile, "%s %s", r->lon, r->lat);
+    printWhere(outputFile, r);
+    fprintf(outputFile, "\n");
     for(int i = 0; i < r->numRecords; i++){
-        fprintf(outputFile, "--> ");
-        for(int j = 0; j < NUM_FIELDS; j++){
-            fprintf(outputFile, "%s: ", fieldNames[j]);
-            printField(outputFile, r->records[i], j);
-            fprintf(outputFile, " || ");
-        }
-        fprintf(outputFile, "\n");
+        printRecord(outputFile, r->records[i]);
     }
 
   
     /* Print summary. */
     if(stage == REGIONQUERY){
+        fprintf(summaryFile, "%s %s", r->lon, r->lat);
+        printWhere(summaryFile, r);
         if(r->numRecords == 0){
-            fprintf(summaryFile, "%s %s --> %s\n", r->lon, r->lat, NOTFOUND);
+            fprintf(summaryFile, " --> %s\n", NOTFOUND);
         } else {
-            fprintf(summaryFile, "%s %s --> ", r->lon, r->lat);
+            fprintf(summaryFile, " --> ");
         }
 
     } 
 
+    // A cached result replays the quadrants the search printed
+    if(r->cached){
+        fwrite(r->hit.path, 1, r->hit.pathLen, summaryFile);
+        return;
+    }
+
     // Convert the point to be searched into a rectangle with coordinates
     point2D *center_r = create_point(r->x_val, r->y_val);
     rectangle2D *boundary_r = create_rectangle(center_r, APPROXIMATE_VALUE, APPROXIMATE_VALUE);
     
     /* Search for the point within the constructed quadtree
     and return the path traversed with the quadrant names */
-    point2D **res = searchPoint(qt, boundary_r,center_r);
+    point2D **res = indexSearchPoint(index, boundary_r, center_r);
     
+    // The path is captured as it is printed when the result is to be cached
+    char *path = NULL;
+    size_t pathLen = 0;
+    FILE *pathFile = r->cacheKey ? open_memstream(&path, &pathLen) : summaryFile;
+    assert(pathFile);
+
     size_t j = 0;
     while (res[j] != NULL && j < MAX_ARRAY_SIZE) {
 
         // Print path of traversal until point was found
-        determineQuadrant(qt->boundary, res[j],summaryFile);
+        determineQuadrant(index->boundary, res[j],pathFile);
         j++;
     }
+
+    if(r->cacheKey){
+        fclose(pathFile);
+        trackedAdopt(ALLOC_QUERY, path);
+        fwrite(path, 1, pathLen, summaryFile);
+        int *ids = (int *) trackedMalloc(ALLOC_QUERY, sizeof(int) * (r->numRecords + 1));
+        assert(ids);
+        for(int i = 0; i < r->numRecords; i++){
+            ids[i] = r->records[i]->rank;
+        }
+        cachePut(r->dict->cache, r->cacheKey, ids, r->numRecords, path, pathLen);
+        trackedFree(ALLOC_QUERY, ids);
+        trackedFree(ALLOC_QUERY, path);
+    }
+    trackedFree(ALLOC_QUERY, res);
+    freeRectangle(boundary_r);
 }
 
 /* Free the given query result. */
@@ -500,10 +2041,18 @@ void freeQueryResult(struct queryResult *r){
     if(! r){
         return;
     }
-    free(r->records);
-    free(r->lon);
-    free(r->lat);
-    free(r);
+    trackedFree(ALLOC_QUERY, r->records);
+    trackedFree(ALLOC_QUERY, r->lon);
+    trackedFree(ALLOC_QUERY, r->lat);
+    trackedFree(ALLOC_QUERY, r->lonMax);
+    trackedFree(ALLOC_QUERY, r->latMax);
+    trackedFree(ALLOC_QUERY, r->where);
+    freeFilter(r->filter);
+    trackedFree(ALLOC_QUERY, r->cacheKey);
+    if(r->cached){
+        freeCachedResult(&r->hit);
+    }
+    trackedFree(ALLOC_QUERY, r);
 }
 
 void freeData(struct data *d){
@@ -511,18 +2060,19 @@ void freeData(struct data *d){
         return;
     }
     if(d->address){
-        free(d->address);
+        trackedFree(ALLOC_DICT, d->address);
     };
     if(d->clue_sa){
-        free(d->clue_sa);
+        trackedFree(ALLOC_DICT, d->clue_sa);
     };
     if(d->asset_type){
-        free(d->asset_type);
+        trackedFree(ALLOC_DICT, d->asset_type);
     };
     if(d->segside){
-        free(d->segside);
+        trackedFree(ALLOC_DICT, d->segside);
     };
-    free(d);
+    trackedFree(ALLOC_DICT, d->raw);
+    trackedFree(ALLOC_DICT, d);
 }
 
 /* Free a given dictionary. */
@@ -535,21 +2085,40 @@ void freeDict(struct dictionary *dict){
     while(current){
         next = current->next;
         freeData(current->record);
-        free(current);
+        trackedFree(ALLOC_DICT, current);
         current = next;
     }
     if(dict->indices){
         for(int i = 0; i < NUM_FIELDS; i++){
             if(dict->indices[i]){
                 if(dict->indices[i]->nodes){
-                    free(dict->indices[i]->nodes);
+                    trackedFree(ALLOC_DICT, dict->indices[i]->nodes);
                 }
-                free(dict->indices[i]);
+                trackedFree(ALLOC_DICT, dict->indices[i]);
             }
         }
-        free(dict->indices);
+        trackedFree(ALLOC_DICT, dict->indices);
     }
-    free(dict);
+    for(int i = 0; i < NUM_FIELDS; i++){
+        for(int j = 0; j < dict->categories[i].numValues; j++){
+            trackedFree(ALLOC_DICT, dict->categories[i].values[j]);
+        }
+    }
+    if(! dict->isPart){
+        trackedFree(ALLOC_DICT, dict->categories);
+    }
+    trackedFree(ALLOC_DICT, dict->byRank);
+    while(dict->cursors){
+        struct queryCursor *next = dict->cursors->next;
+        freeQueryCursor(dict->cursors);
+        dict->cursors = next;
+    }
+
+    // Other threads' marks are freed as they exit
+    pthread_once(&rankMarksOnce, createRankMarksKey);
+    trackedFree(ALLOC_QUERY, pthread_getspecific(rankMarksKey));
+    pthread_setspecific(rankMarksKey, NULL);
+    trackedFree(ALLOC_DICT, dict);
 }
 
 void Point_print(point2D *point) {
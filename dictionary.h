@@ -1,9 +1,11 @@
 #include "record_struct.h"
 #include <stdio.h>
-#include "quadtree.h"
+#include "spatial_index.h"
+#include "query_cache.h"
 
 
 #define REGIONQUERY 3
+#define RANGEQUERY 4
 #define PROXIMITYSTAGE 2
 
 /* Result of a query. */
@@ -15,17 +17,96 @@ struct dictionary;
 /* Returns an empty dictionary. */
 struct dictionary *newDict();
 
+/* Sets whether records are inserted lazily, parsing only footpath_id and the coordinates 
+and the other fields when a record is first printed or filtered on. */
+void setLazyRecords(struct dictionary *dict, int lazy);
+
+/* Sets the cache point and range query results are kept in, or NULL for none; the cache 
+should watch the generation of the index the records are inserted into. */
+void setQueryCache(struct dictionary *dict, queryCache *cache);
+
+/* Sets limits on range queries printed with printRangePage: the records printed per page, and
+the nodes visited and milliseconds spent searching for each page; 0 sets no limit. */
+void setQueryBudget(struct dictionary *dict, size_t maxResults, size_t maxNodes, 
+    unsigned long long deadlineMs);
+
+/* Returns 1 if any limit has been set on range queries. */
+int hasQueryBudget(struct dictionary *dict);
+
+/* Returns an empty part of the dictionary, sharing its settings and the numbering of string 
+values, so several parts may be filled from separate threads. Call once every field to be 
+summarised has been set with parseSummaryColumns. */
+struct dictionary *newPartDict(struct dictionary *dict);
+
+/* Appends the records of a part to the end of the dictionary, freeing the part. */
+void appendDict(struct dictionary *dict, struct dictionary *part);
+
 /* Insert a given record into the dictionary. */
-void insertRecord(struct dictionary *dict, struct csvRecord *record, QuadTree *qt);
+void insertRecord(struct dictionary *dict, struct csvRecord *record, spatialIndex *index);
+
+/* Sets x and y to the coordinates of the record's start (end 0) or end (end 1) point, 
+for indexes which recover points from the records. */
+void recordPoint(struct data *record, int end, long double *x, long double *y);
+
+/* Ranks the records by footpath_id so range results can be ordered without sorting. 
+Call once all records are inserted; a range query ranks any records inserted after. */
+void rankRecords(struct dictionary *dict);
 
 /* Search for a given key in the dictionary. */
 struct queryResult *lookupRecord(struct dictionary *dict, char *query);
 
+/* Parse a range query given by its bottom-left and top-right coordinates. */
+struct queryResult *lookupRange(struct dictionary *dict, char *query);
+
+/* Parse a tile query given as zoom/x/y, where the root rectangle is divided into 2^zoom by 
+2^zoom tiles numbered from its north-west corner. */
+struct queryResult *lookupTile(struct dictionary *dict, char *query);
+
 
 
 /* Output the given query result */
 void printQueryResult(struct queryResult *r, FILE *summaryFile, 
-    FILE *outputFile, int stage,QuadTree *qt);
+    FILE *outputFile, int stage, spatialIndex *index);
+
+/* Output the records inserted under the tile of a tile query, sorted by footpath_id with 
+duplicates removed, and the quadrants leading to the tile. With a result cache, a tile 
+missing from it is answered by searching its parent once and caching all four children. */
+void printTileResult(struct queryResult *r, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index);
+
+/* Output the records of each range query of a batch as printQueryResult would, in the order
+given. Queries not already cached are answered together by one batched search of the index. */
+void printRangeBatch(struct queryResult **rs, size_t numQueries, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index);
+
+/* Output the first page of a range query within the dictionary's limits: its records sorted
+by footpath_id with duplicates removed, and the quadrants explored. A query stopped short by a
+limit ends its summary with the limit and a cursor its next page is fetched with. */
+void printRangePage(struct queryResult *r, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index);
+
+/* Output the next page of the range query kept under the cursor, continuing its search from 
+where the last page stopped. Each page's records are sorted by footpath_id, and no record is 
+printed on two pages. */
+void printNextPage(struct dictionary *dict, int cursorId, FILE *summaryFile, FILE *outputFile);
+
+/* Output only the number of datapoints (footpath ends) within a range query. */
+void printRangeCount(struct queryResult *r, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index);
+
+/* Sets up the spec to summarise the comma-separated numeric fields named in the list,
+counting each footpath once at its start point. Returns 0 if a field is not numeric. */
+int parseAggregateColumns(char *list, aggregateSpec *spec);
+
+/* Sets up the spec to summarise the comma-separated fields named in the list at every node,
+so range queries filtering on them can skip whole subtrees, and has the dictionary number the
+values of its text fields. Call before inserting records. Returns 0 if a field is unknown. */
+int parseSummaryColumns(struct dictionary *dict, char *list, aggregateSpec *spec);
+
+/* Output the number of footpaths starting within a range query and the sum, minimum and
+maximum of each aggregated field over them. */
+void printRangeAggregate(struct queryResult *r, FILE *summaryFile, 
+    FILE *outputFile, spatialIndex *index);
 
 /* Free the given query result. */
 void freeQueryResult(struct queryResult *r);
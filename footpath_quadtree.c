@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "footpath_quadtree.h"
+#include "query_stats.h"
+#include "alloc_stats.h"
+
+/* Result of a footpath tree range query as it is collected */
+typedef struct footpathResult {
+    point2D **points;
+    size_t count;
+    size_t capacity;
+    FILE *summaryFile;
+} footpathResult;
+
+// Allocates a zeroed node charged to the tree subsystem
+void *footpathAllocNode(size_t size) {
+    return trackedCalloc(ALLOC_TREE, 1, size);
+}
+
+// Frees a node charged to the tree subsystem
+void footpathFreeNode(void *node) {
+    trackedFree(ALLOC_TREE, node);
+}
+
+// Creates a new, empty footpath tree covering the given root rectangle
+footpathTree *newFootpathTree(rectangle2D *boundary) {
+    return footpathTree_new(boundary->center->x, boundary->center->y, boundary->x_half, 
+        boundary->y_half);
+}
+
+// Adds a point given with its 2D coordinates to the footpath tree
+int footpathAddPoint(footpathTree *tree, point2D *point) {
+    return footpathTree_insert(tree, point->x, point->y, point);
+}
+
+// Appends a datapoint found to the result, keeping one slot spare for the terminating NULL
+static void collectPoint(point2D *point, void *arg) {
+    footpathResult *result = (footpathResult *)arg;
+    if (result->count + 1 >= result->capacity) {
+        result->capacity *= 2;
+        result->points = (point2D **)trackedRealloc(ALLOC_QUERY, result->points, 
+            sizeof(point2D *) * result->capacity);
+        assert(result->points);
+    }
+    result->points[result->count++] = point;
+}
+
+// Prints a quadrant explored, as rangeQuery does
+static void printQuadrant(int quadrant, void *arg) {
+    footpathResult *result = (footpathResult *)arg;
+    QUERY_STAT_ADD(nodesVisited, 1);
+    if (result->summaryFile) {
+        fprintf(result->summaryFile, " %s", quadrantName(quadrant + 1));
+    }
+}
+
+// Returns all datapoints lying within the query rectangle as a NULL-terminated array
+point2D **footpathRangeQuery(footpathTree *tree, rectangle2D *range, FILE *summaryFile) {
+    footpathResult result = {NULL, 0, 16, summaryFile};
+    result.points = (point2D **)trackedMalloc(ALLOC_QUERY, sizeof(point2D *) * result.capacity);
+    assert(result.points);
+
+    // The root is visited without being printed
+    QUERY_STAT_ADD(nodesVisited, 1);
+    footpathTree_range(tree, range->center->x - range->x_half, range->center->y - range->y_half,
+        range->center->x + range->x_half, range->center->y + range->y_half, collectPoint, 
+        printQuadrant, &result);
+    result.points[result.count] = NULL;
+    QUERY_STAT_ADD(pointsReturned, result.count);
+
+    return result.points;
+}
+
+// Returns the number of datapoints lying within the query rectangle
+size_t footpathRangeCount(footpathTree *tree, rectangle2D *range) {
+    size_t found = footpathTree_count(tree, range->center->x - range->x_half, 
+        range->center->y - range->y_half, range->center->x + range->x_half, 
+        range->center->y + range->y_half);
+    QUERY_STAT_ADD(pointsReturned, found);
+
+    return found;
+}
+
+// Prints the footpath tree's size as one "name: value" pair per line
+void printFootpathTreeStats(footpathTree *tree, FILE *f) {
+    fprintf(f, "points: %zu\n", tree->size);
+    fprintf(f, "nodes: %zu\n", tree->nodes);
+    fprintf(f, "max_depth: %d\n", tree->depth);
+    fprintf(f, "bytes_nodes: %zu\n", sizeof(footpathTree_node) * tree->nodes);
+    fprintf(f, "bytes_points: %zu\n", sizeof(point2D) * tree->size);
+    fprintf(f, "bytes_total: %zu\n", sizeof(footpathTree_node) * tree->nodes + 
+        sizeof(point2D) * tree->size + sizeof(footpathTree));
+}
+
+// Frees the footpath tree and every point added to it
+void freeFootpathTree(footpathTree *tree) {
+    if (!tree) {
+        return;
+    }
+    footpathTree_free(tree, freePoint);
+}
@@ -0,0 +1,44 @@
+#ifndef FOOTPATH_QUADTREE_H
+#define FOOTPATH_QUADTREE_H
+
+#include <stdio.h>
+#include "quadtree.h"
+#include "quadtree_template.h"
+
+/* Depth below which the footpath tree stops splitting; only runs of several hundred identical
+points reach it */
+#define FOOTPATH_TREE_MAX_DEPTH (64)
+
+/* Allocates and frees the footpath tree's nodes, charged to the tree subsystem */
+void *footpathAllocNode(size_t size);
+void footpathFreeNode(void *node);
+
+/* The PR quadtree of the pointer engine instantiated from quadtree_template.h: long double
+coordinates, datapoints as items and QT_NODE_CAPACITY points per node, held inline in each
+node rather than behind rectangle and point array allocations */
+QUADTREE_TEMPLATE(footpathTree, long double, point2D *, QT_NODE_CAPACITY, FOOTPATH_TREE_MAX_DEPTH,
+    footpathAllocNode, footpathFreeNode)
+
+// function definitions
+
+/* Creates a new, empty footpath tree covering the given root rectangle */
+footpathTree *newFootpathTree(rectangle2D *boundary);
+
+/* Adds a point given with its 2D coordinates to the footpath tree */
+int footpathAddPoint(footpathTree *tree, point2D *point);
+
+/* Returns all datapoints lying within the query rectangle as a NULL-terminated array, in the
+order rangeQuery returns them, printing each quadrant explored to the summary file (if given)
+as rangeQuery does */
+point2D **footpathRangeQuery(footpathTree *tree, rectangle2D *range, FILE *summaryFile);
+
+/* Returns the number of datapoints lying within the query rectangle, without collecting them */
+size_t footpathRangeCount(footpathTree *tree, rectangle2D *range);
+
+/* Prints the footpath tree's size as one "name: value" pair per line */
+void printFootpathTreeStats(footpathTree *tree, FILE *f);
+
+/* Frees the footpath tree and every point added to it */
+void freeFootpathTree(footpathTree *tree);
+
+#endif
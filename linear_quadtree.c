@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "linear_quadtree.h"
+#include "query_stats.h"
+#include "contain_kernel.h"
+#include "alloc_stats.h"
+
+#define INITIAL_ENTRIES (16)
+#define INITIAL_INTERVALS (16)
+#define GRID_SCALE (4294967296.0L)
+
+/* Points a thread's last compact search returned, rebuilt from the record store */
+typedef struct resolvedPoints {
+    size_t capacity;
+    point2D points[];
+} resolvedPoints;
+
+static pthread_key_t resolvedKey;
+static pthread_once_t resolvedOnce = PTHREAD_ONCE_INIT;
+
+// Creates a new, empty linear quadtree covering the given root rectangle
+LinearQuadTree *new_LinearQuadtree(rectangle2D *boundary) {
+    LinearQuadTree *lqt = (LinearQuadTree *)trackedMalloc(ALLOC_TREE, sizeof(LinearQuadTree));
+    assert(lqt);
+
+    lqt->boundary = boundary;
+    lqt->entries = NULL;
+    lqt->numEntries = 0;
+    lqt->capacity = 0;
+    lqt->sorted = 1;
+    lqt->xs = NULL;
+    lqt->ys = NULL;
+    lqt->inexact = 0;
+    lqt->compact = 0;
+    lqt->resolve = NULL;
+
+    return lqt;
+}
+
+// Switches an empty linear quadtree to keeping only codes and record references
+void linearSetCompact(LinearQuadTree *lqt, pointResolver resolve) {
+    assert(lqt->numEntries == 0);
+
+    lqt->compact = 1;
+    lqt->resolve = resolve;
+}
+
+// Spreads the bits of a 32-bit value out to the even bits of a 64-bit value
+static uint64_t spreadBits(uint64_t v) {
+    v &= 0xFFFFFFFFULL;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v << 8)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    v = (v | (v << 1)) & 0x5555555555555555ULL;
+    return v;
+}
+
+// Interleaves grid x and y positions into a Morton code, x taking the even bits
+static uint64_t interleave(uint64_t x, uint64_t y) {
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+// Maps a coordinate onto the grid spanning [min, min + extent]; monotonic so range bounds stay conservative
+static uint64_t quantise(long double value, long double min, long double extent) {
+    if (extent <= 0) {
+        return 0;
+    }
+
+    long double t = (value - min) / extent * GRID_SCALE;
+    if (t <= 0) {
+        return 0;
+    }
+    if (t >= GRID_SCALE - 1) {
+        return 0xFFFFFFFFULL;
+    }
+
+    return (uint64_t)t;
+}
+
+// Returns the Z-order code of a point relative to the root rectangle
+uint64_t mortonCode(rectangle2D *boundary, point2D *point) {
+    long double min_x = boundary->center->x - boundary->x_half;
+    long double min_y = boundary->center->y - boundary->y_half;
+
+    uint64_t gx = quantise(point->x, min_x, 2 * boundary->x_half);
+    uint64_t gy = quantise(point->y, min_y, 2 * boundary->y_half);
+
+    return interleave(gx, gy);
+}
+
+// Adds a point given with its 2D coordinates to the linear quadtree
+int linearAddPoint(LinearQuadTree *lqt, point2D *point) {
+
+    // If point does not lie within the root node
+    if (!inRectangle(lqt->boundary, point)) {
+        return 0;
+    }
+
+    if (lqt->numEntries >= lqt->capacity) {
+        lqt->capacity = lqt->capacity ? lqt->capacity * 2 : INITIAL_ENTRIES;
+        lqt->entries = (mortonEntry *)trackedRealloc(ALLOC_TREE, lqt->entries, 
+            sizeof(mortonEntry) * lqt->capacity);
+        assert(lqt->entries);
+    }
+
+    // Entries are appended unsorted and sorted in one pass before the next search
+    lqt->entries[lqt->numEntries].code = mortonCode(lqt->boundary, point);
+    if (lqt->compact) {
+        assert(point->record && ((uintptr_t)point->record & 1) == 0);
+        lqt->entries[lqt->numEntries].ref = (uintptr_t)point->record | (point->end != 0);
+    } else {
+        lqt->entries[lqt->numEntries].point = point;
+    }
+    lqt->numEntries++;
+    lqt->sorted = 0;
+    if (!exactAsDouble(point)) {
+        lqt->inexact = 1;
+    }
+
+    return 1;
+}
+
+// Orders entries by Morton code
+static int compareEntries(const void *a, const void *b) {
+    uint64_t ca = ((const mortonEntry *)a)->code;
+    uint64_t cb = ((const mortonEntry *)b)->code;
+
+    return (ca > cb) - (ca < cb);
+}
+
+// Sorts any pending entries so the linear quadtree can be searched
+void linearBuild(LinearQuadTree *lqt) {
+    if (lqt->sorted) {
+        return;
+    }
+
+    qsort(lqt->entries, lqt->numEntries, sizeof(mortonEntry), compareEntries);
+    lqt->sorted = 1;
+
+    // Compact trees keep no coordinates, testing boundary cells against the record store
+    if (lqt->compact) {
+        return;
+    }
+
+    // Coordinates are copied out in sorted order so interval scans read them contiguously
+    lqt->xs = (double *)trackedRealloc(ALLOC_TREE, lqt->xs, 
+        sizeof(double) * (lqt->numEntries + 1));
+    assert(lqt->xs);
+    lqt->ys = (double *)trackedRealloc(ALLOC_TREE, lqt->ys, 
+        sizeof(double) * (lqt->numEntries + 1));
+    assert(lqt->ys);
+    for (size_t i = 0; i < lqt->numEntries; i++) {
+        lqt->xs[i] = (double)lqt->entries[i].point->x;
+        lqt->ys[i] = (double)lqt->entries[i].point->y;
+    }
+}
+
+// Grid bounds of a query: cells overlapping [q0, q1] may hold hits, and cells
+// within [c0, c1] hold nothing but hits
+typedef struct queryGrid {
+    uint64_t qx0, qy0, qx1, qy1;
+    int64_t cx0, cy0, cx1, cy1;
+} queryGrid;
+
+// Appends an interval, merging it with the previous one when they are contiguous and alike
+static void appendInterval(mortonInterval **intervals, size_t *count, size_t *capacity,
+    uint64_t lo, uint64_t hi, int contained) {
+
+    if (*count > 0 && (*intervals)[*count - 1].hi + 1 == lo && 
+        (*intervals)[*count - 1].contained == contained) {
+        (*intervals)[*count - 1].hi = hi;
+        return;
+    }
+
+    if (*count >= *capacity) {
+        *capacity *= 2;
+        *intervals = (mortonInterval *)trackedRealloc(ALLOC_QUERY, *intervals, 
+            sizeof(mortonInterval) * *capacity);
+        assert(*intervals);
+    }
+
+    (*intervals)[*count].lo = lo;
+    (*intervals)[*count].hi = hi;
+    (*intervals)[*count].contained = contained;
+    (*count)++;
+}
+
+// Recursively splits a grid cell until it lies fully inside the query or the depth limit is reached
+static void decomposeCell(uint64_t cx, uint64_t cy, int level, queryGrid *q,
+    mortonInterval **intervals, size_t *count, size_t *capacity) {
+
+    int shift = LQT_MORTON_BITS - level;
+    uint64_t x0 = cx << shift;
+    uint64_t y0 = cy << shift;
+    uint64_t x1 = ((cx + 1) << shift) - 1;
+    uint64_t y1 = ((cy + 1) << shift) - 1;
+
+    // Cell lies outside the query
+    if (x1 < q->qx0 || x0 > q->qx1 || y1 < q->qy0 || y0 > q->qy1) {
+        return;
+    }
+
+    int contained = (int64_t)x0 >= q->cx0 && (int64_t)x1 <= q->cx1 && 
+        (int64_t)y0 >= q->cy0 && (int64_t)y1 <= q->cy1;
+
+    // Cell lies inside the query, or is small enough to be scanned and filtered exactly
+    if (contained || (x0 >= q->qx0 && x1 <= q->qx1 && y0 >= q->qy0 && y1 <= q->qy1) || 
+        level == LQT_DECOMPOSE_DEPTH) {
+        appendInterval(intervals, count, capacity, interleave(x0, y0), interleave(x1, y1), contained);
+        return;
+    }
+
+    // Children are visited in Z-order so intervals are produced in ascending order
+    for (int child = 0; child < 4; child++) {
+        decomposeCell(2 * cx + (child & 1), 2 * cy + (child >> 1), level + 1,
+            q, intervals, count, capacity);
+    }
+}
+
+// Decomposes the query rectangle into ascending, merged Morton intervals
+size_t mortonDecompose(rectangle2D *boundary, rectangle2D *range, mortonInterval **intervals) {
+    size_t count = 0;
+    size_t capacity = INITIAL_INTERVALS;
+
+    *intervals = (mortonInterval *)trackedMalloc(ALLOC_QUERY, sizeof(mortonInterval) * capacity);
+    assert(*intervals);
+
+    long double min_x = boundary->center->x - boundary->x_half;
+    long double min_y = boundary->center->y - boundary->y_half;
+    long double max_x = boundary->center->x + boundary->x_half;
+    long double max_y = boundary->center->y + boundary->y_half;
+    long double range_min_x = range->center->x - range->x_half;
+    long double range_min_y = range->center->y - range->y_half;
+    long double range_max_x = range->center->x + range->x_half;
+    long double range_max_y = range->center->y + range->y_half;
+
+    queryGrid q;
+    q.qx0 = quantise(range_min_x, min_x, 2 * boundary->x_half);
+    q.qy0 = quantise(range_min_y, min_y, 2 * boundary->y_half);
+    q.qx1 = quantise(range_max_x, min_x, 2 * boundary->x_half);
+    q.qy1 = quantise(range_max_y, min_y, 2 * boundary->y_half);
+
+    // Quantising rounds down, so a point sharing the query edge's grid column may still
+    // lie outside it; only columns strictly inside are certain, unless the query edge
+    // lies beyond the root where no points are stored
+    q.cx0 = range_min_x <= min_x ? (int64_t)q.qx0 : (int64_t)q.qx0 + 1;
+    q.cy0 = range_min_y <= min_y ? (int64_t)q.qy0 : (int64_t)q.qy0 + 1;
+    q.cx1 = range_max_x >= max_x ? (int64_t)q.qx1 : (int64_t)q.qx1 - 1;
+    q.cy1 = range_max_y >= max_y ? (int64_t)q.qy1 : (int64_t)q.qy1 - 1;
+
+    decomposeCell(0, 0, 0, &q, intervals, &count, &capacity);
+
+    return count;
+}
+
+// Returns the index of the first entry at or after start whose code is not below the given code
+static size_t lowerBound(mortonEntry *entries, size_t start, size_t end, uint64_t code) {
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+        if (entries[mid].code < code) {
+            start = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+
+    return start;
+}
+
+// Returns the index of the first entry at or after start whose code is above the given code
+static size_t upperBound(mortonEntry *entries, size_t start, size_t end, uint64_t code) {
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+        if (entries[mid].code <= code) {
+            start = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+
+    return start;
+}
+
+// Recovers the exact point an entry of a compact tree stands for
+static void resolveEntry(LinearQuadTree *lqt, uintptr_t ref, point2D *point) {
+    point->record = (struct data *)(ref & ~(uintptr_t)1);
+    point->end = ref & 1;
+    lqt->resolve(point->record, ref & 1, &point->x, &point->y);
+}
+
+// Frees a thread's resolved points as it exits
+static void freeResolved(void *resolved) {
+    trackedFree(ALLOC_QUERY, resolved);
+}
+
+// Creates the key of each thread's resolved points, which are freed as the thread exits
+static void createResolvedKey(void) {
+    int created = pthread_key_create(&resolvedKey, freeResolved);
+    assert(created == 0);
+}
+
+// Replaces the references collected by a compact search with points rebuilt in the
+// calling thread's buffer, which is reused by its next search
+static void resolveResults(LinearQuadTree *lqt, point2D **result, size_t count) {
+    pthread_once(&resolvedOnce, createResolvedKey);
+
+    resolvedPoints *resolved = (resolvedPoints *)pthread_getspecific(resolvedKey);
+    if (!resolved || resolved->capacity < count) {
+        trackedFree(ALLOC_QUERY, resolved);
+        resolved = (resolvedPoints *)trackedMalloc(ALLOC_QUERY, 
+            sizeof(resolvedPoints) + sizeof(point2D) * count);
+        assert(resolved);
+        resolved->capacity = count;
+        pthread_setspecific(resolvedKey, resolved);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        resolveEntry(lqt, (uintptr_t)result[i], &resolved->points[i]);
+        result[i] = &resolved->points[i];
+    }
+}
+
+// Appends a point to a growable NULL-terminated result array
+static void appendResult(point2D ***result, size_t *count, size_t *capacity, point2D *point) {
+
+    // Keep one slot spare for the terminating NULL
+    if (*count + 1 >= *capacity) {
+        *capacity *= 2;
+        *result = (point2D **)trackedRealloc(ALLOC_QUERY, *result, 
+            sizeof(point2D *) * *capacity);
+        assert(*result);
+    }
+
+    (*result)[(*count)++] = point;
+    (*result)[*count] = NULL;
+}
+
+// Scans the intervals covering the query, appending hits to the result if one is given,
+// and returns the number of hits
+static size_t scanRange(LinearQuadTree *lqt, rectangle2D *range, 
+    point2D ***result, size_t *count, size_t *capacity) {
+
+    // If the query lies outside the root node
+    if (!rectangleOverlap(lqt->boundary, range)) {
+        return 0;
+    }
+
+    linearBuild(lqt);
+
+    mortonInterval *intervals;
+    size_t numIntervals = mortonDecompose(lqt->boundary, range, &intervals);
+
+    // Each interval stands in for one visited node of a pointer quadtree
+    QUERY_STAT_ADD(nodesVisited, numIntervals);
+
+    containBounds bounds;
+    containBoundsOf(range, &bounds);
+
+    // Intervals ascend, so each binary search resumes from where the last scan stopped
+    size_t found = 0;
+    size_t pos = 0;
+    for (size_t i = 0; i < numIntervals; i++) {
+        pos = lowerBound(lqt->entries, pos, lqt->numEntries, intervals[i].lo);
+        size_t end = upperBound(lqt->entries, pos, lqt->numEntries, intervals[i].hi);
+
+        // Intervals inside the query are emitted (or counted) without testing
+        if (intervals[i].contained) {
+            found += end - pos;
+            QUERY_STAT_ADD(pointsReturned, end - pos);
+            // Compact entries are collected as references and resolved once the query is done
+            for (; result && pos < end; pos++) {
+                appendResult(result, count, capacity, lqt->entries[pos].point);
+            }
+            pos = end;
+            continue;
+        }
+        QUERY_STAT_ADD(pointsExamined, end - pos);
+
+        // Test the interval's coordinates a batch at a time, emitting each hit
+        while (pos < end) {
+            size_t batch = end - pos < CONTAIN_BATCH ? end - pos : CONTAIN_BATCH;
+            uint64_t hits = 0;
+
+            if (lqt->compact) {
+                for (size_t j = 0; j < batch; j++) {
+                    point2D point;
+                    resolveEntry(lqt, lqt->entries[pos + j].ref, &point);
+                    hits |= (uint64_t)inRectangle(range, &point) << j;
+                }
+            } else if (!lqt->inexact) {
+                QUERY_STAT_ADD(inRectangleTests, batch);
+                hits = containBatch(lqt->xs + pos, lqt->ys + pos, batch, &bounds);
+            } else {
+                for (size_t j = 0; j < batch; j++) {
+                    hits |= (uint64_t)inRectangle(range, lqt->entries[pos + j].point) << j;
+                }
+            }
+
+            found += __builtin_popcountll(hits);
+            QUERY_STAT_ADD(pointsReturned, __builtin_popcountll(hits));
+            while (result && hits) {
+                int j = __builtin_ctzll(hits);
+                appendResult(result, count, capacity, lqt->entries[pos + j].point);
+                hits &= hits - 1;
+            }
+            pos += batch;
+        }
+    }
+
+    trackedFree(ALLOC_QUERY, intervals);
+
+    return found;
+}
+
+// Returns all datapoints lying within the query rectangle as a NULL-terminated array
+point2D **linearSearchPoint(LinearQuadTree *lqt, rectangle2D *range, point2D *search) {
+    size_t count = 0;
+    size_t capacity = INITIAL_ENTRIES;
+
+    point2D **result = (point2D **)trackedMalloc(ALLOC_QUERY, sizeof(point2D *) * capacity);
+    assert(result);
+    result[0] = NULL;
+
+    scanRange(lqt, range, &result, &count, &capacity);
+    if (lqt->compact) {
+        resolveResults(lqt, result, count);
+    }
+
+    return result;
+}
+
+// Returns the number of datapoints lying within the query rectangle, without collecting them
+size_t linearRangeCount(LinearQuadTree *lqt, rectangle2D *range) {
+    return scanRange(lqt, range, NULL, NULL, NULL);
+}
+
+// Frees the linear quadtree, leaving the stored points and root rectangle to the caller
+void freeLinearQuadtree(LinearQuadTree *lqt) {
+    if (!lqt) {
+        return;
+    }
+
+    trackedFree(ALLOC_TREE, lqt->entries);
+    trackedFree(ALLOC_TREE, lqt->xs);
+    trackedFree(ALLOC_TREE, lqt->ys);
+    trackedFree(ALLOC_TREE, lqt);
+}
+
+// Frees the points the calling thread's last compact search returned
+void linearReleaseResults(void) {
+    pthread_once(&resolvedOnce, createResolvedKey);
+    freeResolved(pthread_getspecific(resolvedKey));
+    pthread_setspecific(resolvedKey, NULL);
+}
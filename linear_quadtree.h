@@ -0,0 +1,88 @@
+#ifndef LINEAR_QUADTREE_H
+#define LINEAR_QUADTREE_H
+
+#include <stdint.h>
+#include "quadtree.h"
+
+/* Bits of grid resolution per axis used when computing Z-order (Morton) codes */
+#define LQT_MORTON_BITS 32
+
+/* Deepest grid level the query decomposition descends to before scanning a cell */
+#define LQT_DECOMPOSE_DEPTH 12
+
+// data definitions
+typedef struct mortonEntry {
+    uint64_t code;
+    union {
+        point2D *point;
+        /* In compact mode, the point's record with the low bit set for its end point */
+        uintptr_t ref;
+    };
+} mortonEntry;
+
+/* Recovers the exact coordinates of a record's start (end 0) or end (end 1) point, for
+linear quadtrees in compact mode which keep no points of their own */
+typedef void (*pointResolver)(struct data *record, int end, long double *x, long double *y);
+
+typedef struct mortonInterval {
+    uint64_t lo;
+    uint64_t hi;
+    /* Set when every point in the interval is known to lie within the query */
+    int contained;
+} mortonInterval;
+
+typedef struct LinearQuadTree {
+    rectangle2D *boundary;
+    mortonEntry *entries;
+    size_t numEntries;
+    size_t capacity;
+    int sorted;
+
+    /* Point coordinates in entry order, for the batch containment kernel */
+    double *xs;
+    double *ys;
+    /* Set when a point's coordinates are not exact doubles, forcing scalar tests */
+    int inexact;
+
+    /* Set when only codes and record references are kept, coordinates being recovered
+    through the resolver and neither points nor coordinate copies stored */
+    int compact;
+    pointResolver resolve;
+} LinearQuadTree;
+
+// function definitions
+
+/* Creates a new, empty linear quadtree covering the given root rectangle */
+LinearQuadTree *new_LinearQuadtree(rectangle2D *boundary);
+
+/* Switches an empty linear quadtree to compact mode, recovering coordinates with the resolver.
+Added points must belong to a record and are not kept, so the caller may free them; points
+returned by searches are only valid until the calling thread's next search */
+void linearSetCompact(LinearQuadTree *lqt, pointResolver resolve);
+
+/* Returns the Z-order code of a point relative to the root rectangle */
+uint64_t mortonCode(rectangle2D *boundary, point2D *point);
+
+/* Adds a point given with its 2D coordinates to the linear quadtree */
+int linearAddPoint(LinearQuadTree *lqt, point2D *point);
+
+/* Sorts any pending entries so the linear quadtree can be searched */
+void linearBuild(LinearQuadTree *lqt);
+
+/* Decomposes the query rectangle into ascending, merged Morton intervals, returning how many were written */
+size_t mortonDecompose(rectangle2D *boundary, rectangle2D *range, mortonInterval **intervals);
+
+/* Returns all datapoints lying within the query rectangle as a NULL-terminated array */
+point2D **linearSearchPoint(LinearQuadTree *lqt, rectangle2D *range, point2D *search);
+
+/* Returns the number of datapoints lying within the query rectangle, without collecting them */
+size_t linearRangeCount(LinearQuadTree *lqt, rectangle2D *range);
+
+/* Frees the linear quadtree, leaving the stored points and root rectangle to the caller */
+void freeLinearQuadtree(LinearQuadTree *lqt);
+
+/* Frees the points the calling thread's last compact search returned, which other threads
+free as they exit */
+void linearReleaseResults(void);
+
+#endif
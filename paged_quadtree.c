@@ -0,0 +1,623 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "paged_quadtree.h"
+#include "quadtree_template.h"
+#include "query_stats.h"
+#include "alloc_stats.h"
+
+#define PAGED_NONE UINT64_MAX
+#define SLOT_BITS 8
+#define INITIAL_POINTS (64)
+#define TEMP_TEMPLATE "/pr-quadtree-XXXXXX"
+
+/* Allocates and frees the nodes of trees being built, charged to the tree subsystem */
+static void *allocBuildNode(size_t size);
+static void freeBuildNode(void *node);
+
+QUADTREE_TEMPLATE(pagedBuildTree, long double, uintptr_t, QT_NODE_CAPACITY, PAGED_MAX_DEPTH,
+    allocBuildNode, freeBuildNode)
+
+/* A node as stored in a page. Its rectangle is not stored, being worked out from its parent's
+as the tree is walked; nodes are referred to by page number and slot within the page */
+typedef struct pagedNode {
+    long double xs[QT_NODE_CAPACITY];
+    long double ys[QT_NODE_CAPACITY];
+    /* Each point's record with the low bit set for its end point, as compact entries hold */
+    uintptr_t records[QT_NODE_CAPACITY];
+    /* Points stored in this node, its overflow nodes and all of its descendants */
+    uint64_t subtreeCount;
+    /* Non-empty children by quadrant (SW, NW, NE, SE) and the overflow node, or PAGED_NONE */
+    uint64_t child[4];
+    uint64_t overflow;
+    uint32_t count;
+} pagedNode;
+
+#define PAGE_NODES (PAGED_PAGE_SIZE / sizeof(pagedNode))
+
+_Static_assert(PAGE_NODES >= 1 && PAGE_NODES < (1 << SLOT_BITS), "page slots must fit a reference");
+
+/* A page held by the cache, linked into its hash bucket and the recency list */
+typedef struct pageFrame {
+    uint64_t page;
+    unsigned char *data;
+    /* Neighbours in recency order, most recent first */
+    struct pageFrame *newer;
+    struct pageFrame *older;
+    /* Next frame in the same hash bucket */
+    struct pageFrame *chain;
+} pageFrame;
+
+struct pageCache {
+    pageFrame *frames;
+    size_t numFrames;
+    size_t usedFrames;
+    pageFrame **buckets;
+    size_t numBuckets;
+    pageFrame *newest;
+    pageFrame *oldest;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t readaheads;
+    pthread_mutex_t lock;
+};
+
+/* A node still to be visited by a walk, with the rectangle worked out for it */
+typedef struct pagedVisit {
+    uint64_t ref;
+    long double cx, cy, hx, hy;
+    /* Quadrant of its parent the node lies in, or -1 for the root */
+    signed char quadrant;
+    /* Set when the node lies inside the query, so its points need no test */
+    unsigned char inside;
+} pagedVisit;
+
+/* Points a thread's last search returned, rebuilt from the nodes read */
+typedef struct pagedPoints {
+    size_t capacity;
+    point2D points[];
+} pagedPoints;
+
+static pthread_key_t pagedKey;
+static pthread_once_t pagedOnce = PTHREAD_ONCE_INIT;
+
+// Allocates a zeroed node charged to the tree subsystem
+static void *allocBuildNode(size_t size) {
+    return trackedCalloc(ALLOC_TREE, 1, size);
+}
+
+// Frees a node charged to the tree subsystem
+static void freeBuildNode(void *node) {
+    trackedFree(ALLOC_TREE, node);
+}
+
+// Creates a new, empty paged quadtree covering the given root rectangle
+PagedQuadTree *newPagedQuadtree(rectangle2D *boundary) {
+    PagedQuadTree *tree = (PagedQuadTree *)trackedMalloc(ALLOC_TREE, sizeof(PagedQuadTree));
+    assert(tree);
+
+    tree->boundary = boundary;
+    tree->building = pagedBuildTree_new(boundary->center->x, boundary->center->y,
+        boundary->x_half, boundary->y_half);
+    tree->path = NULL;
+    tree->fd = -1;
+    tree->cacheBytes = PAGED_DEFAULT_CACHE;
+    tree->cache = NULL;
+    tree->numPoints = 0;
+    tree->numNodes = 0;
+    tree->numPages = 0;
+    tree->depth = 0;
+
+    return tree;
+}
+
+// Opens an unnamed page file in the temporary directory, returning -1 if it cannot be made
+static int openTemporary(void) {
+    const char *dir = getenv("TMPDIR");
+    if (!dir || !*dir) {
+        dir = "/tmp";
+    }
+    char *path = (char *)trackedMalloc(ALLOC_TREE, strlen(dir) + strlen(TEMP_TEMPLATE) + 1);
+    assert(path);
+    strcpy(path, dir);
+    strcat(path, TEMP_TEMPLATE);
+
+    // The file is unlinked at once, so it goes when it is closed or the program ends
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    trackedFree(ALLOC_TREE, path);
+
+    return fd;
+}
+
+// Sets the file the tree's pages are written to and the size of its page cache
+int pagedSetStorage(PagedQuadTree *tree, const char *path, size_t cacheBytes) {
+    assert(tree->building);
+
+    if (cacheBytes > 0) {
+        tree->cacheBytes = cacheBytes;
+    }
+    if (!path) {
+        return 1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return 0;
+    }
+    if (tree->fd >= 0) {
+        close(tree->fd);
+    }
+    trackedFree(ALLOC_TREE, tree->path);
+    tree->fd = fd;
+    tree->path = trackedStrdup(ALLOC_TREE, path);
+    assert(tree->path);
+
+    return 1;
+}
+
+// Adds a point given with its 2D coordinates to the paged quadtree before it is built
+int pagedAddPoint(PagedQuadTree *tree, point2D *point) {
+    assert(tree->building && point->record && ((uintptr_t)point->record & 1) == 0);
+
+    uintptr_t ref = (uintptr_t)point->record | (point->end != 0);
+    if (!pagedBuildTree_insert(tree->building, point->x, point->y, ref)) {
+        return 0;
+    }
+    tree->numPoints++;
+
+    return 1;
+}
+
+// Returns the reference to a slot of a page
+static uint64_t nodeRef(uint64_t page, size_t slot) {
+    return (page << SLOT_BITS) | slot;
+}
+
+/* A node still to be written, with the field of the node linking to it */
+typedef struct pendingNode {
+    pagedBuildTree_node *node;
+    uint64_t parent;
+    /* Quadrant of the parent's child the node is, or 4 for its overflow node */
+    int link;
+} pendingNode;
+
+// Points the parent's link at the node's reference, in the page being filled if the parent is
+// in it, or else in the page file
+static void linkParent(PagedQuadTree *tree, pendingNode *pending, uint64_t ref,
+    unsigned char *page, uint64_t pageNumber) {
+
+    if (pending->parent == PAGED_NONE) {
+        return;
+    }
+    uint64_t parentPage = pending->parent >> SLOT_BITS;
+    size_t offset = (pending->parent & ((1 << SLOT_BITS) - 1)) * sizeof(pagedNode) +
+        (pending->link < 4 ? offsetof(pagedNode, child) + pending->link * sizeof(uint64_t) :
+        offsetof(pagedNode, overflow));
+
+    if (parentPage == pageNumber) {
+        memcpy(page + offset, &ref, sizeof(uint64_t));
+        return;
+    }
+    ssize_t written = pwrite(tree->fd, &ref, sizeof(uint64_t),
+        (off_t)(parentPage * PAGED_PAGE_SIZE + offset));
+    assert(written == sizeof(uint64_t));
+}
+
+// Writes the tree to its page file and frees the tree held in memory
+void pagedBuild(PagedQuadTree *tree) {
+    if (!tree->building) {
+        return;
+    }
+    if (tree->fd < 0) {
+        tree->fd = openTemporary();
+        assert(tree->fd >= 0);
+    }
+
+    unsigned char *page = (unsigned char *)trackedCalloc(ALLOC_TREE, 1, PAGED_PAGE_SIZE);
+    assert(page);
+    uint64_t pageNumber = 0;
+
+    // Nodes are written depth first, each followed by its overflow nodes and then its children
+    // in quadrant order, filling every page; each subtree so lies in a run of pages which a
+    // query over it reads in order. Links to a node are filled in once it is placed
+    pendingNode stack[4 * PAGED_MAX_DEPTH + 8];
+    int top = 0;
+    stack[top++] = (pendingNode){tree->building->root, PAGED_NONE, 0};
+
+    while (top > 0) {
+        pendingNode pending = stack[--top];
+        pagedBuildTree_node *node = pending.node;
+        size_t slot = tree->numNodes++ % PAGE_NODES;
+        if (slot == 0 && tree->numNodes > 1) {
+            ssize_t written = pwrite(tree->fd, page, PAGED_PAGE_SIZE,
+                (off_t)(pageNumber * PAGED_PAGE_SIZE));
+            assert(written == PAGED_PAGE_SIZE);
+            memset(page, 0, PAGED_PAGE_SIZE);
+            pageNumber++;
+        }
+        uint64_t ref = nodeRef(pageNumber, slot);
+        linkParent(tree, &pending, ref, page, pageNumber);
+
+        pagedNode *out = (pagedNode *)page + slot;
+        out->count = node->count;
+        out->subtreeCount = node->subtreeCount;
+        for (unsigned i = 0; i < node->count; i++) {
+            out->xs[i] = node->xs[i];
+            out->ys[i] = node->ys[i];
+            out->records[i] = node->items[i];
+        }
+        out->overflow = PAGED_NONE;
+        for (int q = 0; q < 4; q++) {
+            out->child[q] = PAGED_NONE;
+        }
+
+        for (int q = 3; q >= 0; q--) {
+            if (node->child[q] && node->child[q]->subtreeCount > 0) {
+                stack[top++] = (pendingNode){node->child[q], ref, q};
+            }
+        }
+        if (node->overflow) {
+            stack[top++] = (pendingNode){node->overflow, ref, 4};
+        }
+    }
+
+    ssize_t written = pwrite(tree->fd, page, PAGED_PAGE_SIZE, (off_t)(pageNumber * PAGED_PAGE_SIZE));
+    assert(written == PAGED_PAGE_SIZE);
+    tree->numPages = pageNumber + 1;
+    tree->depth = tree->building->depth;
+    trackedFree(ALLOC_TREE, page);
+    pagedBuildTree_free(tree->building, NULL);
+    tree->building = NULL;
+
+    // The cache holds at least one page, and never more than the file has
+    size_t numFrames = tree->cacheBytes / PAGED_PAGE_SIZE;
+    numFrames = numFrames < 1 ? 1 : numFrames;
+    numFrames = numFrames > tree->numPages ? tree->numPages : numFrames;
+
+    pageCache *cache = (pageCache *)trackedCalloc(ALLOC_TREE, 1, sizeof(pageCache));
+    assert(cache);
+    cache->numFrames = numFrames;
+    cache->frames = (pageFrame *)trackedCalloc(ALLOC_TREE, numFrames, sizeof(pageFrame));
+    cache->numBuckets = 1;
+    while (cache->numBuckets < 2 * numFrames) {
+        cache->numBuckets *= 2;
+    }
+    cache->buckets = (pageFrame **)trackedCalloc(ALLOC_TREE, cache->numBuckets,
+        sizeof(pageFrame *));
+    assert(cache->frames && cache->buckets);
+    pthread_mutex_init(&cache->lock, NULL);
+    tree->cache = cache;
+}
+
+// Returns the cached frame holding the page, or NULL
+static pageFrame *findFrame(pageCache *cache, uint64_t page) {
+    pageFrame *frame = cache->buckets[page & (cache->numBuckets - 1)];
+    while (frame && frame->page != page) {
+        frame = frame->chain;
+    }
+    return frame;
+}
+
+// Takes a frame out of the recency list
+static void unlinkFrame(pageCache *cache, pageFrame *frame) {
+    if (frame->newer) {
+        frame->newer->older = frame->older;
+    } else {
+        cache->newest = frame->older;
+    }
+    if (frame->older) {
+        frame->older->newer = frame->newer;
+    } else {
+        cache->oldest = frame->newer;
+    }
+}
+
+// Puts a frame at the most recently used end of the recency list
+static void linkNewest(pageCache *cache, pageFrame *frame) {
+    frame->newer = NULL;
+    frame->older = cache->newest;
+    if (cache->newest) {
+        cache->newest->newer = frame;
+    } else {
+        cache->oldest = frame;
+    }
+    cache->newest = frame;
+}
+
+// Returns a frame to read a page into: an unused one, or the least recently used one evicted
+static pageFrame *takeFrame(pageCache *cache) {
+    if (cache->usedFrames < cache->numFrames) {
+        pageFrame *frame = &cache->frames[cache->usedFrames++];
+        frame->data = (unsigned char *)trackedMalloc(ALLOC_TREE, PAGED_PAGE_SIZE);
+        assert(frame->data);
+        return frame;
+    }
+
+    pageFrame *frame = cache->oldest;
+    pageFrame **link = &cache->buckets[frame->page & (cache->numBuckets - 1)];
+    while (*link != frame) {
+        link = &(*link)->chain;
+    }
+    *link = frame->chain;
+    unlinkFrame(cache, frame);
+    cache->evictions++;
+
+    return frame;
+}
+
+// Copies the node at the reference out of its page, reading the page in if it is not cached
+static void readNode(PagedQuadTree *tree, uint64_t ref, pagedNode *out) {
+    pageCache *cache = tree->cache;
+    uint64_t page = ref >> SLOT_BITS;
+
+    pthread_mutex_lock(&cache->lock);
+    pageFrame *frame = findFrame(cache, page);
+    if (frame) {
+        cache->hits++;
+        unlinkFrame(cache, frame);
+    } else {
+        cache->misses++;
+        frame = takeFrame(cache);
+        ssize_t got = pread(tree->fd, frame->data, PAGED_PAGE_SIZE,
+            (off_t)(page * PAGED_PAGE_SIZE));
+        assert(got == PAGED_PAGE_SIZE);
+        frame->page = page;
+        frame->chain = cache->buckets[page & (cache->numBuckets - 1)];
+        cache->buckets[page & (cache->numBuckets - 1)] = frame;
+    }
+    linkNewest(cache, frame);
+    memcpy(out, frame->data + (ref & ((1 << SLOT_BITS) - 1)) * sizeof(pagedNode),
+        sizeof(pagedNode));
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Asks the kernel to start reading a page a walk is about to visit, unless it is cached
+static void readAhead(PagedQuadTree *tree, uint64_t ref) {
+    pageCache *cache = tree->cache;
+    uint64_t page = ref >> SLOT_BITS;
+
+    pthread_mutex_lock(&cache->lock);
+    int cached = findFrame(cache, page) != NULL;
+    if (!cached) {
+        cache->readaheads++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (!cached) {
+        posix_fadvise(tree->fd, (off_t)(page * PAGED_PAGE_SIZE), PAGED_PAGE_SIZE,
+            POSIX_FADV_WILLNEED);
+    }
+}
+
+// Frees a thread's result points as it exits
+static void freePagedPoints(void *points) {
+    trackedFree(ALLOC_QUERY, points);
+}
+
+// Creates the key of each thread's result points, which are freed as the thread exits
+static void createPagedKey(void) {
+    int created = pthread_key_create(&pagedKey, freePagedPoints);
+    assert(created == 0);
+}
+
+// Adds the node's points picked by the mask to the calling thread's result points
+static void collectPoints(pagedNode *node, unsigned hits, pagedPoints **points, size_t *count) {
+    while (hits) {
+        int i = __builtin_ctz(hits);
+        hits &= hits - 1;
+        if (!*points || (*points)->capacity <= *count) {
+            size_t capacity = *points ? 2 * (*points)->capacity : INITIAL_POINTS;
+            *points = (pagedPoints *)trackedRealloc(ALLOC_QUERY, *points,
+                sizeof(pagedPoints) + sizeof(point2D) * capacity);
+            assert(*points);
+            (*points)->capacity = capacity;
+            pthread_setspecific(pagedKey, *points);
+        }
+        point2D *point = &(*points)->points[(*count)++];
+        point->x = node->xs[i];
+        point->y = node->ys[i];
+        point->record = (struct data *)(node->records[i] & ~(uintptr_t)1);
+        point->end = node->records[i] & 1;
+    }
+}
+
+// Returns a mask with bit i set when the node's point i lies within the query's edges
+static unsigned nodeHits(pagedNode *node, long double minX, long double minY, long double maxX,
+    long double maxY) {
+
+    unsigned hits = 0;
+    for (unsigned i = 0; i < node->count; i++) {
+        hits |= (unsigned)((node->xs[i] >= minX) & (node->xs[i] <= maxX) &
+            (node->ys[i] >= minY) & (node->ys[i] <= maxY)) << i;
+    }
+    QUERY_STAT_ADD(pointsExamined, node->count);
+    QUERY_STAT_ADD(inRectangleTests, node->count);
+    return hits;
+}
+
+// Pushes the children of a node which the walk must visit, last quadrant first so they are
+// visited in quadrant order, reading ahead those on other pages
+static void pushChildren(PagedQuadTree *tree, pagedVisit *visit, pagedNode *node, int whole,
+    long double minX, long double minY, long double maxX, long double maxY,
+    pagedVisit *stack, int *top) {
+
+    long double hx = visit->hx / 2;
+    long double hy = visit->hy / 2;
+    for (int q = 3; q >= 0; q--) {
+        if (node->child[q] == PAGED_NONE) {
+            continue;
+        }
+        int east = q >= 2;
+        int north = q == 1 || q == 2;
+        long double cx = east ? visit->cx + hx : visit->cx - hx;
+        long double cy = north ? visit->cy + hy : visit->cy - hy;
+        if (!whole && (cx + hx < minX || cx - hx > maxX || cy + hy < minY || cy - hy > maxY)) {
+            continue;
+        }
+        if (node->child[q] >> SLOT_BITS != visit->ref >> SLOT_BITS) {
+            readAhead(tree, node->child[q]);
+        }
+        pagedVisit *child = &stack[(*top)++];
+        child->ref = node->child[q];
+        child->cx = cx;
+        child->cy = cy;
+        child->hx = hx;
+        child->hy = hy;
+        child->quadrant = (signed char)q;
+        child->inside = (unsigned char)whole;
+    }
+}
+
+// Returns all datapoints lying within the query rectangle as a NULL-terminated array
+point2D **pagedRangeQuery(PagedQuadTree *tree, rectangle2D *range, FILE *summaryFile) {
+    assert(tree->cache);
+    long double minX = range->center->x - range->x_half;
+    long double maxX = range->center->x + range->x_half;
+    long double minY = range->center->y - range->y_half;
+    long double maxY = range->center->y + range->y_half;
+
+    pthread_once(&pagedOnce, createPagedKey);
+    pagedPoints *points = (pagedPoints *)pthread_getspecific(pagedKey);
+    size_t count = 0;
+
+    pagedVisit stack[3 * PAGED_MAX_DEPTH + 4];
+    int top = 0;
+    stack[top++] = (pagedVisit){0, tree->boundary->center->x, tree->boundary->center->y,
+        tree->boundary->x_half, tree->boundary->y_half, -1, 0};
+
+    while (top > 0) {
+        pagedVisit visit = stack[--top];
+        if (summaryFile && visit.quadrant >= 0) {
+            fprintf(summaryFile, " %s", quadrantName(visit.quadrant + 1));
+        }
+        QUERY_STAT_ADD(nodesVisited, 1);
+
+        // Nodes inside the query are emitted whole, without testing their points
+        int whole = visit.inside || (visit.cx - visit.hx >= minX && visit.cx + visit.hx <= maxX &&
+            visit.cy - visit.hy >= minY && visit.cy + visit.hy <= maxY);
+        pagedNode node;
+        readNode(tree, visit.ref, &node);
+        collectPoints(&node, whole ? (1u << node.count) - 1 :
+            nodeHits(&node, minX, minY, maxX, maxY), &points, &count);
+        pagedNode overflow = node;
+        while (overflow.overflow != PAGED_NONE) {
+            readNode(tree, overflow.overflow, &overflow);
+            collectPoints(&overflow, whole ? (1u << overflow.count) - 1 :
+                nodeHits(&overflow, minX, minY, maxX, maxY), &points, &count);
+        }
+        pushChildren(tree, &visit, &node, whole, minX, minY, maxX, maxY, stack, &top);
+    }
+
+    point2D **result = (point2D **)trackedMalloc(ALLOC_QUERY, sizeof(point2D *) * (count + 1));
+    assert(result);
+    for (size_t i = 0; i < count; i++) {
+        result[i] = &points->points[i];
+    }
+    result[count] = NULL;
+    QUERY_STAT_ADD(pointsReturned, count);
+
+    return result;
+}
+
+// Returns the number of datapoints lying within the query rectangle
+size_t pagedRangeCount(PagedQuadTree *tree, rectangle2D *range) {
+    assert(tree->cache);
+    long double minX = range->center->x - range->x_half;
+    long double maxX = range->center->x + range->x_half;
+    long double minY = range->center->y - range->y_half;
+    long double maxY = range->center->y + range->y_half;
+
+    pagedVisit stack[3 * PAGED_MAX_DEPTH + 4];
+    int top = 0;
+    stack[top++] = (pagedVisit){0, tree->boundary->center->x, tree->boundary->center->y,
+        tree->boundary->x_half, tree->boundary->y_half, -1, 0};
+    size_t found = 0;
+
+    while (top > 0) {
+        pagedVisit visit = stack[--top];
+        pagedNode node;
+        readNode(tree, visit.ref, &node);
+
+        // Nodes inside the query contribute their whole subtree
+        if (visit.cx - visit.hx >= minX && visit.cx + visit.hx <= maxX &&
+            visit.cy - visit.hy >= minY && visit.cy + visit.hy <= maxY) {
+            found += node.subtreeCount;
+            continue;
+        }
+
+        pagedNode overflow = node;
+        found += __builtin_popcount(nodeHits(&node, minX, minY, maxX, maxY));
+        while (overflow.overflow != PAGED_NONE) {
+            readNode(tree, overflow.overflow, &overflow);
+            found += __builtin_popcount(nodeHits(&overflow, minX, minY, maxX, maxY));
+        }
+        pushChildren(tree, &visit, &node, 0, minX, minY, maxX, maxY, stack, &top);
+    }
+    QUERY_STAT_ADD(pointsReturned, found);
+
+    return found;
+}
+
+// Prints the paged quadtree's size and page cache counters
+void printPagedQuadtreeStats(PagedQuadTree *tree, FILE *f) {
+    fprintf(f, "points: %zu\n", tree->numPoints);
+    fprintf(f, "nodes: %zu\n", tree->numNodes);
+    fprintf(f, "max_depth: %d\n", tree->depth);
+    fprintf(f, "pages: %zu\n", tree->numPages);
+    fprintf(f, "page_size: %d\n", PAGED_PAGE_SIZE);
+    fprintf(f, "nodes_per_page: %zu\n", (size_t)PAGE_NODES);
+    fprintf(f, "bytes_file: %zu\n", tree->numPages * PAGED_PAGE_SIZE);
+    if (!tree->cache) {
+        return;
+    }
+
+    pageCache *cache = tree->cache;
+    pthread_mutex_lock(&cache->lock);
+    fprintf(f, "cache_pages: %zu\n", cache->numFrames);
+    fprintf(f, "cache_hits: %zu\n", cache->hits);
+    fprintf(f, "cache_misses: %zu\n", cache->misses);
+    fprintf(f, "cache_evictions: %zu\n", cache->evictions);
+    fprintf(f, "cache_readaheads: %zu\n", cache->readaheads);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Frees the paged quadtree and its cache, closing its page file
+void freePagedQuadtree(PagedQuadTree *tree) {
+    if (!tree) {
+        return;
+    }
+
+    if (tree->building) {
+        pagedBuildTree_free(tree->building, NULL);
+    }
+    if (tree->cache) {
+        for (size_t i = 0; i < tree->cache->usedFrames; i++) {
+            trackedFree(ALLOC_TREE, tree->cache->frames[i].data);
+        }
+        trackedFree(ALLOC_TREE, tree->cache->frames);
+        trackedFree(ALLOC_TREE, tree->cache->buckets);
+        pthread_mutex_destroy(&tree->cache->lock);
+        trackedFree(ALLOC_TREE, tree->cache);
+    }
+    if (tree->fd >= 0) {
+        close(tree->fd);
+    }
+    trackedFree(ALLOC_TREE, tree->path);
+    trackedFree(ALLOC_TREE, tree);
+}
+
+// Frees the points the calling thread's last search returned
+void pagedReleaseResults(void) {
+    pthread_once(&pagedOnce, createPagedKey);
+    freePagedPoints(pthread_getspecific(pagedKey));
+    pthread_setspecific(pagedKey, NULL);
+}
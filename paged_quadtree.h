@@ -0,0 +1,81 @@
+#ifndef PAGED_QUADTREE_H
+#define PAGED_QUADTREE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "quadtree.h"
+
+/* Bytes per page of the page file, each holding as many whole nodes as fit */
+#define PAGED_PAGE_SIZE (16384)
+
+/* Page cache size when none is given */
+#define PAGED_DEFAULT_CACHE (16 << 20)
+
+/* Depth below which nodes stop splitting, as in the specialised engine */
+#define PAGED_MAX_DEPTH (64)
+
+// data definitions
+
+/* Least recently used cache of the pages read from a page file */
+typedef struct pageCache pageCache;
+
+/* Tree the points are inserted into until it is written out as pages, defined in paged_quadtree.c */
+struct pagedBuildTree;
+
+/* PR quadtree queried from an on-disk layout: points are inserted into a tree in memory, which
+is written to the page file once built and freed, nodes then being read through the page cache.
+Only the nodes leave memory; the tree is whole in memory while it is built, and the records its
+points refer to stay in the dictionary. Like the compact engine, it keeps no points of its own,
+only their coordinates and records */
+typedef struct PagedQuadTree {
+    rectangle2D *boundary;
+    struct pagedBuildTree *building;
+    /* Page file, named by path or unlinked at once if created in the temporary directory */
+    char *path;
+    int fd;
+    size_t cacheBytes;
+    pageCache *cache;
+    size_t numPoints;
+    size_t numNodes;
+    size_t numPages;
+    int depth;
+} PagedQuadTree;
+
+// function definitions
+
+/* Creates a new, empty paged quadtree covering the given root rectangle, written to a temporary
+file with a PAGED_DEFAULT_CACHE page cache unless pagedSetStorage says otherwise */
+PagedQuadTree *newPagedQuadtree(rectangle2D *boundary);
+
+/* Writes the tree's pages to the file at path (created or truncated), and caches at most
+cacheBytes of them (or PAGED_DEFAULT_CACHE given 0); path may be NULL for a temporary file.
+Call before the tree is built; returns 0 (FALSE) if the file cannot be opened */
+int pagedSetStorage(PagedQuadTree *tree, const char *path, size_t cacheBytes);
+
+/* Adds a point given with its 2D coordinates to the paged quadtree before it is built; the point
+must belong to a record, and is not kept so the caller may free it */
+int pagedAddPoint(PagedQuadTree *tree, point2D *point);
+
+/* Writes the tree to its page file depth first, so every page is full and each subtree lies in a
+run of consecutive pages, and frees the tree held in memory */
+void pagedBuild(PagedQuadTree *tree);
+
+/* Returns all datapoints lying within the query rectangle as a NULL-terminated array, in the
+order rangeQuery returns them, printing each quadrant explored to the summary file (if given)
+as rangeQuery does. Points are only valid until the calling thread's next search. Safe to call
+from several threads at once */
+point2D **pagedRangeQuery(PagedQuadTree *tree, rectangle2D *range, FILE *summaryFile);
+
+/* Returns the number of datapoints lying within the query rectangle, without collecting them */
+size_t pagedRangeCount(PagedQuadTree *tree, rectangle2D *range);
+
+/* Prints the paged quadtree's size and page cache counters as one "name: value" pair per line */
+void printPagedQuadtreeStats(PagedQuadTree *tree, FILE *f);
+
+/* Frees the paged quadtree and its cache, closing its page file */
+void freePagedQuadtree(PagedQuadTree *tree);
+
+/* Frees the points the calling thread's last search returned */
+void pagedReleaseResults(void);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef PARSE_DOUBLE_H
+#define PARSE_DOUBLE_H
+
+// function definitions
+
+/* Parses a decimal number at the start of the string exactly as strtod would, returning its
+correctly rounded value and setting end (if given) past the characters used. Plain decimals
+are parsed with the Eisel-Lemire algorithm; anything else is handed to strtod */
+double parseDouble(const char *str, char **end);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "pipeline.h"
+#include "read.h"
+#include "alloc_stats.h"
+
+// data definitions
+
+/* Bounded first-in first-out queue handing items from one thread to another */
+typedef struct pipeRing {
+    void *slots[PIPELINE_RING_SIZE];
+    size_t head;
+    size_t count;
+    /* Set once no more items will be pushed */
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+} pipeRing;
+
+/* What one query wrote to each output stream */
+typedef struct pipelineReply {
+    char *summary;
+    size_t summaryLen;
+    char *output;
+    size_t outputLen;
+} pipelineReply;
+
+typedef struct pipelineState {
+    FILE *in;
+    FILE *summaryFile;
+    FILE *outputFile;
+    pipeRing queries;
+    pipeRing replies;
+} pipelineState;
+
+// Sets up an empty ring
+static void ringInit(pipeRing *ring) {
+    ring->head = 0;
+    ring->count = 0;
+    ring->closed = 0;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->notEmpty, NULL);
+    pthread_cond_init(&ring->notFull, NULL);
+}
+
+// Adds an item to the back of the ring, waiting while it is full
+static void ringPush(pipeRing *ring, void *item) {
+    pthread_mutex_lock(&ring->lock);
+    while (ring->count == PIPELINE_RING_SIZE) {
+        pthread_cond_wait(&ring->notFull, &ring->lock);
+    }
+
+    ring->slots[(ring->head + ring->count) % PIPELINE_RING_SIZE] = item;
+    ring->count++;
+    pthread_cond_signal(&ring->notEmpty);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+// Takes the item at the front of the ring, waiting while it is empty; returns NULL
+// once the ring is closed and empty
+static void *ringPop(pipeRing *ring) {
+    pthread_mutex_lock(&ring->lock);
+    while (ring->count == 0 && !ring->closed) {
+        pthread_cond_wait(&ring->notEmpty, &ring->lock);
+    }
+
+    void *item = NULL;
+    if (ring->count > 0) {
+        item = ring->slots[ring->head];
+        ring->head = (ring->head + 1) % PIPELINE_RING_SIZE;
+        ring->count--;
+        pthread_cond_signal(&ring->notFull);
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    return item;
+}
+
+// Marks the ring as having no more items, waking its consumer
+static void ringClose(pipeRing *ring) {
+    pthread_mutex_lock(&ring->lock);
+    ring->closed = 1;
+    pthread_cond_broadcast(&ring->notEmpty);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+// Frees a ring's synchronisation state
+static void ringDestroy(pipeRing *ring) {
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->notEmpty);
+    pthread_cond_destroy(&ring->notFull);
+}
+
+// Reads query lines ahead of the query stage
+static void *pipelineReader(void *p) {
+    pipelineState *state = (pipelineState *)p;
+
+    char *query;
+    while ((query = getQuery(state->in))) {
+        ringPush(&state->queries, query);
+    }
+    ringClose(&state->queries);
+
+    return NULL;
+}
+
+// Writes replies behind the query stage, in the order the queries were read
+static void *pipelineWriter(void *p) {
+    pipelineState *state = (pipelineState *)p;
+
+    pipelineReply *reply;
+    while ((reply = (pipelineReply *)ringPop(&state->replies))) {
+        fwrite(reply->output, 1, reply->outputLen, state->outputFile);
+        fwrite(reply->summary, 1, reply->summaryLen, state->summaryFile);
+        trackedFree(ALLOC_QUERY, reply->output);
+        trackedFree(ALLOC_QUERY, reply->summary);
+        trackedFree(ALLOC_QUERY, reply);
+    }
+    fflush(state->outputFile);
+    fflush(state->summaryFile);
+
+    return NULL;
+}
+
+// Answers every query line of the input with reader and writer threads overlapping the I/O
+void runPipeline(FILE *in, FILE *summaryFile, FILE *outputFile, queryAnswerer answer, void *arg) {
+    pipelineState state;
+    state.in = in;
+    state.summaryFile = summaryFile;
+    state.outputFile = outputFile;
+    ringInit(&state.queries);
+    ringInit(&state.replies);
+
+    setvbuf(summaryFile, NULL, _IOFBF, PIPELINE_BUFFER_SIZE);
+    setvbuf(outputFile, NULL, _IOFBF, PIPELINE_BUFFER_SIZE);
+
+    pthread_t reader, writer;
+    int created = pthread_create(&reader, NULL, pipelineReader, &state);
+    assert(created == 0);
+    created = pthread_create(&writer, NULL, pipelineWriter, &state);
+    assert(created == 0);
+
+    // Each query writes into memory, leaving the writer thread to do the stream I/O
+    char *query;
+    while ((query = (char *)ringPop(&state.queries))) {
+        pipelineReply *reply = (pipelineReply *)trackedMalloc(ALLOC_QUERY, sizeof(pipelineReply));
+        assert(reply);
+        FILE *summary = open_memstream(&reply->summary, &reply->summaryLen);
+        FILE *output = open_memstream(&reply->output, &reply->outputLen);
+        assert(summary && output);
+
+        answer(query, summary, output, arg);
+        fclose(summary);
+        fclose(output);
+        trackedAdopt(ALLOC_QUERY, reply->summary);
+        trackedAdopt(ALLOC_QUERY, reply->output);
+        trackedFree(ALLOC_QUERY, query);
+
+        ringPush(&state.replies, reply);
+    }
+    ringClose(&state.replies);
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    ringDestroy(&state.queries);
+    ringDestroy(&state.replies);
+}
@@ -0,0 +1,25 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+
+/* Query lines (and replies) waiting between pipeline stages */
+#define PIPELINE_RING_SIZE 256
+
+/* Buffer size of each output stream while the pipeline writes to it */
+#define PIPELINE_BUFFER_SIZE (1 << 20)
+
+// data definitions
+
+/* Answers one query line, writing to the summary and output files */
+typedef void (*queryAnswerer)(char *query, FILE *summaryFile, FILE *outputFile, void *arg);
+
+// function definitions
+
+/* Answers every query line of the input in order, as if each were answered in turn and written
+straight to the summary and output files, but with a reader thread reading ahead and a writer
+thread writing behind the calling thread answering them. Call before anything is written to
+either output stream, as their buffers are enlarged. */
+void runPipeline(FILE *in, FILE *summaryFile, FILE *outputFile, queryAnswerer answer, void *arg);
+
+#endif
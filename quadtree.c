@@ -2,22 +2,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <assert.h>
 #include "dictionary.h"
-
-#define QT_NODE_CAPACITY (4)
-#define MAX_ARRAY_SIZE (1024)
+#include "query_stats.h"
+#include "contain_kernel.h"
+#include "alloc_stats.h"
 
 // Creates a point using given coordinates and stores their values
 point2D *create_point(long double x, long double y) {
-    point2D *p = (point2D *)malloc(sizeof(point2D));
+    point2D *p = (point2D *)trackedMalloc(ALLOC_TREE, sizeof(point2D));
     p->x = x;
     p->y = y;
+    p->record = NULL;
+    p->end = 0;
     return p;
 }
 
+// Frees a point created with create_point
+void freePoint(point2D *point) {
+    trackedFree(ALLOC_TREE, point);
+}
+
 // Specifies a rectangle given bottom-left 2D point and an upper right 2D point
 rectangle2D *create_rectangle(point2D *center, long double x_half, long double y_half) {
-    rectangle2D *rectangle = (rectangle2D *)malloc(sizeof(rectangle2D));
+    rectangle2D *rectangle = (rectangle2D *)trackedMalloc(ALLOC_TREE, sizeof(rectangle2D));
 
     // Center point of the rectangle
     rectangle->center = center;
@@ -29,8 +37,18 @@ rectangle2D *create_rectangle(point2D *center, long double x_half, long double y
     return rectangle;
 }
 
+// Frees a rectangle and its center point
+void freeRectangle(rectangle2D *rectangle) {
+    if (!rectangle) {
+        return;
+    }
+    freePoint(rectangle->center);
+    trackedFree(ALLOC_TREE, rectangle);
+}
+
 // Tests whether a given 2D point lies within the rectangle and returns 1 (TRUE) if it does
 int inRectangle(rectangle2D *boundary, point2D *point) {
+    QUERY_STAT_ADD(inRectangleTests, 1);
     
     // Check if x coordinate of point lies within the rectangle boundary
     if (point->x < boundary->center->x - boundary->x_half || point->x > boundary->center->x + boundary->x_half) {
@@ -47,38 +65,40 @@ int inRectangle(rectangle2D *boundary, point2D *point) {
     return 1;
 }
 
-// Returns the quadrant of the rectangle that the point lies in 
-int determineQuadrant(rectangle2D *range, point2D *point,FILE *summaryFile) {
+// Returns the quadrant of the rectangle that the point lies in, without printing it
+int quadrantOf(rectangle2D *range, point2D *point) {
 
-    // South-West Quadrant
-    if (point->x <= range->center->x && point->y < range->center->y) {
+    // Points on the vertical centre line belong to the western quadrants,
+    // points on the horizontal centre line to the northern ones
+    int east = point->x > range->center->x;
+    int north = point->y >= range->center->y;
 
-        fprintf(summaryFile, "SW\n");
-        return 1;
+    // South-West 1, North-West 2, North-East 3, South-East 4
+    if (east) {
+        return north ? 3 : 4;
     }
 
-    // North-West Quadrant
-    if (point->x <= range->center->x && point->y >= range->center->y) {
+    return north ? 2 : 1;
+}
 
-        fprintf(summaryFile, "NW\n");
-        return 2;
-    }
+// Returns the quadrant of the rectangle that the point lies in 
+int determineQuadrant(rectangle2D *range, point2D *point,FILE *summaryFile) {
+    int quadrant = quadrantOf(range, point);
 
-    // North-East Quadrant
-    if (point->x > range->center->x && point->y >= range->center->y) {
+    fprintf(summaryFile, "%s\n", quadrantName(quadrant));
 
-        fprintf(summaryFile, "NE\n");
-        return 3;
-    }
+    return quadrant;
+}
 
-    // South-East Quadrant
-    if (point->x > range->center->x && point->y < range->center->y) {
+// Returns the name of a quadrant numbered as in determineQuadrant
+const char *quadrantName(int quadrant) {
+    static const char *names[] = {"", "SW", "NW", "NE", "SE"};
 
-        fprintf(summaryFile, "SE\n");
-        return 4;
+    if (quadrant < 1 || quadrant > 4) {
+        return names[0];
     }
 
-    return 0;
+    return names[quadrant];
 }
 
 // Adds a point given with its 2D coordinates to the quadtree
@@ -95,6 +115,18 @@ int addPoint(QuadTree *root, point2D *point) {
     // Add points as leaf nodes to an internal node
     if (points_size < QT_NODE_CAPACITY && root->NW == NULL) {
         root->points[points_size] = point;
+        root->xs[points_size] = (double)point->x;
+        root->ys[points_size] = (double)point->y;
+        if (!exactAsDouble(point)) {
+            root->inexact = 1;
+        }
+        root->subtreePoints++;
+        if (root->agg) {
+            aggregateAddPoint(root->agg, root->aggSpec, point);
+        }
+        if (root->summary) {
+            aggregateAddPoint(root->summary, root->summarySpec, point);
+        }
         return 1;
     }
 
@@ -104,50 +136,82 @@ int addPoint(QuadTree *root, point2D *point) {
     }
 
     // Recursively adds points to each quadrant of the root node
-    if (addPoint(root->NW, point)) return 1;
-    if (addPoint(root->NE, point)) return 1;
-    if (addPoint(root->SW, point)) return 1;
-    if (addPoint(root->SE, point)) return 1;
+    if (addPoint(root->NW, point) || addPoint(root->NE, point) ||
+        addPoint(root->SW, point) || addPoint(root->SE, point)) {
+        root->subtreePoints++;
+        if (root->agg) {
+            aggregateAddPoint(root->agg, root->aggSpec, point);
+        }
+        if (root->summary) {
+            aggregateAddPoint(root->summary, root->summarySpec, point);
+        }
+        return 1;
+    }
 
     return 0;
 }
 
 // Tests whether two rectangles overlap and returns 1 (TRUE) if they do 
 int rectangleOverlap(rectangle2D *self, rectangle2D *other) {
+    QUERY_STAT_ADD(overlapTests, 1);
     
     // Check if x-coordinates of one rectangle lie beyond the x-coordinates of the other rectangle 
-    if (self->center->x + self->x_half > other->center->x - other->x_half) {
-        return 1;
+    if (self->center->x + self->x_half < other->center->x - other->x_half) {
+        return 0;
     }
 
-    if (self->center->x - self->x_half < other->center->x + other->x_half) {
-        return 1;
+    if (self->center->x - self->x_half > other->center->x + other->x_half) {
+        return 0;
     }
 
     // Check if y-coordinates of one rectangle lie beyond the y-coordinates of the other rectangle 
-    if (self->center->y + self->y_half > other->center->y - other->y_half) {
-        return 1;
+    if (self->center->y + self->y_half < other->center->y - other->y_half) {
+        return 0;
     }
 
-    if (self->center->y - self->y_half < other->center->y + other->y_half) {
-        return 1;
+    if (self->center->y - self->y_half > other->center->y + other->y_half) {
+        return 0;
     }
 
-    return 0;
+    return 1;
 }
 
+// Tests whether the inner rectangle lies entirely within the outer rectangle and returns 1 (TRUE) if it does
+int rectangleContains(rectangle2D *outer, rectangle2D *inner) {
+    QUERY_STAT_ADD(overlapTests, 1);
+
+    // Compared with the same expressions inRectangle uses, so every point inside
+    // the inner rectangle is guaranteed to pass inRectangle on the outer one
+    if (inner->center->x - inner->x_half < outer->center->x - outer->x_half ||
+        inner->center->x + inner->x_half > outer->center->x + outer->x_half) {
+        return 0;
+    }
+
+    if (inner->center->y - inner->y_half < outer->center->y - outer->y_half ||
+        inner->center->y + inner->y_half > outer->center->y + outer->y_half) {
+        return 0;
+    }
+
+    return 1;
+}
 
 // Creates a new QuadTree given the 2D coordinates of its upper left and bottom right points of its root node
 QuadTree *new_Quadtree(rectangle2D *boundary) {
-    QuadTree *qt = (QuadTree *)malloc(sizeof(QuadTree));
+    QuadTree *qt = (QuadTree *)trackedMalloc(ALLOC_TREE, sizeof(QuadTree));
     qt->NE = NULL;
     qt->NW = NULL;
     qt->SE = NULL;
     qt->SW = NULL;
 
     qt->boundary = boundary;
+    qt->inexact = 0;
+    qt->subtreePoints = 0;
+    qt->aggSpec = NULL;
+    qt->agg = NULL;
+    qt->summarySpec = NULL;
+    qt->summary = NULL;
 
-    qt->points = (point2D **)malloc(sizeof(point2D*) * QT_NODE_CAPACITY);
+    qt->points = (point2D **)trackedMalloc(ALLOC_TREE, sizeof(point2D*) * QT_NODE_CAPACITY);
 
     for (size_t i = 0; i < QT_NODE_CAPACITY; i++)
     {
@@ -193,14 +257,79 @@ QuadTree *create_quadNode(QuadTree *root) {
     point2D *se_p = create_point(root->boundary->center->x + new_Xhalf, root->boundary->center->y - new_Yhalf);
     root->SE = new_Quadtree(create_rectangle(se_p, new_Xhalf, new_Yhalf));
 
+    // Children keep summaries whenever their parent does
+    if (root->aggSpec) {
+        enableAggregates(root->NW, root->aggSpec);
+        enableAggregates(root->NE, root->aggSpec);
+        enableAggregates(root->SW, root->aggSpec);
+        enableAggregates(root->SE, root->aggSpec);
+    }
+    if (root->summarySpec) {
+        enableSummaries(root->NW, root->summarySpec);
+        enableSummaries(root->NE, root->summarySpec);
+        enableSummaries(root->SW, root->summarySpec);
+        enableSummaries(root->SE, root->summarySpec);
+    }
+
     return root;
 }
 
+// Frees a node, its children and every point stored under it, leaving the root rectangle
+// (given to new_Quadtree by the caller) to the caller
+static void freeNode(QuadTree *node, int isRoot) {
+    if (node->NW) {
+        freeNode(node->NW, 0);
+        freeNode(node->NE, 0);
+        freeNode(node->SW, 0);
+        freeNode(node->SE, 0);
+    }
+
+    // Each point is stored in just one node
+    size_t points_size = QuadTree_points_size(node->points);
+    for (size_t i = 0; i < points_size; i++) {
+        freePoint(node->points[i]);
+    }
+    trackedFree(ALLOC_TREE, node->points);
+    trackedFree(ALLOC_TREE, node->agg);
+    trackedFree(ALLOC_TREE, node->summary);
+    if (!isRoot) {
+        freeRectangle(node->boundary);
+    }
+    trackedFree(ALLOC_TREE, node);
+}
+
+// Frees the quadtree and every point added to it, leaving the root rectangle to the caller
+void freeQuadtree(QuadTree *root) {
+    if (!root) {
+        return;
+    }
+    freeNode(root, 1);
+}
+
+_Static_assert(QT_NODE_CAPACITY <= CONTAIN_BATCH, "a node's points must fit one containment batch");
+
+// Returns a mask with bit i set when the node's point i lies within the query rectangle
+static uint64_t nodeHits(QuadTree *node, rectangle2D *range, containBounds *bounds, size_t points_size) {
+    QUERY_STAT_ADD(pointsExamined, points_size);
+
+    if (!node->inexact) {
+        QUERY_STAT_ADD(inRectangleTests, points_size);
+        return containBatch(node->xs, node->ys, points_size, bounds);
+    }
+
+    uint64_t hits = 0;
+    for (size_t i = 0; i < points_size; i++) {
+        hits |= (uint64_t)inRectangle(range, node->points[i]) << i;
+    }
+
+    return hits;
+}
+
 // Tests whether a datapoint given by its 2D coordinates lies within a quadtree and returns the datapoint along with its stored information 
 point2D **searchPoint(QuadTree *root, rectangle2D *range, point2D *search) {
     
     point2D **result;
-    result = (point2D **)malloc(sizeof(point2D *) * MAX_ARRAY_SIZE);
+    result = (point2D **)trackedMalloc(ALLOC_QUERY, sizeof(point2D *) * MAX_ARRAY_SIZE);
 
     size_t index = 0;
     for (size_t i = 0; i < MAX_ARRAY_SIZE; i++) {
@@ -211,16 +340,21 @@ point2D **searchPoint(QuadTree *root, rectangle2D *range, point2D *search) {
     if (!rectangleOverlap(root->boundary, range)) {
         return result;
     } 
+    QUERY_STAT_ADD(nodesVisited, 1);
     
     // Finds the number of points present within the rectangle 
     size_t points_size = QuadTree_points_size(root->points);
+    containBounds bounds;
+    containBoundsOf(range, &bounds);
+    uint64_t hits = nodeHits(root, range, &bounds, points_size);
     for (size_t i = 0; i < points_size; i++)
     {
         // If datapoint present in the quadtree matches the datapoint that is being searched
-        if (inRectangle(range, root->points[i])) {
+        if (((hits >> i) & 1) && index < MAX_ARRAY_SIZE) {
             
             // Store the coordinates of the found datapoint
             result[index++] = root->points[i];
+            QUERY_STAT_ADD(pointsReturned, 1);
         }
     }
     
@@ -237,31 +371,700 @@ point2D **searchPoint(QuadTree *root, rectangle2D *range, point2D *search) {
     // South-West Quadrant
     i = 0;
     point2D **sw_r = searchPoint(root->SW, range,search);   
-    while (sw_r[i] != NULL && i < MAX_ARRAY_SIZE) {        
-        result[index++] = sw_r[i];
+    while (i < MAX_ARRAY_SIZE && sw_r[i] != NULL && index < MAX_ARRAY_SIZE) {
+        result[index++] = sw_r[i++];
     }
+    trackedFree(ALLOC_QUERY, sw_r);
 
     // North-West Quadrant
     i = 0;
     point2D **nw_r = searchPoint(root->NW, range,search);   
-    while (nw_r[i] != NULL && i < MAX_ARRAY_SIZE) {      
-        result[index++] = nw_r[i];
+    while (i < MAX_ARRAY_SIZE && nw_r[i] != NULL && index < MAX_ARRAY_SIZE) {
+        result[index++] = nw_r[i++];
     }
+    trackedFree(ALLOC_QUERY, nw_r);
 
     // North-East Quadrant
     i = 0;
     point2D **ne_r = searchPoint(root->NE, range,search);    
-    while (ne_r[i] != NULL && i < MAX_ARRAY_SIZE) {        
-        result[index++] = ne_r[i];
+    while (i < MAX_ARRAY_SIZE && ne_r[i] != NULL && index < MAX_ARRAY_SIZE) {
+        result[index++] = ne_r[i++];
     }
+    trackedFree(ALLOC_QUERY, ne_r);
 
     // South-East Quadrant
     i = 0;
     point2D **se_r = searchPoint(root->SE, range,search);
-    while (se_r[i] != NULL && i < MAX_ARRAY_SIZE) {
-        result[index++] = se_r[i];
+    while (i < MAX_ARRAY_SIZE && se_r[i] != NULL && index < MAX_ARRAY_SIZE) {
+        result[index++] = se_r[i++];
+    }
+    trackedFree(ALLOC_QUERY, se_r);
+
+    return result;
+}
+
+
+
+// Appends a point to a growable NULL-terminated result array
+static void appendResult(point2D ***result, size_t *count, size_t *capacity, point2D *point) {
+    
+    // Keep one slot spare for the terminating NULL
+    if (*count + 1 >= *capacity) {
+        *capacity *= 2;
+        *result = (point2D **)trackedRealloc(ALLOC_QUERY, *result, 
+            sizeof(point2D *) * *capacity);
+        assert(*result);
+    }
+
+    (*result)[(*count)++] = point;
+    (*result)[*count] = NULL;
+}
+
+// Returns 1 (TRUE) if the node's summary leaves open that one of its points passes the filter
+static int filterMayMatch(QuadTree *node, pointFilter *filter) {
+    if (!filter || !filter->mayMatch || !node->summary) {
+        return 1;
+    }
+
+    return filter->mayMatch(node->summary, node->summarySpec, filter->arg);
+}
+
+// Emits every point of a node lying entirely within the query, without testing their position
+static void emitSubtree(QuadTree *node, pointFilter *filter, FILE *summaryFile, 
+    point2D ***result, size_t *count, size_t *capacity) {
+
+    QUERY_STAT_ADD(nodesVisited, 1);
+
+    size_t points_size = QuadTree_points_size(node->points);
+    for (size_t i = 0; i < points_size; i++) {
+        if (filter && !filter->test(node->points[i], filter->arg)) {
+            continue;
+        }
+        appendResult(result, count, capacity, node->points[i]);
+        QUERY_STAT_ADD(pointsReturned, 1);
+    }
+
+    if (node->NW == NULL) {
+        return;
+    }
+
+    // Quadrants are still printed so the path matches a tested traversal
+    QuadTree *children[] = {node->SW, node->NW, node->NE, node->SE};
+    for (int q = 0; q < 4; q++) {
+        if (children[q]->points[0] == NULL || !filterMayMatch(children[q], filter)) {
+            continue;
+        }
+
+        if (summaryFile) {
+            fprintf(summaryFile, " %s", quadrantName(q + 1));
+        }
+        emitSubtree(children[q], filter, summaryFile, result, count, capacity);
+    }
+}
+
+// Collects the points of a node and its children which lie within the query rectangle
+static void rangeQueryNode(QuadTree *node, rectangle2D *range, containBounds *bounds, 
+    pointFilter *filter, FILE *summaryFile, point2D ***result, size_t *count, size_t *capacity) {
+
+    // Nodes inside the query are emitted whole
+    if (rectangleContains(range, node->boundary)) {
+        emitSubtree(node, filter, summaryFile, result, count, capacity);
+        return;
+    }
+
+    QUERY_STAT_ADD(nodesVisited, 1);
+
+    size_t points_size = QuadTree_points_size(node->points);
+    uint64_t hits = nodeHits(node, range, bounds, points_size);
+    for (size_t i = 0; i < points_size; i++) {
+        if ((hits >> i) & 1 && (!filter || filter->test(node->points[i], filter->arg))) {
+            appendResult(result, count, capacity, node->points[i]);
+            QUERY_STAT_ADD(pointsReturned, 1);
+        }
+    }
+
+    // If the current node has no child nodes
+    if (node->NW == NULL) {
+        return;
+    }
+
+    // Quadrants are explored in the order SW, NW, NE, SE
+    QuadTree *children[] = {node->SW, node->NW, node->NE, node->SE};
+    for (int q = 0; q < 4; q++) {
+
+        // Skip quadrants outside the query, quadrants holding no points and quadrants
+        // whose summaries show no point can pass the filter
+        if (!rectangleOverlap(children[q]->boundary, range) || children[q]->points[0] == NULL ||
+            !filterMayMatch(children[q], filter)) {
+            continue;
+        }
+
+        if (summaryFile) {
+            fprintf(summaryFile, " %s", quadrantName(q + 1));
+        }
+        rangeQueryNode(children[q], range, bounds, filter, summaryFile, result, count, capacity);
+    }
+}
+
+// Counts the points of a node and its children which lie within the query rectangle
+static size_t rangeCountNode(QuadTree *node, rectangle2D *range, containBounds *bounds) {
+
+    // Nodes inside the query contribute their whole subtree
+    if (rectangleContains(range, node->boundary)) {
+        QUERY_STAT_ADD(pointsReturned, node->subtreePoints);
+        return node->subtreePoints;
+    }
+
+    QUERY_STAT_ADD(nodesVisited, 1);
+
+    size_t points_size = QuadTree_points_size(node->points);
+    size_t found = __builtin_popcountll(nodeHits(node, range, bounds, points_size));
+    QUERY_STAT_ADD(pointsReturned, found);
+
+    if (node->NW == NULL) {
+        return found;
+    }
+
+    QuadTree *children[] = {node->SW, node->NW, node->NE, node->SE};
+    for (int q = 0; q < 4; q++) {
+        if (children[q]->subtreePoints > 0 && rectangleOverlap(children[q]->boundary, range)) {
+            found += rangeCountNode(children[q], range, bounds);
+        }
+    }
+
+    return found;
+}
+
+// Keeps per-node summaries of the columns in the spec; call before any point is added
+void enableAggregates(QuadTree *root, aggregateSpec *spec) {
+    assert(root->subtreePoints == 0);
+
+    root->aggSpec = spec;
+    root->agg = (nodeAggregate *)trackedMalloc(ALLOC_TREE, sizeof(nodeAggregate));
+    assert(root->agg);
+    aggregateInit(root->agg);
+}
+
+// Keeps per-node summaries of every point under the spec for filtered queries to prune with
+void enableSummaries(QuadTree *root, aggregateSpec *spec) {
+    assert(root->subtreePoints == 0);
+
+    root->summarySpec = spec;
+    root->summary = (nodeAggregate *)trackedMalloc(ALLOC_TREE, sizeof(nodeAggregate));
+    assert(root->summary);
+    aggregateInit(root->summary);
+}
+
+// Adds the counted points of a node and its children within the query rectangle to the aggregate
+static void rangeAggregateNode(QuadTree *node, rectangle2D *range, containBounds *bounds, 
+    nodeAggregate *out) {
+
+    // Nodes inside the query contribute their whole summary
+    if (rectangleContains(range, node->boundary)) {
+        aggregateMerge(out, node->aggSpec->numColumns, node->agg);
+        return;
+    }
+
+    QUERY_STAT_ADD(nodesVisited, 1);
+
+    // Only the points of nodes straddling the query edge are examined
+    size_t points_size = QuadTree_points_size(node->points);
+    uint64_t hits = nodeHits(node, range, bounds, points_size);
+    while (hits) {
+        int i = __builtin_ctzll(hits);
+        aggregateAddPoint(out, node->aggSpec, node->points[i]);
+        QUERY_STAT_ADD(pointsReturned, 1);
+        hits &= hits - 1;
+    }
+
+    if (node->NW == NULL) {
+        return;
+    }
+
+    QuadTree *children[] = {node->SW, node->NW, node->NE, node->SE};
+    for (int q = 0; q < 4; q++) {
+        if (children[q]->subtreePoints > 0 && rectangleOverlap(children[q]->boundary, range)) {
+            rangeAggregateNode(children[q], range, bounds, out);
+        }
+    }
+}
+
+// Summarises the counted datapoints within the query rectangle
+int rangeAggregate(QuadTree *root, rectangle2D *range, nodeAggregate *out) {
+    aggregateInit(out);
+
+    if (!root->agg) {
+        return 0;
+    }
+
+    containBounds bounds;
+    containBoundsOf(range, &bounds);
+
+    if (rectangleOverlap(root->boundary, range)) {
+        rangeAggregateNode(root, range, &bounds, out);
+    }
+
+    return 1;
+}
+
+// Returns the number of datapoints lying within the query rectangle, without collecting them
+size_t rangeCount(QuadTree *root, rectangle2D *range) {
+    containBounds bounds;
+    containBoundsOf(range, &bounds);
+
+    if (!rectangleOverlap(root->boundary, range)) {
+        return 0;
+    }
+
+    return rangeCountNode(root, range, &bounds);
+}
+
+// Returns the datapoints lying within the query rectangle which pass the filter as a NULL-terminated array
+point2D **rangeQueryFiltered(QuadTree *root, rectangle2D *range, pointFilter *filter, FILE *summaryFile) {
+    size_t count = 0;
+    size_t capacity = QT_NODE_CAPACITY;
+
+    point2D **result = (point2D **)trackedMalloc(ALLOC_QUERY, sizeof(point2D *) * capacity);
+    assert(result);
+    result[0] = NULL;
+
+    containBounds bounds;
+    containBoundsOf(range, &bounds);
+
+    if (rectangleOverlap(root->boundary, range) && filterMayMatch(root, filter)) {
+        rangeQueryNode(root, range, &bounds, filter, summaryFile, &result, &count, &capacity);
     }
 
     return result;
 }
 
+// Returns all datapoints lying within the query rectangle as a NULL-terminated array
+point2D **rangeQuery(QuadTree *root, rectangle2D *range, FILE *summaryFile) {
+    return rangeQueryFiltered(root, range, NULL, summaryFile);
+}
+
+// Progress of one query of a batch traversal
+typedef struct batchState {
+    containBounds bounds;
+    size_t count;
+    size_t capacity;
+} batchState;
+
+// Collects the points of a node and its children lying within each of the active queries,
+// which all overlap the node; the node is visited once however many queries reach it
+static void rangeBatchNode(QuadTree *node, batchQuery *queries, batchState *states, 
+    size_t *active, size_t numActive) {
+
+    // Queries containing the node take its whole subtree; the rest test its points
+    size_t *partial = (size_t *)trackedMalloc(ALLOC_QUERY, sizeof(size_t) * numActive);
+    assert(partial);
+    size_t numPartial = 0;
+    size_t points_size = QuadTree_points_size(node->points);
+    for (size_t a = 0; a < numActive; a++) {
+        batchQuery *query = &queries[active[a]];
+        batchState *state = &states[active[a]];
+        if (rectangleContains(query->range, node->boundary)) {
+            emitSubtree(node, query->filter, query->summaryFile, &query->result, &state->count,
+                &state->capacity);
+            continue;
+        }
+
+        uint64_t hits = nodeHits(node, query->range, &state->bounds, points_size);
+        for (size_t i = 0; i < points_size; i++) {
+            if ((hits >> i) & 1 && (!query->filter || 
+                query->filter->test(node->points[i], query->filter->arg))) {
+                appendResult(&query->result, &state->count, &state->capacity, node->points[i]);
+                QUERY_STAT_ADD(pointsReturned, 1);
+            }
+        }
+        partial[numPartial++] = active[a];
+    }
+    if (numPartial > 0) {
+        QUERY_STAT_ADD(nodesVisited, 1);
+    }
+
+    // Each quadrant is explored, in the order SW, NW, NE, SE, by the queries which would 
+    // explore it alone, so each query prints the quadrants rangeQueryFiltered would
+    if (node->NW != NULL && numPartial > 0) {
+        size_t *reaching = (size_t *)trackedMalloc(ALLOC_QUERY, sizeof(size_t) * numPartial);
+        assert(reaching);
+        QuadTree *children[] = {node->SW, node->NW, node->NE, node->SE};
+        for (int q = 0; q < 4; q++) {
+            if (children[q]->points[0] == NULL) {
+                continue;
+            }
+
+            size_t numReaching = 0;
+            for (size_t a = 0; a < numPartial; a++) {
+                batchQuery *query = &queries[partial[a]];
+                if (!rectangleOverlap(children[q]->boundary, query->range) ||
+                    !filterMayMatch(children[q], query->filter)) {
+                    continue;
+                }
+                if (query->summaryFile) {
+                    fprintf(query->summaryFile, " %s", quadrantName(q + 1));
+                }
+                reaching[numReaching++] = partial[a];
+            }
+            if (numReaching > 0) {
+                rangeBatchNode(children[q], queries, states, reaching, numReaching);
+            }
+        }
+        trackedFree(ALLOC_QUERY, reaching);
+    }
+    trackedFree(ALLOC_QUERY, partial);
+}
+
+// Answers a batch of range queries with one traversal of the quadtree
+void rangeQueryBatch(QuadTree *root, batchQuery *queries, size_t numQueries) {
+    batchState *states = (batchState *)trackedMalloc(ALLOC_QUERY, 
+        sizeof(batchState) * (numQueries + 1));
+    size_t *active = (size_t *)trackedMalloc(ALLOC_QUERY, sizeof(size_t) * (numQueries + 1));
+    assert(states && active);
+
+    size_t numActive = 0;
+    for (size_t k = 0; k < numQueries; k++) {
+        states[k].count = 0;
+        states[k].capacity = QT_NODE_CAPACITY;
+        containBoundsOf(queries[k].range, &states[k].bounds);
+        queries[k].result = (point2D **)trackedMalloc(ALLOC_QUERY, 
+            sizeof(point2D *) * states[k].capacity);
+        assert(queries[k].result);
+        queries[k].result[0] = NULL;
+
+        if (rectangleOverlap(root->boundary, queries[k].range) && 
+            filterMayMatch(root, queries[k].filter)) {
+            active[numActive++] = k;
+        }
+    }
+
+    if (numActive > 0) {
+        rangeBatchNode(root, queries, states, active, numActive);
+    }
+
+    trackedFree(ALLOC_QUERY, states);
+    trackedFree(ALLOC_QUERY, active);
+}
+
+/* A node still to be visited by a range cursor */
+typedef struct cursorFrame {
+    QuadTree *node;
+    /* Quadrant printed on reaching the node, or 0 for the root */
+    int quadrant;
+    /* Whether the node lies entirely within the query */
+    int contained;
+} cursorFrame;
+
+struct rangeCursor {
+    point2D center;
+    rectangle2D range;
+    containBounds bounds;
+    pointFilter *filter;
+    /* Nodes still to be visited, the next on top */
+    cursorFrame *stack;
+    size_t depth;
+    size_t capacity;
+};
+
+// Adds a node to the top of a cursor's stack
+static void pushFrame(rangeCursor *cursor, QuadTree *node, int quadrant, int contained) {
+    if (cursor->depth == cursor->capacity) {
+        cursor->capacity *= 2;
+        cursor->stack = (cursorFrame *)trackedRealloc(ALLOC_QUERY, cursor->stack, 
+            sizeof(cursorFrame) * cursor->capacity);
+        assert(cursor->stack);
+    }
+
+    cursorFrame *frame = &cursor->stack[cursor->depth++];
+    frame->node = node;
+    frame->quadrant = quadrant;
+    frame->contained = contained;
+}
+
+// Starts a range query over the quadtree which can be run in several legs
+rangeCursor *newRangeCursor(QuadTree *root, rectangle2D *range, pointFilter *filter) {
+    rangeCursor *cursor = (rangeCursor *)trackedMalloc(ALLOC_QUERY, sizeof(rangeCursor));
+    assert(cursor);
+
+    // The query rectangle is copied so the caller need not keep it
+    cursor->center = *range->center;
+    cursor->range = *range;
+    cursor->range.center = &cursor->center;
+    containBoundsOf(&cursor->range, &cursor->bounds);
+    cursor->filter = filter;
+    cursor->capacity = QT_NODE_CAPACITY;
+    cursor->depth = 0;
+    cursor->stack = (cursorFrame *)trackedMalloc(ALLOC_QUERY, sizeof(cursorFrame) * cursor->capacity);
+    assert(cursor->stack);
+
+    if (rectangleOverlap(root->boundary, range) && filterMayMatch(root, filter)) {
+        pushFrame(cursor, root, 0, 0);
+    }
+
+    return cursor;
+}
+
+// Returns why the budget stops a leg which has found count points in visiting nodes, or
+// RANGE_COMPLETE if it may go on
+static int budgetStop(queryBudget *budget, size_t count, size_t nodes) {
+    if (budget->maxPoints && count >= budget->maxPoints) {
+        return RANGE_STOPPED_POINTS;
+    }
+    if (budget->maxNodes && nodes >= budget->maxNodes) {
+        return RANGE_STOPPED_NODES;
+    }
+    if (budget->deadlineNs && monotonicNs() >= budget->deadlineNs) {
+        return RANGE_STOPPED_DEADLINE;
+    }
+    return RANGE_COMPLETE;
+}
+
+// Runs the next leg of a range cursor within the budget
+int rangeCursorNext(rangeCursor *cursor, queryBudget *budget, FILE *summaryFile, 
+    point2D ***result) {
+
+    size_t count = 0;
+    size_t capacity = QT_NODE_CAPACITY;
+    *result = (point2D **)trackedMalloc(ALLOC_QUERY, sizeof(point2D *) * capacity);
+    assert(*result);
+    (*result)[0] = NULL;
+
+    // Nodes are visited depth first in the order of rangeQueryFiltered, so a query run
+    // without limits finds and prints the same
+    size_t nodes = 0;
+    while (cursor->depth > 0) {
+        int stop = budgetStop(budget, count, nodes);
+        if (stop != RANGE_COMPLETE) {
+            return stop;
+        }
+
+        cursorFrame frame = cursor->stack[--cursor->depth];
+        QuadTree *node = frame.node;
+        nodes++;
+        QUERY_STAT_ADD(nodesVisited, 1);
+        if (frame.quadrant && summaryFile) {
+            fprintf(summaryFile, " %s", quadrantName(frame.quadrant));
+        }
+
+        // Nodes inside the query keep every point passing the filter
+        int contained = frame.contained || rectangleContains(&cursor->range, node->boundary);
+        size_t points_size = QuadTree_points_size(node->points);
+        uint64_t hits = contained ? ~0ULL : 
+            nodeHits(node, &cursor->range, &cursor->bounds, points_size);
+        for (size_t i = 0; i < points_size; i++) {
+            if ((hits >> i) & 1 && 
+                (!cursor->filter || cursor->filter->test(node->points[i], cursor->filter->arg))) {
+                appendResult(result, &count, &capacity, node->points[i]);
+                QUERY_STAT_ADD(pointsReturned, 1);
+            }
+        }
+
+        // Children are pushed last first so they are visited in the order SW, NW, NE, SE
+        if (node->NW == NULL) {
+            continue;
+        }
+        QuadTree *children[] = {node->SW, node->NW, node->NE, node->SE};
+        for (int q = 3; q >= 0; q--) {
+            if (children[q]->points[0] == NULL || !filterMayMatch(children[q], cursor->filter) ||
+                (!contained && !rectangleOverlap(children[q]->boundary, &cursor->range))) {
+                continue;
+            }
+            pushFrame(cursor, children[q], q + 1, contained);
+        }
+    }
+
+    return RANGE_COMPLETE;
+}
+
+// Returns 1 (TRUE) once a range cursor has visited every node it needs to
+int rangeCursorDone(rangeCursor *cursor) {
+    return cursor->depth == 0;
+}
+
+// Frees a range cursor
+void freeRangeCursor(rangeCursor *cursor) {
+    if (!cursor) {
+        return;
+    }
+    trackedFree(ALLOC_QUERY, cursor->stack);
+    trackedFree(ALLOC_QUERY, cursor);
+}
+
+// Children in the order addPoint tries them, which decides the quadrant of points on their edges
+static const int childEast[] = {0, 1, 0, 1};
+static const int childNorth[] = {1, 1, 0, 0};
+
+// Sets the tile's rectangle, dividing the root rectangle as create_quadNode divides nodes
+int tileRectangle(rectangle2D *root, int zoom, uint32_t x, uint32_t y, rectangle2D *out) {
+    if (zoom < 0 || zoom > QT_MAX_TILE_ZOOM || ((x | y) >> zoom) != 0) {
+        return 0;
+    }
+
+    *out->center = *root->center;
+    out->x_half = root->x_half;
+    out->y_half = root->y_half;
+    for (int level = zoom - 1; level >= 0; level--) {
+        out->x_half /= 2;
+        out->y_half /= 2;
+        out->center->x += (x >> level) & 1 ? out->x_half : -out->x_half;
+        out->center->y += (y >> level) & 1 ? -out->y_half : out->y_half;
+    }
+
+    return 1;
+}
+
+// Finds the tile at the zoom level that the point is inserted under
+int tileOf(rectangle2D *root, int zoom, point2D *point, uint32_t *x, uint32_t *y) {
+    if (!inRectangle(root, point)) {
+        return 0;
+    }
+
+    point2D center = *root->center;
+    rectangle2D rect = {&center, root->x_half, root->y_half};
+    *x = 0;
+    *y = 0;
+    for (int level = 0; level < zoom; level++) {
+        long double x_half = rect.x_half / 2;
+        long double y_half = rect.y_half / 2;
+
+        // The point goes to the first child containing it, as in addPoint
+        int q;
+        point2D childCenter;
+        rectangle2D child = {&childCenter, x_half, y_half};
+        for (q = 0; q < 4; q++) {
+            childCenter.x = center.x + (childEast[q] ? x_half : -x_half);
+            childCenter.y = center.y + (childNorth[q] ? y_half : -y_half);
+            if (inRectangle(&child, point)) {
+                break;
+            }
+        }
+        if (q == 4) {
+            return 0;
+        }
+
+        *x = (*x << 1) | childEast[q];
+        *y = (*y << 1) | !childNorth[q];
+        center = childCenter;
+        rect.x_half = x_half;
+        rect.y_half = y_half;
+    }
+
+    return 1;
+}
+
+// Returns the datapoints inserted under the tile as a NULL-terminated array
+point2D **tileQuery(QuadTree *root, int zoom, uint32_t x, uint32_t y) {
+    size_t count = 0;
+    size_t capacity = QT_NODE_CAPACITY;
+
+    point2D **result = (point2D **)trackedMalloc(ALLOC_QUERY, sizeof(point2D *) * capacity);
+    assert(result);
+    result[0] = NULL;
+
+    point2D center;
+    rectangle2D tile = {&center, 0, 0};
+    if (!tileRectangle(root->boundary, zoom, x, y, &tile)) {
+        return result;
+    }
+
+    // The tile's node is reached directly, since nodes divide their rectangle as tiles do
+    QuadTree *node = root;
+    for (int level = zoom - 1; level >= 0; level--) {
+        QUERY_STAT_ADD(nodesVisited, 1);
+
+        // A node keeps the first points inserted into it, which may lie in any of its quadrants
+        size_t points_size = QuadTree_points_size(node->points);
+        for (size_t i = 0; i < points_size; i++) {
+            uint32_t px, py;
+            if (tileOf(root->boundary, zoom, node->points[i], &px, &py) && px == x && py == y) {
+                appendResult(&result, &count, &capacity, node->points[i]);
+                QUERY_STAT_ADD(pointsReturned, 1);
+            }
+        }
+
+        if (node->NW == NULL) {
+            return result;
+        }
+        int east = (x >> level) & 1;
+        int north = !((y >> level) & 1);
+        node = east ? (north ? node->NE : node->SE) : (north ? node->NW : node->SW);
+    }
+
+    // Every point under the tile's node was inserted under the tile
+    emitSubtree(node, NULL, NULL, &result, &count, &capacity);
+
+    return result;
+}
+
+// Accumulates the statistics of a node and its children
+static void statsNode(QuadTree *node, int depth, treeStats *stats) {
+    size_t points_size = QuadTree_points_size(node->points);
+
+    stats->nodeCount++;
+    stats->pointCount += points_size;
+    stats->nodeBytes += sizeof(QuadTree) + sizeof(point2D *) * QT_NODE_CAPACITY;
+    if (node->agg) {
+        stats->nodeBytes += sizeof(nodeAggregate);
+    }
+    if (node->summary) {
+        stats->nodeBytes += sizeof(nodeAggregate);
+    }
+    stats->rectangleBytes += sizeof(rectangle2D) + sizeof(point2D);
+    stats->pointBytes += sizeof(point2D) * points_size;
+
+    // Every node visited by searchPoint allocates its own result buffer
+    stats->resultBufferBytes += sizeof(point2D *) * MAX_ARRAY_SIZE;
+
+    if (node->NW == NULL) {
+        stats->leafCount++;
+        if (points_size == 0) {
+            stats->emptyLeafCount++;
+        }
+        stats->leafPoints[points_size]++;
+        stats->totalLeafDepth += depth;
+        if (depth > stats->maxDepth) {
+            stats->maxDepth = depth;
+        }
+        if (stats->minLeafDepth < 0 || depth < stats->minLeafDepth) {
+            stats->minLeafDepth = depth;
+        }
+        return;
+    }
+
+    statsNode(node->SW, depth + 1, stats);
+    statsNode(node->NW, depth + 1, stats);
+    statsNode(node->NE, depth + 1, stats);
+    statsNode(node->SE, depth + 1, stats);
+}
+
+// Walks the quadtree and fills in its node, depth and memory statistics
+void quadtree_stats(QuadTree *root, treeStats *stats) {
+    memset(stats, 0, sizeof(treeStats));
+    stats->minLeafDepth = -1;
+
+    if (root) {
+        statsNode(root, 0, stats);
+    }
+}
+
+// Prints quadtree statistics as one "name: value" pair per line
+void printQuadtreeStats(treeStats *stats, FILE *f) {
+    size_t totalBytes = stats->nodeBytes + stats->rectangleBytes + stats->pointBytes;
+
+    fprintf(f, "nodes: %zu\n", stats->nodeCount);
+    fprintf(f, "leaves: %zu\n", stats->leafCount);
+    fprintf(f, "empty_leaves: %zu\n", stats->emptyLeafCount);
+    fprintf(f, "points: %zu\n", stats->pointCount);
+    fprintf(f, "max_depth: %d\n", stats->maxDepth);
+    fprintf(f, "min_leaf_depth: %d\n", stats->minLeafDepth);
+    fprintf(f, "avg_leaf_depth: %.2f\n", 
+        stats->leafCount ? (double)stats->totalLeafDepth / stats->leafCount : 0.0);
+    for (int i = 0; i <= QT_NODE_CAPACITY; i++) {
+        fprintf(f, "leaves_with_%d_points: %zu\n", i, stats->leafPoints[i]);
+    }
+    fprintf(f, "bytes_nodes: %zu\n", stats->nodeBytes);
+    fprintf(f, "bytes_rectangles: %zu\n", stats->rectangleBytes);
+    fprintf(f, "bytes_points: %zu\n", stats->pointBytes);
+    fprintf(f, "bytes_total: %zu\n", totalBytes);
+    fprintf(f, "bytes_full_search_buffers: %zu\n", stats->resultBufferBytes);
+}
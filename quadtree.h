@@ -1,9 +1,24 @@
+#ifndef QUADTREE_H
+#define QUADTREE_H
+
 #include <stdio.h>
+#include <stdint.h>
+#include "aggregate.h"
+
+#define QT_NODE_CAPACITY (4)
+#define MAX_ARRAY_SIZE (1024)
+#define QT_MAX_TILE_ZOOM (31)
+
+/* Footpath record a datapoint belongs to, defined in dictionary.c */
+struct data;
 
 // data definitions
 struct point_t {
     long double x;
     long double y;
+    struct data *record;
+    /* Set for a record's end point, clear for its start point and for points of no record */
+    int end;
 } ;
 typedef struct point_t point2D;
 
@@ -17,6 +32,20 @@ typedef struct QuadTree {
     rectangle2D *boundary;
     point2D **points;
 
+    /* Copies of the point coordinates laid out for the batch containment kernel */
+    double xs[QT_NODE_CAPACITY];
+    double ys[QT_NODE_CAPACITY];
+    /* Set when a point's coordinates are not exact doubles, forcing scalar tests */
+    int inexact;
+    /* Number of points stored in this node and all of its descendants */
+    size_t subtreePoints;
+    /* Summary of the counted points of this subtree, when aggregates are enabled */
+    aggregateSpec *aggSpec;
+    nodeAggregate *agg;
+    /* Summary of every point of this subtree, used to prune filtered queries */
+    aggregateSpec *summarySpec;
+    nodeAggregate *summary;
+
     struct QuadTree* NW;
     struct QuadTree* NE;
     struct QuadTree* SW;
@@ -24,20 +53,85 @@ typedef struct QuadTree {
 
 } QuadTree;
 
+/* Predicate over datapoints, with an optional test of node summaries to rule out whole subtrees */
+typedef struct pointFilter {
+    /* Returns 1 (TRUE) if the datapoint passes the filter */
+    int (*test)(point2D *point, void *arg);
+    /* Returns 0 (FALSE) if no datapoint summarised under the spec can pass the filter; may be NULL */
+    int (*mayMatch)(nodeAggregate *summary, aggregateSpec *spec, void *arg);
+    void *arg;
+} pointFilter;
+
+/* One range query of a batch answered by rangeQueryBatch */
+typedef struct batchQuery {
+    rectangle2D *range;
+    /* Filter the datapoints must pass, or NULL */
+    pointFilter *filter;
+    /* File the quadrants explored are printed to, or NULL */
+    FILE *summaryFile;
+    /* Set to the NULL-terminated array of datapoints found */
+    point2D **result;
+} batchQuery;
+
+/* Limits on one leg of a range query run with a cursor; a zero field sets no limit */
+typedef struct queryBudget {
+    /* Datapoints to find before stopping */
+    size_t maxPoints;
+    /* Nodes to visit before stopping */
+    size_t maxNodes;
+    /* Monotonic time in nanoseconds (as monotonicNs gives) after which no node is visited */
+    unsigned long long deadlineNs;
+} queryBudget;
+
+/* Why a leg of a range query run with a cursor stopped */
+#define RANGE_COMPLETE 0
+#define RANGE_STOPPED_POINTS 1
+#define RANGE_STOPPED_NODES 2
+#define RANGE_STOPPED_DEADLINE 3
+
+/* A range query over a quadtree which stops when its budget runs out and resumes from the
+nodes it had still to visit */
+typedef struct rangeCursor rangeCursor;
+
+typedef struct treeStats {
+    size_t nodeCount;
+    size_t leafCount;
+    size_t emptyLeafCount;
+    size_t pointCount;
+    int maxDepth;
+    int minLeafDepth;
+    size_t totalLeafDepth;
+    /* Number of leaves holding each possible number of points */
+    size_t leafPoints[QT_NODE_CAPACITY + 1];
+    size_t nodeBytes;
+    size_t rectangleBytes;
+    size_t pointBytes;
+    size_t resultBufferBytes;
+} treeStats;
+
 // function definitions
 
 /* Creates a point using given coordinates and stores their values */
 point2D *create_point(long double x, long double y);
 
+/* Frees a point created with create_point */
+void freePoint(point2D *point);
+
 /* Specifies a rectangle given bottom-left 2D point and an upper right 2D point */
 rectangle2D *create_rectangle(point2D *center, long double x_mid, long double y_mid);
 
+/* Frees a rectangle and its center point */
+void freeRectangle(rectangle2D *rectangle);
+
 /* Tests whether a given 2D point lies within the rectangle and returns 1 (TRUE) if it does */
 int inRectangle(rectangle2D *boundary, point2D *point);
 
 /* Tests whether two rectangles overlap and returns 1 (TRUE) if they do  */
 int rectangleOverlap(rectangle2D *self, rectangle2D *other);
 
+/* Tests whether the inner rectangle lies entirely within the outer rectangle and returns 1 (TRUE) if it does */
+int rectangleContains(rectangle2D *outer, rectangle2D *inner);
+
 /* Creates a new QuadTree given the 2D coordinates of its upper left and bottom right points of its root node */
 QuadTree *new_Quadtree(rectangle2D *boundary);
 
@@ -47,11 +141,87 @@ size_t QuadTree_points_size(point2D *points[]);
 /* Creates new children nodes for each internal node and further divides the root node rectangle to insert points */
 QuadTree *create_quadNode(QuadTree *root);
 
+/* Frees the quadtree, its child rectangles and every point added to it, leaving the root
+rectangle to the caller */
+void freeQuadtree(QuadTree *root);
+
 /*Tests whether a datapoint given by its 2D coordinates lies within a quadtree and returns the datapoint along with its stored information */
 point2D **searchPoint(QuadTree *root, rectangle2D *range,point2D *search);
 
 /* Adds a point given with its 2D coordinates to the quadtree */
 int addPoint(QuadTree *root, point2D *point);
 
-/* Returns the quadrant of the rectangle that the point lies in */
+/* Returns all datapoints lying within the query rectangle as a NULL-terminated array, 
+printing each quadrant explored to the summary file (if given) */
+point2D **rangeQuery(QuadTree *root, rectangle2D *range, FILE *summaryFile);
+
+/* Returns the datapoints lying within the query rectangle which pass the filter (if given) as a
+NULL-terminated array, skipping subtrees whose summaries rule the filter out */
+point2D **rangeQueryFiltered(QuadTree *root, rectangle2D *range, pointFilter *filter, FILE *summaryFile);
+
+/* Answers every query of the batch with one traversal of the quadtree, carrying down each node
+the queries which overlap it, so nodes shared by several queries are visited once for all of
+them. Each query gets the result and printed quadrants rangeQueryFiltered would give it; queries
+are carried in the order given, so callers should sort them spatially */
+void rangeQueryBatch(QuadTree *root, batchQuery *queries, size_t numQueries);
+
+/* Starts a range query over the quadtree which may be run in several legs. The filter (if
+given) must last as long as the cursor */
+rangeCursor *newRangeCursor(QuadTree *root, rectangle2D *range, pointFilter *filter);
+
+/* Runs the next leg of the cursor's query, visiting nodes until all are visited or the budget
+runs out, and sets result to the NULL-terminated array of the datapoints found on the way.
+Prints each quadrant explored to the summary file (if given); run without limits, a cursor
+finds and prints what rangeQueryFiltered would. Returns RANGE_COMPLETE or why the leg stopped */
+int rangeCursorNext(rangeCursor *cursor, queryBudget *budget, FILE *summaryFile, 
+    point2D ***result);
+
+/* Returns 1 (TRUE) once the cursor has visited every node its query needs */
+int rangeCursorDone(rangeCursor *cursor);
+
+/* Frees a range cursor */
+void freeRangeCursor(rangeCursor *cursor);
+
+/* Returns the number of datapoints lying within the query rectangle, without collecting them */
+size_t rangeCount(QuadTree *root, rectangle2D *range);
+
+/* Keeps per-node summaries of the columns in the spec; call before any point is added */
+void enableAggregates(QuadTree *root, aggregateSpec *spec);
+
+/* Keeps per-node summaries of every point under the spec for filtered queries to prune with;
+call before any point is added */
+void enableSummaries(QuadTree *root, aggregateSpec *spec);
+
+/* Summarises the counted datapoints within the query rectangle, combining the summaries of
+nodes lying inside it; returns 0 (FALSE) if aggregates are not enabled */
+int rangeAggregate(QuadTree *root, rectangle2D *range, nodeAggregate *out);
+
+/* Sets out to the rectangle of tile x, y (counted from the west and north edges) at the zoom
+level, which divides the root rectangle into 2^zoom by 2^zoom tiles as nodes at that depth do;
+out's center must point to storage. Returns 0 (FALSE) if there is no such tile */
+int tileRectangle(rectangle2D *root, int zoom, uint32_t x, uint32_t y, rectangle2D *out);
+
+/* Sets x and y to the tile at the zoom level that the point is inserted under, so a point on
+the edge of tiles belongs to just one of them; returns 0 (FALSE) if it lies outside the root */
+int tileOf(rectangle2D *root, int zoom, point2D *point, uint32_t *x, uint32_t *y);
+
+/* Returns the datapoints inserted under tile x, y at the zoom level as a NULL-terminated array,
+reaching the tile's node directly rather than searching its rectangle */
+point2D **tileQuery(QuadTree *root, int zoom, uint32_t x, uint32_t y);
+
+/* Returns the quadrant of the rectangle that the point lies in, without printing it */
+int quadrantOf(rectangle2D *range, point2D *point);
+
+/* Returns the quadrant of the rectangle that the point lies in, printing its name */
 int determineQuadrant(rectangle2D *range, point2D *point,FILE *summaryFile);
+
+/* Returns the name of a quadrant numbered as in determineQuadrant */
+const char *quadrantName(int quadrant);
+
+/* Walks the quadtree and fills in its node, depth and memory statistics */
+void quadtree_stats(QuadTree *root, treeStats *stats);
+
+/* Prints quadtree statistics as one "name: value" pair per line */
+void printQuadtreeStats(treeStats *stats, FILE *f);
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef QUADTREE_TEMPLATE_H
+#define QUADTREE_TEMPLATE_H
+
+#include <stddef.h>
+#include <assert.h>
+
+/* Generates a PR quadtree specialised at compile time, as static inline types and functions
+prefixed with name, so every instantiation is compiled for its own coordinate type, payload
+type and node capacity:
+
+    QUADTREE_TEMPLATE(name, coord_t, payload_t, capacity, maxDepth, allocNode, freeNode)
+
+coord_t is an arithmetic type holding coordinates, and payload_t the item stored with each
+point. A node holds up to capacity (at most 32) points; once full it splits, keeping its points,
+and later points go down to its children. Nodes at maxDepth do not split but chain further
+points into overflow nodes covering the same cell. allocNode returns the given number of
+zeroed bytes, as calloc(1, size) does, and freeNode frees them.
+
+Points on the edge of a node are inside it, and points on the centre lines of a node belong
+to its western and northern quadrants, as in quadtree.c. Quadrants are numbered as there less
+one: south-west 0, north-west 1, north-east 2 and south-east 3, the order they are explored in.
+
+Generated, for a tree type name and node type name_node:
+
+    name *name_new(coord_t cx, coord_t cy, coord_t hx, coord_t hy)
+        Creates an empty tree over the rectangle with the given centre and half sizes
+    int name_quadrant(const name_node *node, coord_t x, coord_t y)
+        Returns the quadrant of the node the point belongs to, without branching
+    int name_insert(name *tree, coord_t x, coord_t y, payload_t item)
+        Adds an item at the point, returning 0 (FALSE) if it lies outside the root
+    void name_range(name *tree, coord_t minX, coord_t minY, coord_t maxX, coord_t maxY,
+        void (*visit)(payload_t item, void *arg), void (*enter)(int quadrant, void *arg),
+        void *arg)
+        Visits each item within the rectangle (edges included) in the order quadtree.c's
+        rangeQuery returns them, calling enter (if given) with each non-empty quadrant explored
+        before its items, as rangeQuery prints them
+    size_t name_count(name *tree, coord_t minX, coord_t minY, coord_t maxX, coord_t maxY)
+        Returns the number of items within the rectangle, counting nodes inside it whole
+    void name_free(name *tree, void (*freeItem)(payload_t item))
+        Frees the tree, calling freeItem (if given) on every item */
+#define QUADTREE_TEMPLATE(name, coord_t, payload_t, capacity, maxDepth, allocNode, freeNode)  \
+                                                                                            \
+_Static_assert((capacity) > 0 && (capacity) <= 32, "a node's points must fit a 32 bit mask"); \
+                                                                                            \
+typedef struct name##_node {                                                                \
+    /* Centre, half sizes and edges of the node's cell */                                   \
+    coord_t cx, cy, hx, hy;                                                                 \
+    coord_t minX, minY, maxX, maxY;                                                         \
+    /* Points stored in this node, in the order they were added */                          \
+    coord_t xs[capacity];                                                                   \
+    coord_t ys[capacity];                                                                   \
+    payload_t items[capacity];                                                              \
+    unsigned count;                                                                         \
+    int depth;                                                                              \
+    /* Points stored in this node, its overflow nodes and all of its descendants */         \
+    size_t subtreeCount;                                                                    \
+    /* Children by quadrant, all NULL for a leaf */                                         \
+    struct name##_node *child[4];                                                           \
+    /* Node holding further points of a full node at maxDepth, or NULL */                   \
+    struct name##_node *overflow;                                                           \
+} name##_node;                                                                              \
+                                                                                            \
+typedef struct name {                                                                       \
+    name##_node *root;                                                                      \
+    size_t size;                                                                            \
+    size_t nodes;                                                                           \
+    int depth;                                                                              \
+} name;                                                                                     \
+                                                                                            \
+static inline name##_node *name##_newNode(name *tree, coord_t cx, coord_t cy, coord_t hx,   \
+    coord_t hy, int depth) {                                                                \
+    name##_node *node = (name##_node *)allocNode(sizeof(name##_node));                      \
+    assert(node);                                                                           \
+    node->cx = cx;                                                                          \
+    node->cy = cy;                                                                          \
+    node->hx = hx;                                                                          \
+    node->hy = hy;                                                                          \
+    node->minX = cx - hx;                                                                   \
+    node->maxX = cx + hx;                                                                   \
+    node->minY = cy - hy;                                                                   \
+    node->maxY = cy + hy;                                                                   \
+    node->depth = depth;                                                                    \
+    tree->nodes++;                                                                          \
+    if (depth > tree->depth) {                                                              \
+        tree->depth = depth;                                                                \
+    }                                                                                       \
+    return node;                                                                            \
+}                                                                                           \
+                                                                                            \
+static inline name *name##_new(coord_t cx, coord_t cy, coord_t hx, coord_t hy) {            \
+    name *tree = (name *)allocNode(sizeof(name));                                           \
+    assert(tree);                                                                           \
+    tree->root = name##_newNode(tree, cx, cy, hx, hy, 0);                                   \
+    return tree;                                                                            \
+}                                                                                           \
+                                                                                            \
+static inline int name##_quadrant(const name##_node *node, coord_t x, coord_t y) {          \
+    int east = x > node->cx;                                                                \
+    int north = y >= node->cy;                                                              \
+    return (east * 3) ^ north;                                                              \
+}                                                                                           \
+                                                                                            \
+static inline void name##_split(name *tree, name##_node *node) {                            \
+    coord_t hx = node->hx / 2;                                                              \
+    coord_t hy = node->hy / 2;                                                              \
+    for (int q = 0; q < 4; q++) {                                                           \
+        int east = q >= 2;                                                                  \
+        int north = q == 1 || q == 2;                                                       \
+        node->child[q] = name##_newNode(tree, east ? node->cx + hx : node->cx - hx,         \
+            north ? node->cy + hy : node->cy - hy, hx, hy, node->depth + 1);                \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+static inline int name##_insert(name *tree, coord_t x, coord_t y, payload_t item) {         \
+    name##_node *node = tree->root;                                                         \
+    if (x < node->minX || x > node->maxX || y < node->minY || y > node->maxY) {             \
+        return 0;                                                                           \
+    }                                                                                       \
+    for (;;) {                                                                              \
+        node->subtreeCount++;                                                               \
+        if (node->count < (capacity) && !node->child[0]) {                                  \
+            node->xs[node->count] = x;                                                      \
+            node->ys[node->count] = y;                                                      \
+            node->items[node->count++] = item;                                              \
+            tree->size++;                                                                   \
+            return 1;                                                                       \
+        }                                                                                   \
+        if (node->depth >= (maxDepth)) {                                                    \
+            if (!node->overflow) {                                                          \
+                node->overflow = name##_newNode(tree, node->cx, node->cy, node->hx,         \
+                    node->hy, node->depth);                                                 \
+            }                                                                               \
+            node = node->overflow;                                                          \
+            continue;                                                                       \
+        }                                                                                   \
+        if (!node->child[0]) {                                                              \
+            name##_split(tree, node);                                                       \
+        }                                                                                   \
+        node = node->child[name##_quadrant(node, x, y)];                                    \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+static inline unsigned name##_hits(const name##_node *node, coord_t minX, coord_t minY,     \
+    coord_t maxX, coord_t maxY) {                                                           \
+    unsigned hits = 0;                                                                      \
+    _Pragma("GCC unroll 32")                                                                \
+    for (int i = 0; i < (capacity); i++) {                                                  \
+        hits |= (unsigned)((node->xs[i] >= minX) & (node->xs[i] <= maxX) &                  \
+            (node->ys[i] >= minY) & (node->ys[i] <= maxY)) << i;                            \
+    }                                                                                       \
+    return hits & (unsigned)((1ULL << node->count) - 1);                                    \
+}                                                                                           \
+                                                                                            \
+static inline void name##_range(name *tree, coord_t minX, coord_t minY, coord_t maxX,       \
+    coord_t maxY, void (*visit)(payload_t item, void *arg),                                 \
+    void (*enter)(int quadrant, void *arg), void *arg) {                                    \
+                                                                                            \
+    /* Depth first, children pushed last to first so they are explored in quadrant order */ \
+    name##_node *stack[3 * (maxDepth) + 4];                                                 \
+    signed char quadrants[3 * (maxDepth) + 4];                                              \
+    unsigned char inside[3 * (maxDepth) + 4];                                               \
+    int top = 0;                                                                            \
+    stack[top] = tree->root;                                                                \
+    quadrants[top] = -1;                                                                    \
+    inside[top++] = 0;                                                                      \
+                                                                                            \
+    while (top > 0) {                                                                       \
+        top--;                                                                              \
+        name##_node *node = stack[top];                                                     \
+        if (enter && quadrants[top] >= 0) {                                                 \
+            enter(quadrants[top], arg);                                                     \
+        }                                                                                   \
+                                                                                            \
+        /* Nodes inside the query are emitted whole, without testing their points */        \
+        int whole = inside[top] || (node->minX >= minX && node->maxX <= maxX &&             \
+            node->minY >= minY && node->maxY <= maxY);                                      \
+        for (name##_node *n = node; n; n = n->overflow) {                                   \
+            unsigned hits = whole ? (unsigned)((1ULL << n->count) - 1) :                    \
+                name##_hits(n, minX, minY, maxX, maxY);                                     \
+            while (hits) {                                                                  \
+                visit(n->items[__builtin_ctz(hits)], arg);                                  \
+                hits &= hits - 1;                                                           \
+            }                                                                               \
+        }                                                                                   \
+                                                                                            \
+        if (!node->child[0]) {                                                              \
+            continue;                                                                       \
+        }                                                                                   \
+        for (int q = 3; q >= 0; q--) {                                                      \
+            name##_node *child = node->child[q];                                            \
+            if (child->count == 0 || (!whole && (child->maxX < minX ||                      \
+                child->minX > maxX || child->maxY < minY || child->minY > maxY))) {         \
+                continue;                                                                   \
+            }                                                                               \
+            stack[top] = child;                                                             \
+            quadrants[top] = (signed char)q;                                                \
+            inside[top++] = (unsigned char)whole;                                           \
+        }                                                                                   \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+static inline size_t name##_count(name *tree, coord_t minX, coord_t minY, coord_t maxX,     \
+    coord_t maxY) {                                                                         \
+    name##_node *stack[3 * (maxDepth) + 4];                                                 \
+    int top = 0;                                                                            \
+    size_t found = 0;                                                                       \
+    stack[top++] = tree->root;                                                              \
+                                                                                            \
+    while (top > 0) {                                                                       \
+        name##_node *node = stack[--top];                                                   \
+        if (node->minX >= minX && node->maxX <= maxX && node->minY >= minY &&               \
+            node->maxY <= maxY) {                                                           \
+            found += node->subtreeCount;                                                    \
+            continue;                                                                       \
+        }                                                                                   \
+        for (name##_node *n = node; n; n = n->overflow) {                                   \
+            found += __builtin_popcount(name##_hits(n, minX, minY, maxX, maxY));            \
+        }                                                                                   \
+        if (!node->child[0]) {                                                              \
+            continue;                                                                       \
+        }                                                                                   \
+        for (int q = 3; q >= 0; q--) {                                                      \
+            name##_node *child = node->child[q];                                            \
+            if (child->subtreeCount > 0 && child->maxX >= minX && child->minX <= maxX &&    \
+                child->maxY >= minY && child->minY <= maxY) {                               \
+                stack[top++] = child;                                                       \
+            }                                                                               \
+        }                                                                                   \
+    }                                                                                       \
+    return found;                                                                           \
+}                                                                                           \
+                                                                                            \
+static inline void name##_free(name *tree, void (*freeItem)(payload_t item)) {              \
+    name##_node *stack[3 * (maxDepth) + 4];                                                 \
+    int top = 0;                                                                            \
+    stack[top++] = tree->root;                                                              \
+                                                                                            \
+    while (top > 0) {                                                                       \
+        name##_node *node = stack[--top];                                                   \
+        if (node->child[0]) {                                                               \
+            for (int q = 3; q >= 0; q--) {                                                  \
+                stack[top++] = node->child[q];                                              \
+            }                                                                               \
+        }                                                                                   \
+        while (node) {                                                                      \
+            name##_node *overflow = node->overflow;                                         \
+            for (unsigned i = 0; freeItem && i < node->count; i++) {                        \
+                freeItem(node->items[i]);                                                   \
+            }                                                                               \
+            freeNode(node);                                                                 \
+            node = overflow;                                                                \
+        }                                                                                   \
+    }                                                                                       \
+    freeNode(tree);                                                                         \
+}
+
+#endif
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include "query_cache.h"
+#include "alloc_stats.h"
+
+#define INITIAL_BUCKETS 64
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define MAX_VARINT 10
+
+// data definitions
+
+/* One cached result, allocated in one block holding its key, path and encoded ids in that
+order. Ids are stored as the zigzag varint of their difference from the previous id, so the
+sorted ids of range results take a byte or two each */
+typedef struct cacheEntry {
+    uint64_t hash;
+    size_t numIds;
+    size_t keyLen;
+    size_t pathLen;
+    size_t encodedLen;
+    /* Bytes charged against the budget */
+    size_t bytes;
+    /* Neighbours in recency order, most recent first */
+    struct cacheEntry *newer;
+    struct cacheEntry *older;
+    /* Next entry in the same hash bucket */
+    struct cacheEntry *chain;
+    unsigned char data[];
+} cacheEntry;
+
+struct queryCache {
+    cacheEntry **buckets;
+    size_t numBuckets;
+    size_t numEntries;
+    size_t bytes;
+    size_t budget;
+    cacheEntry *newest;
+    cacheEntry *oldest;
+    const size_t *generation;
+    size_t seenGeneration;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t invalidations;
+    pthread_mutex_t lock;
+};
+
+// Returns the FNV-1a hash of a key
+static uint64_t hashKey(const char *key, size_t keyLen) {
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < keyLen; i++) {
+        hash = (hash ^ (unsigned char)key[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// Returns an entry's key
+static char *entryKey(cacheEntry *entry) {
+    return (char *)entry->data;
+}
+
+// Returns an entry's path, stored after its key
+static char *entryPath(cacheEntry *entry) {
+    return entryKey(entry) + entry->keyLen;
+}
+
+// Returns an entry's encoded ids, stored after its path
+static unsigned char *entryIds(cacheEntry *entry) {
+    return (unsigned char *)entryPath(entry) + entry->pathLen;
+}
+
+// Encodes the ids into out, which holds at least MAX_VARINT bytes per id, returning the bytes used
+static size_t encodeIds(const int *ids, size_t numIds, unsigned char *out) {
+    size_t len = 0;
+    int64_t previous = 0;
+    for (size_t i = 0; i < numIds; i++) {
+        int64_t delta = (int64_t)ids[i] - previous;
+        uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+        previous = ids[i];
+        while (zigzag >= 0x80) {
+            out[len++] = (unsigned char)(zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        out[len++] = (unsigned char)zigzag;
+    }
+    return len;
+}
+
+// Decodes numIds ids encoded by encodeIds
+static void decodeIds(const unsigned char *in, size_t numIds, int *ids) {
+    int64_t previous = 0;
+    for (size_t i = 0; i < numIds; i++) {
+        uint64_t zigzag = 0;
+        int shift = 0;
+        while (*in & 0x80) {
+            zigzag |= (uint64_t)(*in++ & 0x7F) << shift;
+            shift += 7;
+        }
+        zigzag |= (uint64_t)*in++ << shift;
+        previous += (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        ids[i] = (int)previous;
+    }
+}
+
+// Creates an empty cache holding at most budget bytes of entries
+queryCache *newQueryCache(size_t budget, const size_t *generation) {
+    queryCache *cache = (queryCache *)trackedMalloc(ALLOC_QUERY, sizeof(queryCache));
+    assert(cache);
+
+    cache->numBuckets = INITIAL_BUCKETS;
+    cache->buckets = (cacheEntry **)trackedCalloc(ALLOC_QUERY, cache->numBuckets, 
+        sizeof(cacheEntry *));
+    assert(cache->buckets);
+    cache->numEntries = 0;
+    cache->bytes = 0;
+    cache->budget = budget;
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->generation = generation;
+    cache->seenGeneration = *generation;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+    cache->invalidations = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+// Takes an entry out of the recency list
+static void unlinkRecency(queryCache *cache, cacheEntry *entry) {
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+}
+
+// Puts an entry at the most recently used end of the recency list
+static void linkNewest(queryCache *cache, cacheEntry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+// Removes an entry from its bucket and the recency list and frees it
+static void removeEntry(queryCache *cache, cacheEntry *entry) {
+    cacheEntry **link = &cache->buckets[entry->hash & (cache->numBuckets - 1)];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+
+    unlinkRecency(cache, entry);
+    cache->numEntries--;
+    cache->bytes -= entry->bytes;
+    trackedFree(ALLOC_QUERY, entry);
+}
+
+// Drops every entry if the index has changed since the cache was last used
+static void checkGeneration(queryCache *cache) {
+    if (*cache->generation == cache->seenGeneration) {
+        return;
+    }
+    while (cache->oldest) {
+        removeEntry(cache, cache->oldest);
+    }
+    cache->seenGeneration = *cache->generation;
+    cache->invalidations++;
+}
+
+// Returns the entry cached under the key, or NULL
+static cacheEntry *findEntry(queryCache *cache, const char *key, size_t keyLen, uint64_t hash) {
+    cacheEntry *entry = cache->buckets[hash & (cache->numBuckets - 1)];
+    for (; entry; entry = entry->chain) {
+        if (entry->hash == hash && entry->keyLen == keyLen &&
+            memcmp(entryKey(entry), key, keyLen) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Doubles the bucket array, rehashing every entry
+static void growBuckets(queryCache *cache) {
+    size_t numBuckets = cache->numBuckets * 2;
+    cacheEntry **buckets = (cacheEntry **)trackedCalloc(ALLOC_QUERY, numBuckets, 
+        sizeof(cacheEntry *));
+    assert(buckets);
+
+    for (size_t i = 0; i < cache->numBuckets; i++) {
+        cacheEntry *entry = cache->buckets[i];
+        while (entry) {
+            cacheEntry *next = entry->chain;
+            entry->chain = buckets[entry->hash & (numBuckets - 1)];
+            buckets[entry->hash & (numBuckets - 1)] = entry;
+            entry = next;
+        }
+    }
+
+    trackedFree(ALLOC_QUERY, cache->buckets);
+    cache->buckets = buckets;
+    cache->numBuckets = numBuckets;
+}
+
+// Copies the result cached under the key into out
+int cacheGet(queryCache *cache, const char *key, cachedResult *out) {
+    size_t keyLen = strlen(key);
+    uint64_t hash = hashKey(key, keyLen);
+
+    pthread_mutex_lock(&cache->lock);
+    checkGeneration(cache);
+
+    cacheEntry *entry = findEntry(cache, key, keyLen, hash);
+    if (!entry) {
+        cache->misses++;
+        pthread_mutex_unlock(&cache->lock);
+        return 0;
+    }
+    cache->hits++;
+    unlinkRecency(cache, entry);
+    linkNewest(cache, entry);
+
+    // The result is copied out so the entry may be evicted while the caller prints it
+    out->numIds = entry->numIds;
+    out->ids = (int *)trackedMalloc(ALLOC_QUERY, sizeof(int) * (entry->numIds + 1));
+    assert(out->ids);
+    decodeIds(entryIds(entry), entry->numIds, out->ids);
+    out->pathLen = entry->pathLen;
+    out->path = (char *)trackedMalloc(ALLOC_QUERY, entry->pathLen + 1);
+    assert(out->path);
+    memcpy(out->path, entryPath(entry), entry->pathLen);
+    out->path[entry->pathLen] = '\0';
+    pthread_mutex_unlock(&cache->lock);
+
+    return 1;
+}
+
+// Caches a copy of the result under the key
+void cachePut(queryCache *cache, const char *key, const int *ids, size_t numIds,
+    const char *path, size_t pathLen) {
+
+    size_t keyLen = strlen(key);
+    if (sizeof(cacheEntry) + keyLen + pathLen + numIds > cache->budget) {
+        return;
+    }
+    uint64_t hash = hashKey(key, keyLen);
+
+    // The entry is allocated for the longest encoding and shrunk once the ids are encoded
+    cacheEntry *entry = (cacheEntry *)trackedMalloc(ALLOC_QUERY, 
+        sizeof(cacheEntry) + keyLen + pathLen + MAX_VARINT * numIds);
+    assert(entry);
+    entry->hash = hash;
+    entry->numIds = numIds;
+    entry->keyLen = keyLen;
+    entry->pathLen = pathLen;
+    memcpy(entryKey(entry), key, keyLen);
+    memcpy(entryPath(entry), path, pathLen);
+    entry->encodedLen = encodeIds(ids, numIds, entryIds(entry));
+    size_t bytes = sizeof(cacheEntry) + keyLen + pathLen + entry->encodedLen;
+    entry = (cacheEntry *)trackedRealloc(ALLOC_QUERY, entry, bytes);
+    assert(entry);
+    entry->bytes = bytes;
+    if (bytes > cache->budget) {
+        trackedFree(ALLOC_QUERY, entry);
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    checkGeneration(cache);
+
+    // Another thread may have answered the same query first
+    cacheEntry *existing = findEntry(cache, key, keyLen, hash);
+    if (existing) {
+        removeEntry(cache, existing);
+    }
+    while (cache->bytes + bytes > cache->budget) {
+        removeEntry(cache, cache->oldest);
+        cache->evictions++;
+    }
+
+    if (cache->numEntries >= cache->numBuckets) {
+        growBuckets(cache);
+    }
+    entry->chain = cache->buckets[hash & (cache->numBuckets - 1)];
+    cache->buckets[hash & (cache->numBuckets - 1)] = entry;
+    linkNewest(cache, entry);
+    cache->numEntries++;
+    cache->bytes += bytes;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Frees the arrays of a result copied out of the cache
+void freeCachedResult(cachedResult *result) {
+    trackedFree(ALLOC_QUERY, result->ids);
+    trackedFree(ALLOC_QUERY, result->path);
+}
+
+// Prints the cache's counters and size as one JSON line
+void cacheReport(queryCache *cache, FILE *f) {
+    pthread_mutex_lock(&cache->lock);
+    fprintf(f, "{\"cache_hits\":%zu,\"cache_misses\":%zu,\"cache_evictions\":%zu,"
+        "\"cache_invalidations\":%zu,\"cache_entries\":%zu,\"cache_bytes\":%zu,"
+        "\"cache_budget\":%zu}\n", cache->hits, cache->misses, cache->evictions,
+        cache->invalidations, cache->numEntries, cache->bytes, cache->budget);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Frees the cache and every entry in it
+void freeQueryCache(queryCache *cache) {
+    if (!cache) {
+        return;
+    }
+    while (cache->oldest) {
+        removeEntry(cache, cache->oldest);
+    }
+    trackedFree(ALLOC_QUERY, cache->buckets);
+    pthread_mutex_destroy(&cache->lock);
+    trackedFree(ALLOC_QUERY, cache);
+}
@@ -0,0 +1,46 @@
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <stdio.h>
+
+// data definitions
+
+/* Least recently used cache of query results within a memory budget */
+typedef struct queryCache queryCache;
+
+/* A cached result: the ids of the records found, in output order, and the quadrants
+the search explored as printed to the summary file */
+typedef struct cachedResult {
+    int *ids;
+    size_t numIds;
+    char *path;
+    size_t pathLen;
+} cachedResult;
+
+// function definitions
+
+/* Creates an empty cache holding at most budget bytes of entries. Every entry is dropped
+whenever the counter at generation has changed since the cache was last used, so it should
+be a counter the index bumps on any mutation */
+queryCache *newQueryCache(size_t budget, const size_t *generation);
+
+/* Copies the result cached under the key into out, marking it most recently used, and
+returns 1 (TRUE); returns 0 (FALSE) on a miss. The caller frees out's arrays with
+freeCachedResult. Safe to call from several threads at once */
+int cacheGet(queryCache *cache, const char *key, cachedResult *out);
+
+/* Caches a copy of the result under the key, evicting least recently used entries to
+stay within the budget; results larger than the whole budget are not cached */
+void cachePut(queryCache *cache, const char *key, const int *ids, size_t numIds,
+    const char *path, size_t pathLen);
+
+/* Frees the arrays of a result copied out of the cache */
+void freeCachedResult(cachedResult *result);
+
+/* Prints the cache's hit, miss, eviction and invalidation counts and its size as one JSON line */
+void cacheReport(queryCache *cache, FILE *f);
+
+/* Frees the cache and every entry in it */
+void freeQueryCache(queryCache *cache);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "query_stats.h"
+
+/* Each thread counts and times the query it is running. */
+__thread queryCounters queryStatsCounters;
+static __thread struct timespec queryStart;
+
+/* Totals over all queries since the program started, shared by every thread. */
+static queryCounters totals;
+static latencyHistogram latencies;
+static pthread_mutex_t totalsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns the monotonic clock in nanoseconds
+static unsigned long long nowNs(struct timespec *ts) {
+    return (unsigned long long)ts->tv_sec * 1000000000ULL + (unsigned long long)ts->tv_nsec;
+}
+
+// Returns the monotonic clock in nanoseconds
+unsigned long long monotonicNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return nowNs(&now);
+}
+
+// Resets the counters and starts timing a query
+void queryStatsBegin(void) {
+    memset(&queryStatsCounters, 0, sizeof(queryCounters));
+    clock_gettime(CLOCK_MONOTONIC, &queryStart);
+}
+
+// Stops timing a query, adds it to the aggregate, and prints its counters to f if given
+void queryStatsEnd(FILE *f, size_t queryNumber) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    unsigned long long ns = nowNs(&end) - nowNs(&queryStart);
+
+    pthread_mutex_lock(&totalsLock);
+    latencyRecord(&latencies, ns);
+    totals.nodesVisited += queryStatsCounters.nodesVisited;
+    totals.inRectangleTests += queryStatsCounters.inRectangleTests;
+    totals.overlapTests += queryStatsCounters.overlapTests;
+    totals.pointsExamined += queryStatsCounters.pointsExamined;
+    totals.pointsReturned += queryStatsCounters.pointsReturned;
+    pthread_mutex_unlock(&totalsLock);
+
+    if (f) {
+        fprintf(f, "{\"query\":%zu,\"nodes_visited\":%zu,\"in_rectangle_tests\":%zu,"
+            "\"overlap_tests\":%zu,\"points_examined\":%zu,\"points_returned\":%zu,\"ns\":%llu}\n",
+            queryNumber, queryStatsCounters.nodesVisited, queryStatsCounters.inRectangleTests,
+            queryStatsCounters.overlapTests, queryStatsCounters.pointsExamined,
+            queryStatsCounters.pointsReturned, ns);
+    }
+}
+
+// Returns the histogram bucket holding the given latency
+static size_t latencyBucket(unsigned long long ns) {
+    if (ns < LATENCY_SUB_BUCKETS) {
+        return ns;
+    }
+
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - LATENCY_SUB_BITS;
+    size_t sub = (ns >> shift) & (LATENCY_SUB_BUCKETS - 1);
+
+    return LATENCY_SUB_BUCKETS + (size_t)shift * LATENCY_SUB_BUCKETS + sub;
+}
+
+// Returns the highest latency counted in the given bucket
+static unsigned long long bucketUpperBound(size_t bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int shift = (bucket - LATENCY_SUB_BUCKETS) / LATENCY_SUB_BUCKETS;
+    unsigned long long sub = (bucket - LATENCY_SUB_BUCKETS) % LATENCY_SUB_BUCKETS;
+
+    return ((LATENCY_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+// Adds a latency in nanoseconds to the histogram
+void latencyRecord(latencyHistogram *h, unsigned long long ns) {
+    size_t bucket = latencyBucket(ns);
+    if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+
+    h->counts[bucket]++;
+    h->total++;
+    if (ns > h->maxNs) {
+        h->maxNs = ns;
+    }
+}
+
+// Returns the latency in nanoseconds at or below which the given fraction of samples fall
+unsigned long long latencyPercentile(latencyHistogram *h, double fraction) {
+    if (h->total == 0) {
+        return 0;
+    }
+
+    // Rank of the sample wanted, counting from 1
+    size_t rank = (size_t)(fraction * h->total);
+    if (rank < fraction * h->total) {
+        rank++;
+    }
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    size_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            unsigned long long upper = bucketUpperBound(i);
+            return upper < h->maxNs ? upper : h->maxNs;
+        }
+    }
+
+    return h->maxNs;
+}
+
+// Prints the aggregated counters and latency percentiles of all queries as one JSON line
+void queryStatsReport(FILE *f) {
+    pthread_mutex_lock(&totalsLock);
+    fprintf(f, "{\"queries\":%zu,\"nodes_visited\":%zu,\"in_rectangle_tests\":%zu,"
+        "\"overlap_tests\":%zu,\"points_examined\":%zu,\"points_returned\":%zu,"
+        "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+        latencies.total, totals.nodesVisited, totals.inRectangleTests, totals.overlapTests,
+        totals.pointsExamined, totals.pointsReturned,
+        latencyPercentile(&latencies, 0.5), latencyPercentile(&latencies, 0.99),
+        latencyPercentile(&latencies, 0.999), latencies.maxNs);
+    pthread_mutex_unlock(&totalsLock);
+}
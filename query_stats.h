@@ -0,0 +1,58 @@
+#ifndef QUERY_STATS_H
+#define QUERY_STATS_H
+
+#include <stdio.h>
+
+/* Latency histogram layout: exact buckets below LATENCY_SUB_BUCKETS ns, then
+LATENCY_SUB_BUCKETS log-linear buckets per power of two (about 6% precision) */
+#define LATENCY_SUB_BUCKETS 16
+#define LATENCY_SUB_BITS 4
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS * 61)
+
+// data definitions
+typedef struct queryCounters {
+    size_t nodesVisited;
+    size_t inRectangleTests;
+    size_t overlapTests;
+    size_t pointsExamined;
+    size_t pointsReturned;
+} queryCounters;
+
+typedef struct latencyHistogram {
+    size_t counts[LATENCY_BUCKETS];
+    size_t total;
+    unsigned long long maxNs;
+} latencyHistogram;
+
+/* Counters of the query currently being run by the calling thread */
+extern __thread queryCounters queryStatsCounters;
+
+/* Counting compiles away entirely when built with -DNO_QUERY_STATS */
+#ifdef NO_QUERY_STATS
+#define QUERY_STAT_ADD(field, n) ((void)0)
+#else
+#define QUERY_STAT_ADD(field, n) (queryStatsCounters.field += (n))
+#endif
+
+// function definitions
+
+/* Returns the monotonic clock in nanoseconds */
+unsigned long long monotonicNs(void);
+
+/* Resets the counters and starts timing a query */
+void queryStatsBegin(void);
+
+/* Stops timing a query, adds it to the aggregate, and prints its counters to f if given;
+safe to call from several threads at once */
+void queryStatsEnd(FILE *f, size_t queryNumber);
+
+/* Adds a latency in nanoseconds to the histogram */
+void latencyRecord(latencyHistogram *h, unsigned long long ns);
+
+/* Returns the latency in nanoseconds at or below which the given fraction of samples fall */
+unsigned long long latencyPercentile(latencyHistogram *h, double fraction);
+
+/* Prints the aggregated counters and latency percentiles of all queries as one JSON line */
+void queryStatsReport(FILE *f);
+
+#endif
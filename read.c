@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <string.h>
 #include "read.h"
+#include "alloc_stats.h"
 #include "record_struct.h"
 #include "record_struct.c"
 
@@ -21,7 +22,21 @@ if parsing was unsuccessful.
 */
 struct csvRecord *parseLine(char *line);
 
+/* As parseLine, but splits the line in place and keeps one copy of it holding every field. */
+struct csvRecord *parseLineInPlace(char *line);
+
+/* Reads every line after the header with the given parser, returning the records parsed. */
+struct csvRecord **readLines(FILE *csvFile, int *n, struct csvRecord *(*parse)(char *line));
+
 struct csvRecord **readCSV(FILE *csvFile, int *n){
+    return readLines(csvFile, n, parseLine);
+}
+
+struct csvRecord **readCSVInPlace(FILE *csvFile, int *n){
+    return readLines(csvFile, n, parseLineInPlace);
+}
+
+struct csvRecord **readLines(FILE *csvFile, int *n, struct csvRecord *(*parse)(char *line)){
     struct csvRecord **records = NULL;
     int numRecords = 0;
     int spaceRecords = 0;
@@ -42,27 +57,26 @@ struct csvRecord **readCSV(FILE *csvFile, int *n){
         }
         if(spaceRecords == 0){
             records = (struct csvRecord **) 
-                malloc(sizeof(struct csvRecord *) * INIT_RECORDS);
+                trackedMalloc(ALLOC_CSV, sizeof(struct csvRecord *) * INIT_RECORDS);
             assert(records);
             spaceRecords = INIT_RECORDS;
         } else if(numRecords >= spaceRecords){
             spaceRecords *= 2;
             records = (struct csvRecord **)
-                realloc(records, sizeof(struct csvRecord *) * spaceRecords);
+                trackedRealloc(ALLOC_CSV, records, sizeof(struct csvRecord *) * spaceRecords);
             assert(records);
         }
-        records[numRecords] = parseLine(line);
+        records[numRecords] = parse(line);
         if(records[numRecords]){
             numRecords++;
         }
     }
-    if(line){
-        free(line);
-    }
+    trackedAdopt(ALLOC_CSV, line);
+    trackedFree(ALLOC_CSV, line);
 
     /* Shrink. */
     records = (struct csvRecord **)
-                realloc(records, sizeof(struct csvRecord *) * numRecords);
+                trackedRealloc(ALLOC_CSV, records, sizeof(struct csvRecord *) * numRecords);
     assert(records);
 
     *n = numRecords;
@@ -74,7 +88,7 @@ struct csvRecord **readCSV(FILE *csvFile, int *n){
     string one character back for every quote seen. */
 struct csvRecord *parseLine(char *line){
     struct csvRecord *ret = NULL;
-    char **fields = (char **) malloc(sizeof(char *) * NUM_FIELDS);
+    char **fields = (char **) trackedMalloc(ALLOC_CSV, sizeof(char *) * NUM_FIELDS);
     assert(fields);
     int fieldNum = 0;
     int len = strlen(line);
@@ -85,6 +99,7 @@ struct csvRecord *parseLine(char *line){
     }
     /* Check for empty lines. */
     if(len == 0){
+        trackedFree(ALLOC_CSV, fields);
         return NULL;
     }
 
@@ -111,7 +126,7 @@ struct csvRecord *parseLine(char *line){
                 /* Terminate */
                 line[progress] = '\0';
                 assert(fieldNum < NUM_FIELDS);
-                fields[fieldNum] = strdup(line + start);
+                fields[fieldNum] = trackedStrdup(ALLOC_CSV, line + start);
                 assert(fields[fieldNum]);
                 fieldNum++;
                 start = progress + 1;
@@ -137,10 +152,68 @@ struct csvRecord *parseLine(char *line){
         }
     }
 
-    ret = (struct csvRecord *) malloc(sizeof(struct csvRecord));
+    ret = (struct csvRecord *) trackedMalloc(ALLOC_CSV, sizeof(struct csvRecord));
     assert(ret);
     ret->fieldCount = fieldNum;
     ret->fields = fields;
+    ret->inPlace = 0;
+    ret->line = NULL;
+
+    return ret;
+}
+
+struct csvRecord *parseLineInPlace(char *line){
+    int len = strlen(line);
+    while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')){
+        line[--len] = '\0';
+    }
+    if(len == 0){
+        return NULL;
+    }
+
+    /* 
+    One pass terminates each field where its comma was, dropping the quotes around 
+    quoted fields by writing each character back over the gap they leave. 
+    */
+    int fieldStarts[NUM_FIELDS];
+    int fieldNum = 0;
+    int start = 0;
+    int written = 0;
+    int inQuotes = 0;
+    for(int progress = 0; progress <= len; progress++){
+        char c = line[progress];
+        if(c == '\"'){
+            inQuotes = ! inQuotes;
+        } else if((c == ',' || c == '\0') && ! inQuotes){
+            assert(c != '\0' || fieldNum == (NUM_FIELDS - 1));
+            assert(fieldNum < NUM_FIELDS);
+            if(written > start && line[start] == '\"'){
+                assert(written - start >= 2 && line[written - 1] == '\"');
+                memmove(line + start, line + start + 1, written - start - 2);
+                written -= 2;
+            }
+            line[written++] = '\0';
+            fieldStarts[fieldNum++] = start;
+            start = written;
+            continue;
+        }
+        assert(c != '\0');
+        line[written++] = c;
+    }
+    assert(fieldNum == NUM_FIELDS);
+
+    struct csvRecord *ret = (struct csvRecord *) trackedMalloc(ALLOC_CSV, sizeof(struct csvRecord));
+    assert(ret);
+    ret->fields = (char **) trackedMalloc(ALLOC_CSV, sizeof(char *) * NUM_FIELDS);
+    assert(ret->fields);
+    ret->line = (char *) trackedMalloc(ALLOC_DICT, written);
+    assert(ret->line);
+    memcpy(ret->line, line, written);
+    for(int i = 0; i < NUM_FIELDS; i++){
+        ret->fields[i] = ret->line + fieldStarts[i];
+    }
+    ret->fieldCount = fieldNum;
+    ret->inPlace = 1;
 
     return ret;
 }
@@ -149,6 +222,7 @@ char *getQuery(FILE *f){
     char *line = NULL;
     size_t size = 0;
     if(getline(&line, &size, f) > 0){
+        trackedAdopt(ALLOC_QUERY, line);
         while(strlen(line) > 0 && (line[strlen(line) - 1] == '\n' 
                 || line[strlen(line) - 1] == '\r')){
             line[strlen(line) - 1] = '\0';
@@ -167,11 +241,17 @@ void freeCSV(struct csvRecord **dataset, int n){
         return;
     }
     for(int i = 0; i < n; i++){
-        for(int j = 0; j < dataset[i]->fieldCount; j++){
-            free(dataset[i]->fields[j]);
+        if(dataset[i]->inPlace){
+            if(dataset[i]->line){
+                trackedFree(ALLOC_DICT, dataset[i]->line);
+            }
+        } else {
+            for(int j = 0; j < dataset[i]->fieldCount; j++){
+                trackedFree(ALLOC_CSV, dataset[i]->fields[j]);
+            }
         }
-        free(dataset[i]->fields);
-        free(dataset[i]);
+        trackedFree(ALLOC_CSV, dataset[i]->fields);
+        trackedFree(ALLOC_CSV, dataset[i]);
     }
-    free(dataset);
+    trackedFree(ALLOC_CSV, dataset);
 }
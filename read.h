@@ -9,7 +9,11 @@
 /* Returns a list of CSV records. */
 struct csvRecord **readCSV(FILE *csvFile, int *n);
 
-/* Read a line of input from the given file. */
+/* Returns a list of CSV records, each split in place within one copy of its line; the 
+lines are charged to ALLOC_DICT, as lazily read records keep them as their text. */
+struct csvRecord **readCSVInPlace(FILE *csvFile, int *n);
+
+/* Read a line of input from the given file, charged to ALLOC_QUERY for the caller to free. */
 char *getQuery(FILE *f);
 
 /* Free a set of records. */
@@ -9,4 +9,8 @@
 struct csvRecord {
     int fieldCount;
     char **fields;
+    /* Whether the fields point into one copy of the line rather than each being allocated. */
+    int inPlace;
+    /* For records split in place, that copy, or NULL once a lazily read record takes it. */
+    char *line;
 };
@@ -0,0 +1,503 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+#include "alloc_stats.h"
+
+/* Events handled per epoll_wait call */
+#define SERVER_MAX_EVENTS 64
+
+/* Bytes read from a client at a time */
+#define SERVER_READ_SIZE 4096
+
+/* Requests of a client wait while this many bytes of its replies are unsent */
+#define SERVER_MAX_UNSENT (1 << 20)
+
+/* Longest request line accepted, and so the most a client's unread requests may hold; a
+longer line is answered with an error and the connection closed */
+#define SERVER_MAX_REQUEST (1 << 16)
+
+// data definitions
+
+/* A connected client, only ever touched by the event loop */
+typedef struct serverClient {
+    int fd;
+    /* Bytes received but not yet taken as requests */
+    char *in;
+    size_t inLen;
+    size_t inCap;
+    /* Replies waiting to be sent */
+    char *out;
+    size_t outLen;
+    size_t outSent;
+    /* Set while one of the client's requests is with the workers */
+    int busy;
+    /* Set once the client has closed its end or the connection failed */
+    int closed;
+    /* Set while the client's socket is registered with epoll */
+    int watched;
+    struct serverClient *prev;
+    struct serverClient *next;
+} serverClient;
+
+/* One request line and, once a worker has answered it, its reply */
+typedef struct serverJob {
+    serverClient *client;
+    char *request;
+    char *reply;
+    size_t replyLen;
+    struct serverJob *next;
+} serverJob;
+
+typedef struct serverState {
+    requestHandler handler;
+    void *arg;
+    int epollFd;
+    int listenFd;
+    int wakeFd;
+    int signalFd;
+    serverClient *clients;
+    /* Clients dropped during the current batch of events, freed once it is handled */
+    serverClient *dropped;
+
+    /* Guards the job lists and stopping flag, shared with the workers */
+    pthread_mutex_t lock;
+    pthread_cond_t jobReady;
+    serverJob *pendingHead;
+    serverJob *pendingTail;
+    serverJob *done;
+    int stopping;
+} serverState;
+
+// Answers jobs until the server stops, handing each reply back to the event loop
+static void *serverWorker(void *p) {
+    serverState *state = (serverState *)p;
+
+    pthread_mutex_lock(&state->lock);
+    while (1) {
+        while (!state->pendingHead && !state->stopping) {
+            pthread_cond_wait(&state->jobReady, &state->lock);
+        }
+        if (!state->pendingHead) {
+            break;
+        }
+
+        serverJob *job = state->pendingHead;
+        state->pendingHead = job->next;
+        if (!state->pendingHead) {
+            state->pendingTail = NULL;
+        }
+        pthread_mutex_unlock(&state->lock);
+
+        FILE *f = open_memstream(&job->reply, &job->replyLen);
+        assert(f);
+        state->handler(job->request, f, state->arg);
+        fputs(SERVER_REPLY_END, f);
+        fclose(f);
+        trackedAdopt(ALLOC_QUERY, job->reply);
+
+        pthread_mutex_lock(&state->lock);
+        job->next = state->done;
+        state->done = job;
+
+        // Wakes the event loop; the counter cannot overflow at one per reply
+        uint64_t one = 1;
+        ssize_t written = write(state->wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return NULL;
+}
+
+// Registers the events the event loop currently wants from a client; a client wanting
+// none is unregistered, since a hung up socket would otherwise be reported forever. Nothing
+// more is read while a request is with the workers or the client's buffer is full, so a
+// client sending without pause holds at most SERVER_MAX_REQUEST bytes of the server's memory
+static void watchClient(serverState *state, serverClient *client) {
+    int reading = !client->closed && !client->busy && client->inLen < SERVER_MAX_REQUEST;
+    struct epoll_event ev;
+    ev.events = (reading ? EPOLLIN : 0) | (client->outSent < client->outLen ? EPOLLOUT : 0);
+    ev.data.ptr = client;
+
+    if (ev.events == 0) {
+        if (client->watched) {
+            epoll_ctl(state->epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+            client->watched = 0;
+        }
+        return;
+    }
+
+    epoll_ctl(state->epollFd, client->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, client->fd, &ev);
+    client->watched = 1;
+}
+
+// Closes a client's connection, leaving it to be freed after the current batch of events
+static void dropClient(serverState *state, serverClient *client) {
+    if (client->watched) {
+        epoll_ctl(state->epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+    }
+    close(client->fd);
+    client->fd = -1;
+
+    if (client->prev) {
+        client->prev->next = client->next;
+    } else {
+        state->clients = client->next;
+    }
+    if (client->next) {
+        client->next->prev = client->prev;
+    }
+
+    client->next = state->dropped;
+    state->dropped = client;
+}
+
+// Frees the clients dropped during the last batch of events
+static void freeDropped(serverState *state) {
+    while (state->dropped) {
+        serverClient *next = state->dropped->next;
+        trackedFree(ALLOC_QUERY, state->dropped->in);
+        trackedFree(ALLOC_QUERY, state->dropped->out);
+        trackedFree(ALLOC_QUERY, state->dropped);
+        state->dropped = next;
+    }
+}
+
+// Accepts every waiting connection
+static void acceptClients(serverState *state) {
+    int fd;
+    while ((fd = accept4(state->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        serverClient *client = (serverClient *)trackedCalloc(ALLOC_QUERY, 1, sizeof(serverClient));
+        assert(client);
+        client->fd = fd;
+        client->watched = 1;
+
+        client->next = state->clients;
+        if (state->clients) {
+            state->clients->prev = client;
+        }
+        state->clients = client;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = client;
+        epoll_ctl(state->epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+// Reads what the client has sent until its buffer holds SERVER_MAX_REQUEST bytes, noting
+// when it has closed its end
+static void readClient(serverClient *client) {
+    while (client->inLen < SERVER_MAX_REQUEST) {
+        if (client->inCap - client->inLen < SERVER_READ_SIZE && client->inCap < SERVER_MAX_REQUEST) {
+            client->inCap = client->inCap * 2 + SERVER_READ_SIZE;
+            if (client->inCap > SERVER_MAX_REQUEST) {
+                client->inCap = SERVER_MAX_REQUEST;
+            }
+            client->in = (char *)trackedRealloc(ALLOC_QUERY, client->in, client->inCap);
+            assert(client->in);
+        }
+
+        ssize_t got = read(client->fd, client->in + client->inLen, client->inCap - client->inLen);
+        if (got > 0) {
+            client->inLen += got;
+        } else if (got < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                client->closed = 1;
+            }
+            return;
+        }
+    }
+}
+
+// Sends as much of the client's waiting replies as the socket takes
+static void flushClient(serverClient *client) {
+    while (client->outSent < client->outLen) {
+        ssize_t sent = send(client->fd, client->out + client->outSent,
+            client->outLen - client->outSent, MSG_NOSIGNAL);
+        if (sent > 0) {
+            client->outSent += sent;
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else {
+            // Replies to, and requests from, a client that has gone away are dropped
+            if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                client->closed = 1;
+                client->outSent = client->outLen;
+                client->inLen = 0;
+            }
+            break;
+        }
+    }
+
+    if (client->outSent == client->outLen) {
+        client->outSent = 0;
+        client->outLen = 0;
+    }
+}
+
+// Answers a request line too long to accept with an error, discarding everything the client
+// has sent and closing the connection once the replies before it have been sent
+static void rejectRequest(serverClient *client) {
+    char reply[128];
+    int len = snprintf(reply, sizeof(reply), "Request longer than %d bytes\n%s",
+        SERVER_MAX_REQUEST - 1, SERVER_REPLY_END);
+    client->out = (char *)trackedRealloc(ALLOC_QUERY, client->out, client->outLen + len);
+    assert(client->out);
+    memcpy(client->out + client->outLen, reply, len);
+    client->outLen += len;
+    client->inLen = 0;
+    client->closed = 1;
+    flushClient(client);
+}
+
+// Hands the client's next complete request line (or, once it has closed, its last
+// unterminated line) to the workers, one request at a time to keep replies in order
+static void dispatchRequest(serverState *state, serverClient *client) {
+    if (client->busy || client->inLen == 0 || client->outLen - client->outSent > SERVER_MAX_UNSENT) {
+        return;
+    }
+
+    char *newline = memchr(client->in, '\n', client->inLen);
+    if (!newline && client->inLen >= SERVER_MAX_REQUEST) {
+        rejectRequest(client);
+        return;
+    }
+    if (!newline && !client->closed) {
+        return;
+    }
+    size_t lineLen = newline ? (size_t)(newline - client->in) : client->inLen;
+    size_t consumed = newline ? lineLen + 1 : lineLen;
+    if (lineLen > 0 && client->in[lineLen - 1] == '\r') {
+        lineLen--;
+    }
+
+    serverJob *job = (serverJob *)trackedCalloc(ALLOC_QUERY, 1, sizeof(serverJob));
+    assert(job);
+    job->client = client;
+    job->request = (char *)trackedMalloc(ALLOC_QUERY, lineLen + 1);
+    assert(job->request);
+    memcpy(job->request, client->in, lineLen);
+    job->request[lineLen] = '\0';
+
+    memmove(client->in, client->in + consumed, client->inLen - consumed);
+    client->inLen -= consumed;
+    client->busy = 1;
+
+    pthread_mutex_lock(&state->lock);
+    if (state->pendingTail) {
+        state->pendingTail->next = job;
+    } else {
+        state->pendingHead = job;
+    }
+    state->pendingTail = job;
+    pthread_cond_signal(&state->jobReady);
+    pthread_mutex_unlock(&state->lock);
+}
+
+// Moves on a client after any change: sends replies, dispatches its next request,
+// and drops it once it has closed with nothing left to answer or send
+static void serviceClient(serverState *state, serverClient *client) {
+    flushClient(client);
+    dispatchRequest(state, client);
+
+    if (client->closed && !client->busy && client->inLen == 0 && client->outLen == 0) {
+        dropClient(state, client);
+        return;
+    }
+    watchClient(state, client);
+}
+
+// Queues the replies the workers have finished onto their clients
+static void collectReplies(serverState *state) {
+    uint64_t count;
+    ssize_t got = read(state->wakeFd, &count, sizeof(count));
+    (void)got;
+
+    pthread_mutex_lock(&state->lock);
+    serverJob *job = state->done;
+    state->done = NULL;
+    pthread_mutex_unlock(&state->lock);
+
+    while (job) {
+        serverJob *next = job->next;
+        serverClient *client = job->client;
+
+        if (client->outLen + job->replyLen > 0) {
+            client->out = (char *)trackedRealloc(ALLOC_QUERY, client->out, 
+                client->outLen + job->replyLen);
+            assert(client->out);
+        }
+        memcpy(client->out + client->outLen, job->reply, job->replyLen);
+        client->outLen += job->replyLen;
+        client->busy = 0;
+
+        trackedFree(ALLOC_QUERY, job->request);
+        trackedFree(ALLOC_QUERY, job->reply);
+        trackedFree(ALLOC_QUERY, job);
+
+        serviceClient(state, client);
+        job = next;
+    }
+}
+
+// Creates the listening socket at the path, replacing a stale socket left there
+static int listenOn(const char *socketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", socketPath);
+        return -1;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    struct stat st;
+    if (stat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socketPath);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", socketPath, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    return fd;
+}
+
+// Adds one of the server's own descriptors to the event loop
+static void watchFd(serverState *state, int *fd) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = fd;
+    epoll_ctl(state->epollFd, EPOLL_CTL_ADD, *fd, &ev);
+}
+
+// Answers requests from clients of a Unix domain socket until SIGINT or SIGTERM
+int serveRequests(const char *socketPath, int numWorkers, requestHandler handler, void *arg) {
+    serverState state;
+    memset(&state, 0, sizeof(state));
+    state.handler = handler;
+    state.arg = arg;
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.jobReady, NULL);
+
+    state.listenFd = listenOn(socketPath);
+    if (state.listenFd < 0) {
+        return -1;
+    }
+
+    // Stop signals are read by the event loop; workers inherit the blocked mask
+    sigset_t stopSignals, oldMask;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &oldMask);
+
+    state.signalFd = signalfd(-1, &stopSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+    state.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    state.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    assert(state.signalFd >= 0 && state.wakeFd >= 0 && state.epollFd >= 0);
+    watchFd(&state, &state.listenFd);
+    watchFd(&state, &state.wakeFd);
+    watchFd(&state, &state.signalFd);
+
+    if (numWorkers < 1) {
+        numWorkers = 1;
+    }
+    pthread_t *workers = (pthread_t *)trackedMalloc(ALLOC_QUERY, sizeof(pthread_t) * numWorkers);
+    assert(workers);
+    for (int i = 0; i < numWorkers; i++) {
+        int created = pthread_create(&workers[i], NULL, serverWorker, &state);
+        assert(created == 0);
+    }
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int running = 1;
+    while (running) {
+        int n = epoll_wait(state.epollFd, events, SERVER_MAX_EVENTS, -1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        assert(n >= 0);
+
+        for (int i = 0; i < n; i++) {
+            void *source = events[i].data.ptr;
+            if (source == &state.listenFd) {
+                acceptClients(&state);
+            } else if (source == &state.wakeFd) {
+                collectReplies(&state);
+            } else if (source == &state.signalFd) {
+                // Every stop signal is read, so none is still pending once the old mask returns
+                struct signalfd_siginfo info;
+                while (read(state.signalFd, &info, sizeof(info)) == sizeof(info)) {
+                }
+                running = 0;
+            } else {
+                // Skip clients dropped earlier in this batch
+                serverClient *client = (serverClient *)source;
+                if (client->fd < 0) {
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    readClient(client);
+                }
+                serviceClient(&state, client);
+            }
+        }
+        freeDropped(&state);
+    }
+
+    // Requests already with the workers are answered, then every client is dropped
+    pthread_mutex_lock(&state.lock);
+    state.stopping = 1;
+    pthread_cond_broadcast(&state.jobReady);
+    pthread_mutex_unlock(&state.lock);
+    for (int i = 0; i < numWorkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    trackedFree(ALLOC_QUERY, workers);
+
+    for (serverJob *job = state.done; job; ) {
+        serverJob *next = job->next;
+        trackedFree(ALLOC_QUERY, job->request);
+        trackedFree(ALLOC_QUERY, job->reply);
+        trackedFree(ALLOC_QUERY, job);
+        job = next;
+    }
+    while (state.clients) {
+        dropClient(&state, state.clients);
+    }
+    freeDropped(&state);
+
+    close(state.epollFd);
+    close(state.wakeFd);
+    close(state.signalFd);
+    close(state.listenFd);
+    unlink(socketPath);
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+    pthread_mutex_destroy(&state.lock);
+    pthread_cond_destroy(&state.jobReady);
+
+    return 0;
+}
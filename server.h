@@ -0,0 +1,28 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+
+/* Worker threads answering requests when no count is given */
+#define SERVER_DEFAULT_WORKERS 4
+
+/* Line ending each reply, so clients know where one reply stops */
+#define SERVER_REPLY_END "\n"
+
+// data definitions
+
+/* Answers one request line (without its newline), writing the reply to f; called from
+several worker threads at once */
+typedef void (*requestHandler)(char *request, FILE *f, void *arg);
+
+// function definitions
+
+/* Listens on a Unix domain socket at the given path and answers each line sent by any
+client with the handler, using an epoll event loop and a pool of worker threads. Replies
+to a client are sent in the order of its requests, each followed by SERVER_REPLY_END.
+A line too long to accept is answered with an error and its connection closed.
+Runs until SIGINT or SIGTERM is received, returning 0, or returns -1 if the socket cannot
+be set up. */
+int serveRequests(const char *socketPath, int numWorkers, requestHandler handler, void *arg);
+
+#endif
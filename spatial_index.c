@@ -0,0 +1,714 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "spatial_index.h"
+#include "alloc_stats.h"
+
+/* Copies of points gathered from shards which do not keep points, per thread */
+typedef struct gatheredPoints {
+    size_t capacity;
+    point2D points[];
+} gatheredPoints;
+
+/* Results of the shards searched so far by one query */
+typedef struct shardGather {
+    point2D **result;
+    size_t count;
+    size_t capacity;
+    gatheredPoints *copies;
+    int copying;
+} shardGather;
+
+static pthread_key_t gatheredKey;
+static pthread_once_t gatheredOnce = PTHREAD_ONCE_INIT;
+
+// Returns the engine named by the given string, or ENGINE_UNKNOWN
+int parseEngine(const char *name) {
+    if (strcmp(name, "pointer") == 0) {
+        return ENGINE_POINTER;
+    }
+    if (strcmp(name, "linear") == 0) {
+        return ENGINE_LINEAR;
+    }
+    if (strcmp(name, "compact") == 0) {
+        return ENGINE_COMPACT;
+    }
+    if (strcmp(name, "specialised") == 0) {
+        return ENGINE_SPECIALISED;
+    }
+    if (strcmp(name, "disk") == 0) {
+        return ENGINE_DISK;
+    }
+
+    return ENGINE_UNKNOWN;
+}
+
+// Creates an empty index of the given engine covering the root rectangle
+spatialIndex *newSpatialIndex(rectangle2D *boundary, int engine) {
+    spatialIndex *index = (spatialIndex *)trackedMalloc(ALLOC_TREE, sizeof(spatialIndex));
+    assert(index);
+
+    index->engine = engine;
+    index->boundary = boundary;
+    index->qt = NULL;
+    index->lqt = NULL;
+    index->fqt = NULL;
+    index->pqt = NULL;
+    index->aggSpec = NULL;
+    index->summarySpec = NULL;
+    index->generation = 0;
+    index->hasPoints = 0;
+    index->numShards = 0;
+    index->shards = NULL;
+
+    // The compact engine is a linear quadtree switched to compact mode once given its resolver
+    if (engine == ENGINE_POINTER) {
+        index->qt = new_Quadtree(boundary);
+    } else if (engine == ENGINE_SPECIALISED) {
+        index->fqt = newFootpathTree(boundary);
+    } else if (engine == ENGINE_DISK) {
+        index->pqt = newPagedQuadtree(boundary);
+    } else {
+        index->lqt = new_LinearQuadtree(boundary);
+    }
+
+    return index;
+}
+
+// Creates an index split into the given number of empty shards
+spatialIndex *newShardedIndex(rectangle2D *boundary, int engine, int numShards) {
+    assert(numShards > 0);
+    spatialIndex *index = newSpatialIndex(boundary, engine);
+
+    index->numShards = numShards;
+    index->shards = (spatialIndex **)trackedMalloc(ALLOC_TREE, sizeof(spatialIndex *) * numShards);
+    assert(index->shards);
+    for (int i = 0; i < numShards; i++) {
+        index->shards[i] = newSpatialIndex(boundary, engine);
+    }
+
+    return index;
+}
+
+// Returns 1 (TRUE) if some point of the shard may lie within the rectangle
+static int shardMayHold(spatialIndex *shard, rectangle2D *range) {
+    return shard->hasPoints &&
+        shard->minX <= range->center->x + range->x_half && 
+        shard->maxX >= range->center->x - range->x_half &&
+        shard->minY <= range->center->y + range->y_half && 
+        shard->maxY >= range->center->y - range->y_half;
+}
+
+// Frees a thread's gathered points as it exits
+static void freeGathered(void *copies) {
+    trackedFree(ALLOC_QUERY, copies);
+}
+
+// Creates the key of each thread's gathered points, which are freed as the thread exits
+static void createGatheredKey(void) {
+    int created = pthread_key_create(&gatheredKey, freeGathered);
+    assert(created == 0);
+}
+
+// Returns an empty gather of shard results
+static shardGather newShardGather(spatialIndex *index) {
+    shardGather gather = {NULL, 0, 0, NULL, 0};
+    if (!indexKeepsPoints(index)) {
+        gather.copying = 1;
+        pthread_once(&gatheredOnce, createGatheredKey);
+        gather.copies = (gatheredPoints *)pthread_getspecific(gatheredKey);
+    }
+    return gather;
+}
+
+// Adds a shard's NULL-terminated result to the gather, freeing it. Points of shards which
+// rebuild them for every search are copied at once, as the next shard's search overwrites them
+static void gatherShard(shardGather *gather, point2D **part) {
+    size_t count = 0;
+    while (part[count] != NULL) {
+        count++;
+    }
+
+    if (gather->copying) {
+        if (!gather->copies || gather->copies->capacity < gather->count + count) {
+            size_t capacity = 2 * (gather->count + count);
+            gather->copies = (gatheredPoints *)trackedRealloc(ALLOC_QUERY, gather->copies, 
+                sizeof(gatheredPoints) + sizeof(point2D) * capacity);
+            assert(gather->copies);
+            gather->copies->capacity = capacity;
+            pthread_setspecific(gatheredKey, gather->copies);
+        }
+        for (size_t i = 0; i < count; i++) {
+            gather->copies->points[gather->count++] = *part[i];
+        }
+    } else {
+        if (gather->capacity < gather->count + count + 1) {
+            gather->capacity = 2 * (gather->count + count + 1);
+            gather->result = (point2D **)trackedRealloc(ALLOC_QUERY, gather->result, 
+                sizeof(point2D *) * gather->capacity);
+            assert(gather->result);
+        }
+        memcpy(gather->result + gather->count, part, sizeof(point2D *) * count);
+        gather->count += count;
+    }
+    trackedFree(ALLOC_QUERY, part);
+}
+
+// Returns the gathered results as one NULL-terminated array; copied points last until the
+// calling thread's next gather
+static point2D **finishGather(shardGather *gather) {
+    if (gather->copying) {
+        gather->result = (point2D **)trackedMalloc(ALLOC_QUERY, 
+            sizeof(point2D *) * (gather->count + 1));
+        assert(gather->result);
+        for (size_t i = 0; i < gather->count; i++) {
+            gather->result[i] = &gather->copies->points[i];
+        }
+    } else if (!gather->result) {
+        gather->result = (point2D **)trackedMalloc(ALLOC_QUERY, sizeof(point2D *));
+        assert(gather->result);
+    }
+    gather->result[gather->count] = NULL;
+
+    return gather->result;
+}
+
+// Gives the index a way to recover a record's points
+void indexSetPointResolver(spatialIndex *index, pointResolver resolve) {
+    for (int i = 0; i < index->numShards; i++) {
+        indexSetPointResolver(index->shards[i], resolve);
+    }
+    if (index->engine == ENGINE_COMPACT) {
+        linearSetCompact(index->lqt, resolve);
+    }
+}
+
+// Stores a disk index's pages in the file at path, caching at most cacheBytes of them per tree
+int indexSetPageStorage(spatialIndex *index, const char *path, size_t cacheBytes) {
+    for (int i = 0; i < index->numShards; i++) {
+        char *shardPath = NULL;
+        if (path) {
+            shardPath = (char *)trackedMalloc(ALLOC_TREE, strlen(path) + 16);
+            assert(shardPath);
+            sprintf(shardPath, "%s.%d", path, i);
+        }
+        int opened = indexSetPageStorage(index->shards[i], shardPath, cacheBytes);
+        trackedFree(ALLOC_TREE, shardPath);
+        if (!opened) {
+            return 0;
+        }
+    }
+
+    // A sharded index's own tree stays empty, so it needs no named file
+    if (index->pqt) {
+        return pagedSetStorage(index->pqt, index->numShards > 0 ? NULL : path, cacheBytes);
+    }
+    return 1;
+}
+
+// Adds a point given with its 2D coordinates to the index
+int indexAddPoint(spatialIndex *index, point2D *point) {
+    index->generation++;
+
+    if (index->numShards > 0) {
+        return indexAddPoint(index->shards[0], point);
+    }
+
+    int added;
+    if (index->engine == ENGINE_POINTER) {
+        added = addPoint(index->qt, point);
+    } else if (index->engine == ENGINE_SPECIALISED) {
+        added = footpathAddPoint(index->fqt, point);
+    } else if (index->engine == ENGINE_DISK) {
+        added = pagedAddPoint(index->pqt, point);
+    } else {
+        added = linearAddPoint(index->lqt, point);
+    }
+
+    // The bounding box only grows, so queries are sent to every shard that may hold a hit
+    if (added && !index->hasPoints) {
+        index->minX = index->maxX = point->x;
+        index->minY = index->maxY = point->y;
+        index->hasPoints = 1;
+    } else if (added) {
+        index->minX = point->x < index->minX ? point->x : index->minX;
+        index->maxX = point->x > index->maxX ? point->x : index->maxX;
+        index->minY = point->y < index->minY ? point->y : index->minY;
+        index->maxY = point->y > index->maxY ? point->y : index->maxY;
+    }
+
+    return added;
+}
+
+// Returns 1 (TRUE) if the index keeps the points added to it
+int indexKeepsPoints(spatialIndex *index) {
+    return index->engine != ENGINE_COMPACT && index->engine != ENGINE_DISK;
+}
+
+// Finishes building the index once all points have been added
+void indexBuild(spatialIndex *index) {
+    index->generation++;
+
+    for (int i = 0; i < index->numShards; i++) {
+        indexBuild(index->shards[i]);
+    }
+    if (index->numShards > 0) {
+        return;
+    }
+
+    // The linear engines sort their entries and the disk engine's tree is written out; the other
+    // quadtrees are built as points are added
+    if (index->lqt) {
+        linearBuild(index->lqt);
+    }
+    if (index->pqt) {
+        pagedBuild(index->pqt);
+    }
+}
+
+// Frees the index, its shards and every point it keeps, leaving the root rectangle to the caller
+void freeSpatialIndex(spatialIndex *index) {
+    if (!index) {
+        return;
+    }
+
+    for (int i = 0; i < index->numShards; i++) {
+        freeSpatialIndex(index->shards[i]);
+    }
+    trackedFree(ALLOC_TREE, index->shards);
+
+    // Linear trees leave their points to the index; compact trees keep none
+    if (index->lqt && !index->lqt->compact) {
+        for (size_t i = 0; i < index->lqt->numEntries; i++) {
+            freePoint(index->lqt->entries[i].point);
+        }
+    }
+    freeLinearQuadtree(index->lqt);
+    freeQuadtree(index->qt);
+    freeFootpathTree(index->fqt);
+    freePagedQuadtree(index->pqt);
+    trackedFree(ALLOC_TREE, index);
+}
+
+// Frees the points the calling thread's last searches of compact, disk and sharded indexes returned
+void indexReleaseResults(void) {
+    linearReleaseResults();
+    pagedReleaseResults();
+    pthread_once(&gatheredOnce, createGatheredKey);
+    freeGathered(pthread_getspecific(gatheredKey));
+    pthread_setspecific(gatheredKey, NULL);
+}
+
+// Returns all datapoints within the rectangle from an unsharded index of an engine other than the
+// pointer one, printing the quadrants explored where the engine has them
+static point2D **searchRange(spatialIndex *index, rectangle2D *range, FILE *summaryFile) {
+    if (index->fqt) {
+        return footpathRangeQuery(index->fqt, range, summaryFile);
+    }
+    if (index->pqt) {
+        return pagedRangeQuery(index->pqt, range, summaryFile);
+    }
+
+    // The linear engines have no explicit nodes, so no quadrants are printed
+    return linearSearchPoint(index->lqt, range, NULL);
+}
+
+// Returns the datapoints lying within the (point-sized) query rectangle
+point2D **indexSearchPoint(spatialIndex *index, rectangle2D *range, point2D *search) {
+    if (index->numShards > 0) {
+        shardGather gather = newShardGather(index);
+        for (int i = 0; i < index->numShards; i++) {
+            if (shardMayHold(index->shards[i], range)) {
+                gatherShard(&gather, indexSearchPoint(index->shards[i], range, search));
+            }
+        }
+        return finishGather(&gather);
+    }
+
+    if (index->lqt) {
+        return linearSearchPoint(index->lqt, range, search);
+    }
+    if (index->engine != ENGINE_POINTER) {
+        return searchRange(index, range, NULL);
+    }
+
+    return searchPoint(index->qt, range, search);
+}
+
+// Returns all datapoints lying within the query rectangle
+point2D **indexRangeQuery(spatialIndex *index, rectangle2D *range, FILE *summaryFile) {
+    if (index->numShards > 0) {
+        return indexRangeQueryFiltered(index, range, NULL, summaryFile);
+    }
+
+    if (index->engine != ENGINE_POINTER) {
+        return searchRange(index, range, summaryFile);
+    }
+
+    return rangeQuery(index->qt, range, summaryFile);
+}
+
+// Returns the datapoints lying within the query rectangle which pass the filter
+point2D **indexRangeQueryFiltered(spatialIndex *index, rectangle2D *range, pointFilter *filter, 
+    FILE *summaryFile) {
+
+    // Each shard searched prints its quadrants in turn
+    if (index->numShards > 0) {
+        shardGather gather = newShardGather(index);
+        for (int i = 0; i < index->numShards; i++) {
+            if (shardMayHold(index->shards[i], range)) {
+                gatherShard(&gather, indexRangeQueryFiltered(index->shards[i], range, filter, summaryFile));
+            }
+        }
+        return finishGather(&gather);
+    }
+
+    if (index->engine == ENGINE_POINTER) {
+        return rangeQueryFiltered(index->qt, range, filter, summaryFile);
+    }
+
+    // The other engines have no summaries to prune with, so their matching points are filtered 
+    // afterwards; only the specialised and disk quadtrees have quadrants to print
+    point2D **res = searchRange(index, range, summaryFile);
+    size_t kept = 0;
+    for (size_t i = 0; res[i] != NULL; i++) {
+        if (!filter || filter->test(res[i], filter->arg)) {
+            res[kept++] = res[i];
+        }
+    }
+    res[kept] = NULL;
+
+    return res;
+}
+
+/* A query of a batch keyed on the Z-order position of its centre */
+typedef struct batchOrder {
+    uint64_t code;
+    size_t query;
+} batchOrder;
+
+/* Results of a batch gathered from each shard in turn */
+typedef struct batchGather {
+    shardGather *gathers;
+    size_t *queries;
+} batchGather;
+
+// Orders queries along the Z-order curve, ties in the order given
+static int compareBatchOrder(const void *a, const void *b) {
+    const batchOrder *x = (const batchOrder *)a;
+    const batchOrder *y = (const batchOrder *)b;
+    if (x->code != y->code) {
+        return x->code < y->code ? -1 : 1;
+    }
+    return x->query < y->query ? -1 : x->query > y->query;
+}
+
+// Adds a shard's result for a query of the batch to the query's gather
+static void gatherBatchResult(size_t query, point2D **result, void *arg) {
+    batchGather *batch = (batchGather *)arg;
+    gatherShard(&batch->gathers[batch->queries[query]], result);
+}
+
+// Answers a batch of range queries, visiting them in Z-order of their centres
+void indexRangeQueryBatch(spatialIndex *index, batchQuery *queries, size_t numQueries, 
+    batchResultFn done, void *arg) {
+
+    batchOrder *order = (batchOrder *)trackedMalloc(ALLOC_QUERY, 
+        sizeof(batchOrder) * (numQueries + 1));
+    batchQuery *sorted = (batchQuery *)trackedMalloc(ALLOC_QUERY, 
+        sizeof(batchQuery) * (numQueries + 1));
+    assert(order && sorted);
+    for (size_t i = 0; i < numQueries; i++) {
+        order[i].code = mortonCode(index->boundary, queries[i].range->center);
+        order[i].query = i;
+    }
+    qsort(order, numQueries, sizeof(batchOrder), compareBatchOrder);
+    for (size_t i = 0; i < numQueries; i++) {
+        sorted[i] = queries[order[i].query];
+    }
+
+    if (index->numShards > 0 && indexKeepsPoints(index)) {
+        // Each shard answers its share of the batch in one traversal, appending to the 
+        // results of the shards before it as a single query does
+        shardGather *gathers = (shardGather *)trackedMalloc(ALLOC_QUERY, 
+            sizeof(shardGather) * (numQueries + 1));
+        size_t *queryOf = (size_t *)trackedMalloc(ALLOC_QUERY, sizeof(size_t) * (numQueries + 1));
+        batchQuery *share = (batchQuery *)trackedMalloc(ALLOC_QUERY, 
+            sizeof(batchQuery) * (numQueries + 1));
+        assert(gathers && queryOf && share);
+        for (size_t i = 0; i < numQueries; i++) {
+            gathers[i] = newShardGather(index);
+        }
+        batchGather batch = {gathers, queryOf};
+
+        for (int s = 0; s < index->numShards; s++) {
+            size_t numShare = 0;
+            for (size_t i = 0; i < numQueries; i++) {
+                if (shardMayHold(index->shards[s], sorted[i].range)) {
+                    queryOf[numShare] = i;
+                    share[numShare++] = sorted[i];
+                }
+            }
+            indexRangeQueryBatch(index->shards[s], share, numShare, gatherBatchResult, &batch);
+        }
+        for (size_t i = 0; i < numQueries; i++) {
+            done(order[i].query, finishGather(&gathers[i]), arg);
+        }
+        trackedFree(ALLOC_QUERY, gathers);
+        trackedFree(ALLOC_QUERY, queryOf);
+        trackedFree(ALLOC_QUERY, share);
+    } else if (index->numShards == 0 && index->engine == ENGINE_POINTER) {
+        rangeQueryBatch(index->qt, sorted, numQueries);
+        for (size_t i = 0; i < numQueries; i++) {
+            done(order[i].query, sorted[i].result, arg);
+        }
+    } else {
+        // Other indexes answer the queries one by one, still in Z-order so neighbouring
+        // queries reuse the entries the last one brought into cache
+        for (size_t i = 0; i < numQueries; i++) {
+            done(order[i].query, indexRangeQueryFiltered(index, sorted[i].range, 
+                sorted[i].filter, sorted[i].summaryFile), arg);
+        }
+    }
+
+    trackedFree(ALLOC_QUERY, order);
+    trackedFree(ALLOC_QUERY, sorted);
+}
+
+/* A range query run in legs; only the unsharded pointer engine has nodes to stop between */
+struct indexCursor {
+    spatialIndex *index;
+    rangeCursor *tree;
+    point2D center;
+    rectangle2D range;
+    pointFilter *filter;
+    int done;
+};
+
+// Starts a range query over the index which may be run in several legs
+indexCursor *newIndexCursor(spatialIndex *index, rectangle2D *range, pointFilter *filter) {
+    indexCursor *cursor = (indexCursor *)trackedMalloc(ALLOC_QUERY, sizeof(indexCursor));
+    assert(cursor);
+
+    cursor->index = index;
+    cursor->tree = NULL;
+    cursor->center = *range->center;
+    cursor->range = *range;
+    cursor->range.center = &cursor->center;
+    cursor->filter = filter;
+    cursor->done = 0;
+    if (index->numShards == 0 && index->engine == ENGINE_POINTER) {
+        cursor->tree = newRangeCursor(index->qt, range, filter);
+    }
+
+    return cursor;
+}
+
+// Runs the next leg of an index cursor within the budget
+point2D **indexCursorNext(indexCursor *cursor, queryBudget *budget, FILE *summaryFile, 
+    int *status) {
+
+    *status = RANGE_COMPLETE;
+    if (cursor->tree) {
+        point2D **result;
+        *status = rangeCursorNext(cursor->tree, budget, summaryFile, &result);
+        cursor->done = rangeCursorDone(cursor->tree);
+        return result;
+    }
+
+    // Other indexes answer the whole query in its first leg
+    if (!cursor->done) {
+        cursor->done = 1;
+        return indexRangeQueryFiltered(cursor->index, &cursor->range, cursor->filter, summaryFile);
+    }
+    point2D **result = (point2D **)trackedMalloc(ALLOC_QUERY, sizeof(point2D *));
+    assert(result);
+    result[0] = NULL;
+    return result;
+}
+
+// Returns 1 (TRUE) once an index cursor has found every datapoint of its query
+int indexCursorDone(indexCursor *cursor) {
+    return cursor->done;
+}
+
+// Frees an index cursor
+void freeIndexCursor(indexCursor *cursor) {
+    if (!cursor) {
+        return;
+    }
+    freeRangeCursor(cursor->tree);
+    trackedFree(ALLOC_QUERY, cursor);
+}
+
+// Returns the datapoints inserted under the tile
+point2D **indexTileQuery(spatialIndex *index, int zoom, uint32_t x, uint32_t y) {
+    point2D center;
+    rectangle2D tile = {&center, 0, 0};
+    if (!tileRectangle(index->boundary, zoom, x, y, &tile)) {
+        point2D **res = (point2D **)trackedMalloc(ALLOC_QUERY, sizeof(point2D *));
+        assert(res);
+        res[0] = NULL;
+        return res;
+    }
+
+    if (index->numShards > 0) {
+        shardGather gather = newShardGather(index);
+        for (int i = 0; i < index->numShards; i++) {
+            if (shardMayHold(index->shards[i], &tile)) {
+                gatherShard(&gather, indexTileQuery(index->shards[i], zoom, x, y));
+            }
+        }
+        return finishGather(&gather);
+    }
+
+    if (index->engine == ENGINE_POINTER) {
+        return tileQuery(index->qt, zoom, x, y);
+    }
+
+    // The other engines search the tile's rectangle, keeping the points which the pointer
+    // quadtree would insert under the tile rather than a neighbour sharing its edge
+    point2D **res = searchRange(index, &tile, NULL);
+    size_t kept = 0;
+    for (size_t i = 0; res[i] != NULL; i++) {
+        uint32_t px, py;
+        if (tileOf(index->boundary, zoom, res[i], &px, &py) && px == x && py == y) {
+            res[kept++] = res[i];
+        }
+    }
+    res[kept] = NULL;
+
+    return res;
+}
+
+// Returns the number of datapoints lying within the query rectangle, without collecting them
+size_t indexRangeCount(spatialIndex *index, rectangle2D *range) {
+    if (index->numShards > 0) {
+        size_t count = 0;
+        for (int i = 0; i < index->numShards; i++) {
+            if (shardMayHold(index->shards[i], range)) {
+                count += indexRangeCount(index->shards[i], range);
+            }
+        }
+        return count;
+    }
+
+    if (index->engine == ENGINE_SPECIALISED) {
+        return footpathRangeCount(index->fqt, range);
+    }
+    if (index->engine == ENGINE_DISK) {
+        return pagedRangeCount(index->pqt, range);
+    }
+    if (index->engine != ENGINE_POINTER) {
+        return linearRangeCount(index->lqt, range);
+    }
+
+    return rangeCount(index->qt, range);
+}
+
+// Enables aggregate range queries over the columns in the spec
+void indexEnableAggregates(spatialIndex *index, aggregateSpec *spec) {
+    index->aggSpec = spec;
+
+    for (int i = 0; i < index->numShards; i++) {
+        indexEnableAggregates(index->shards[i], spec);
+    }
+    if (index->engine == ENGINE_POINTER) {
+        enableAggregates(index->qt, spec);
+    }
+}
+
+// Keeps per-node summaries of the columns in the spec for filtered queries to prune with
+void indexEnableSummaries(spatialIndex *index, aggregateSpec *spec) {
+    index->summarySpec = spec;
+
+    for (int i = 0; i < index->numShards; i++) {
+        indexEnableSummaries(index->shards[i], spec);
+    }
+    if (index->engine == ENGINE_POINTER) {
+        enableSummaries(index->qt, spec);
+    }
+}
+
+// Summarises the counted datapoints within the query rectangle
+int indexRangeAggregate(spatialIndex *index, rectangle2D *range, nodeAggregate *out) {
+    aggregateInit(out);
+
+    if (!index->aggSpec) {
+        return 0;
+    }
+
+    // Shards' summaries are merged as a node merges its children's
+    if (index->numShards > 0) {
+        for (int i = 0; i < index->numShards; i++) {
+            nodeAggregate part;
+            if (shardMayHold(index->shards[i], range) && 
+                indexRangeAggregate(index->shards[i], range, &part)) {
+                aggregateMerge(out, index->aggSpec->numColumns, &part);
+            }
+        }
+        return 1;
+    }
+
+    if (index->engine == ENGINE_POINTER) {
+        return rangeAggregate(index->qt, range, out);
+    }
+
+    // The other engines keep no summaries, so their matching points are summarised directly
+    point2D **res = searchRange(index, range, NULL);
+    for (size_t i = 0; res[i] != NULL; i++) {
+        aggregateAddPoint(out, index->aggSpec, res[i]);
+    }
+    trackedFree(ALLOC_QUERY, res);
+
+    return 1;
+}
+
+// Prints the size and shape statistics of the index
+void indexPrintStats(spatialIndex *index, FILE *f) {
+    if (index->numShards > 0) {
+        fprintf(f, "shards: %d\n", index->numShards);
+        for (int i = 0; i < index->numShards; i++) {
+            fprintf(f, "shard: %d\n", i);
+            indexPrintStats(index->shards[i], f);
+        }
+        return;
+    }
+
+    if (index->engine == ENGINE_SPECIALISED) {
+        fprintf(f, "engine: specialised\n");
+        printFootpathTreeStats(index->fqt, f);
+        return;
+    }
+    if (index->engine == ENGINE_DISK) {
+        fprintf(f, "engine: disk\n");
+        printPagedQuadtreeStats(index->pqt, f);
+        return;
+    }
+
+    if (index->engine != ENGINE_POINTER) {
+        LinearQuadTree *lqt = index->lqt;
+        size_t entryBytes = sizeof(mortonEntry) * lqt->capacity;
+
+        // Compact trees keep neither points nor coordinate copies
+        size_t pointBytes = lqt->compact ? 0 : sizeof(point2D) * lqt->numEntries;
+        size_t coordinateBytes = lqt->xs ? 2 * sizeof(double) * (lqt->numEntries + 1) : 0;
+
+        fprintf(f, "engine: %s\n", lqt->compact ? "compact" : "linear");
+        fprintf(f, "points: %zu\n", lqt->numEntries);
+        fprintf(f, "bytes_entries: %zu\n", entryBytes);
+        fprintf(f, "bytes_points: %zu\n", pointBytes);
+        fprintf(f, "bytes_coordinates: %zu\n", coordinateBytes);
+        fprintf(f, "bytes_total: %zu\n", entryBytes + pointBytes + coordinateBytes + 
+            sizeof(LinearQuadTree));
+        return;
+    }
+
+    treeStats stats;
+    quadtree_stats(index->qt, &stats);
+
+    fprintf(f, "engine: pointer\n");
+    printQuadtreeStats(&stats, f);
+}
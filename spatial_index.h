@@ -0,0 +1,150 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <stdio.h>
+#include "quadtree.h"
+#include "linear_quadtree.h"
+#include "footpath_quadtree.h"
+#include "paged_quadtree.h"
+
+/* Index engines selectable from the driver */
+#define ENGINE_POINTER 0
+#define ENGINE_LINEAR 1
+#define ENGINE_COMPACT 2
+#define ENGINE_SPECIALISED 3
+#define ENGINE_DISK 4
+#define ENGINE_UNKNOWN (-1)
+
+// data definitions
+typedef struct spatialIndex {
+    int engine;
+    rectangle2D *boundary;
+    QuadTree *qt;
+    LinearQuadTree *lqt;
+    footpathTree *fqt;
+    PagedQuadTree *pqt;
+    /* Columns summarised by aggregate queries, or NULL */
+    aggregateSpec *aggSpec;
+    /* Columns summarised per node to prune filtered queries, or NULL */
+    aggregateSpec *summarySpec;
+    /* Bumped whenever a point is added or the index is built, so cached results can tell 
+    they are stale */
+    size_t generation;
+    /* Bounding box of the points added, which decides the queries a shard takes part in */
+    int hasPoints;
+    long double minX;
+    long double minY;
+    long double maxX;
+    long double maxY;
+    /* Indexes over the same root rectangle that a sharded index queries in its place, or NULL */
+    int numShards;
+    struct spatialIndex **shards;
+} spatialIndex;
+
+/* A range query over an index which may be run in several legs within budgets */
+typedef struct indexCursor indexCursor;
+
+/* Receives the result of query i of a batch */
+typedef void (*batchResultFn)(size_t i, point2D **result, void *arg);
+
+// function definitions
+
+/* Returns the engine named by the given string, or ENGINE_UNKNOWN */
+int parseEngine(const char *name);
+
+/* Creates an empty index of the given engine covering the root rectangle */
+spatialIndex *newSpatialIndex(rectangle2D *boundary, int engine);
+
+/* Creates an index split into the given number of empty shards of the engine, each covering the
+whole root rectangle. Shards are filled separately (and may be filled from separate threads)
+through the shards array; queries go to each shard whose points' bounding box meets the query,
+and their results are concatenated. Call indexBuild once every shard is filled */
+spatialIndex *newShardedIndex(rectangle2D *boundary, int engine, int numShards);
+
+/* Gives the index a way to recover a record's points; required by the compact engine, which keeps
+only quantised codes and record references, and must be called before any point is added */
+void indexSetPointResolver(spatialIndex *index, pointResolver resolve);
+
+/* Stores a disk index's pages in the file at path (shard i of a sharded index in "path.i"), or
+in an unlinked temporary file given NULL, caching at most cacheBytes of them per tree (or
+PAGED_DEFAULT_CACHE given 0); does nothing for other engines. Call before any point is added;
+returns 0 (FALSE) if a page file cannot be opened */
+int indexSetPageStorage(spatialIndex *index, const char *path, size_t cacheBytes);
+
+/* Adds a point given with its 2D coordinates to the index, or to the first shard of a sharded index */
+int indexAddPoint(spatialIndex *index, point2D *point);
+
+/* Returns 1 (TRUE) if the index keeps the points added to it, or 0 (FALSE) if the caller may
+free them once added */
+int indexKeepsPoints(spatialIndex *index);
+
+/* Finishes building the index, and any shard not yet built, once all points have been added */
+void indexBuild(spatialIndex *index);
+
+/* Frees the index, its shards and every point added to it that it keeps (see indexKeepsPoints),
+leaving the root rectangle to the caller */
+void freeSpatialIndex(spatialIndex *index);
+
+/* Frees the points the calling thread's last searches of compact, disk and sharded indexes returned,
+which other threads free as they exit; call once the thread is done searching */
+void indexReleaseResults(void);
+
+/* Returns the datapoints lying within the (point-sized) query rectangle as a NULL-terminated array */
+point2D **indexSearchPoint(spatialIndex *index, rectangle2D *range, point2D *search);
+
+/* Returns all datapoints lying within the query rectangle as a NULL-terminated array,
+printing the quadrants explored to the summary file where the engine has them */
+point2D **indexRangeQuery(spatialIndex *index, rectangle2D *range, FILE *summaryFile);
+
+/* Returns the datapoints lying within the query rectangle which pass the filter (if given) as a
+NULL-terminated array, printing the quadrants explored to the summary file where the engine has them */
+point2D **indexRangeQueryFiltered(spatialIndex *index, rectangle2D *range, pointFilter *filter, 
+    FILE *summaryFile);
+
+/* Answers a batch of range queries (whose results are left unset) in Z-order of their centres,
+passing query i's NULL-terminated result to done, which must free the array. The pointer engine
+answers the whole batch in one traversal; each query gets the result and printed quadrants
+indexRangeQueryFiltered would give it, its points valid until the calling thread's next search */
+void indexRangeQueryBatch(spatialIndex *index, batchQuery *queries, size_t numQueries, 
+    batchResultFn done, void *arg);
+
+/* Starts a range query over the index which may be run in several legs. The filter (if given)
+must last as long as the cursor */
+indexCursor *newIndexCursor(spatialIndex *index, rectangle2D *range, pointFilter *filter);
+
+/* Runs the next leg of the cursor's query within the budget, returning the datapoints found as a
+NULL-terminated array and setting status to RANGE_COMPLETE or why the leg stopped. The
+unsharded pointer engine resumes from the nodes it had still to visit; other indexes ignore the
+budget and answer the whole query in the first leg. Points are valid until the calling thread's
+next search */
+point2D **indexCursorNext(indexCursor *cursor, queryBudget *budget, FILE *summaryFile, 
+    int *status);
+
+/* Returns 1 (TRUE) once the cursor has found every datapoint of its query */
+int indexCursorDone(indexCursor *cursor);
+
+/* Frees an index cursor */
+void freeIndexCursor(indexCursor *cursor);
+
+/* Returns the datapoints inserted under tile x, y (counted from the west and north edges) of the
+root rectangle divided into 2^zoom by 2^zoom tiles, as a NULL-terminated array */
+point2D **indexTileQuery(spatialIndex *index, int zoom, uint32_t x, uint32_t y);
+
+/* Returns the number of datapoints lying within the query rectangle, without collecting them */
+size_t indexRangeCount(spatialIndex *index, rectangle2D *range);
+
+/* Enables aggregate range queries over the columns in the spec; call before any point is added */
+void indexEnableAggregates(spatialIndex *index, aggregateSpec *spec);
+
+/* Keeps per-node summaries of the columns in the spec for filtered queries to prune with, where the
+engine has nodes; call before any point is added */
+void indexEnableSummaries(spatialIndex *index, aggregateSpec *spec);
+
+/* Summarises the counted datapoints within the query rectangle; returns 0 (FALSE) if
+aggregates are not enabled */
+int indexRangeAggregate(spatialIndex *index, rectangle2D *range, nodeAggregate *out);
+
+/* Prints the size and shape statistics of the index */
+void indexPrintStats(spatialIndex *index, FILE *f);
+
+#endif